@@ -0,0 +1,171 @@
+#include "BVHBuilder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+
+static float surfaceArea(glm::vec3 min, glm::vec3 max) {
+	glm::vec3 d = max - min;
+	return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+BVHBuilder::BVHBuilder(BVHSplit split, uint32_t seed, int leafSize) {
+	this->split = split;
+	this->state = seed ? seed : 1;
+	this->leafSize = std::max(1, leafSize);
+}
+
+const char* BVHBuilder::SplitName(BVHSplit split) {
+	return split == BVH_SPLIT_SAH ? "sah" : "median";
+}
+
+int BVHBuilder::Depth(const std::vector<BVHBuffer>& bvhs, int node) {
+	if (bvhs.empty()) return 0;
+	const BVHBuffer& b = bvhs[node];
+	if (b.type != BVH_TYPE_BVH) return 1;
+	return 1 + std::max(Depth(bvhs, b.left_index), Depth(bvhs, b.right_index));
+}
+
+std::vector<BVHBuffer> BVHBuilder::Build(const std::vector<SpheresBuffer>& spheres) {
+	items.clear();
+	nodes.clear();
+	order.clear();
+	if (spheres.empty()) return nodes;
+
+	// negative radii are hollow spheres, their bounds are the same
+	for (int i = 0; i < (int)spheres.size(); i++) {
+		glm::vec3 r(fabs(spheres[i].radius));
+		Item item;
+		item.min = spheres[i].position - r;
+		item.max = spheres[i].position + r;
+		item.centre = spheres[i].position;
+		item.sphereIndex = i;
+		items.push_back(item);
+	}
+
+	nodes.reserve(items.size() * 2 - 1);
+	build(0, (int)items.size(), 0);
+	for (const Item& item : items) order.push_back(item.sphereIndex);
+	items.clear();
+	return std::move(nodes);
+}
+
+int BVHBuilder::build(int start, int end, int depth) {
+	int index = (int)nodes.size();
+	nodes.push_back(BVHBuffer());
+
+	if (end - start == 1 && leafSize == 1) {
+		BVHBuffer& leaf = nodes[index];
+		leaf.AABBmin = items[start].min;
+		leaf.AABBmax = items[start].max;
+		leaf.left_index = leaf.right_index = items[start].sphereIndex;
+		leaf.type = BVH_TYPE_SPHERE;
+		return index;
+	}
+	if (end - start <= leafSize) {
+		BVHBuffer& leaf = nodes[index];
+		leaf.AABBmin = glm::vec3(FLT_MAX);
+		leaf.AABBmax = glm::vec3(-FLT_MAX);
+		for (int i = start; i < end; i++) {
+			leaf.AABBmin = glm::min(leaf.AABBmin, items[i].min);
+			leaf.AABBmax = glm::max(leaf.AABBmax, items[i].max);
+		}
+		leaf.left_index = start;
+		leaf.right_index = end - start;
+		leaf.type = BVH_TYPE_CLUSTER;
+		return index;
+	}
+
+	int mid = (split == BVH_SPLIT_SAH && depth < BVH_SAH_MAX_DEPTH) ? splitSAH(start, end) : splitMedian(start, end);
+	int left = build(start, mid, depth + 1);
+	int right = build(mid, end, depth + 1);
+
+	// children were pushed after this node, so take the reference again
+	BVHBuffer& node = nodes[index];
+	node.AABBmin = glm::min(nodes[left].AABBmin, nodes[right].AABBmin);
+	node.AABBmax = glm::max(nodes[left].AABBmax, nodes[right].AABBmax);
+	node.left_index = left;
+	node.right_index = right;
+	node.type = BVH_TYPE_BVH;
+	return index;
+}
+
+int BVHBuilder::splitMedian(int start, int end) {
+	int axis = nextRandom() % 3;
+	int mid = start + (end - start) / 2;
+	std::nth_element(items.begin() + start, items.begin() + mid, items.begin() + end, [axis](const Item& a, const Item& b) {
+		return a.min[axis] < b.min[axis];
+	});
+	return mid;
+}
+
+int BVHBuilder::splitSAH(int start, int end) {
+	glm::vec3 cmin(FLT_MAX), cmax(-FLT_MAX);
+	for (int i = start; i < end; i++) {
+		cmin = glm::min(cmin, items[i].centre);
+		cmax = glm::max(cmax, items[i].centre);
+	}
+	glm::vec3 extent = cmax - cmin;
+	int axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z ? 1 : 2);
+	// every centre in the same place, nothing to choose between
+	if (extent[axis] <= 0.0f) return splitMedian(start, end);
+
+	int counts[BVH_SAH_BINS] = {};
+	glm::vec3 binMin[BVH_SAH_BINS], binMax[BVH_SAH_BINS];
+	for (int b = 0; b < BVH_SAH_BINS; b++) {
+		binMin[b] = glm::vec3(FLT_MAX);
+		binMax[b] = glm::vec3(-FLT_MAX);
+	}
+
+	float scale = BVH_SAH_BINS / extent[axis];
+	auto binOf = [&](const Item& item) {
+		return std::min(BVH_SAH_BINS - 1, (int)((item.centre[axis] - cmin[axis]) * scale));
+	};
+	for (int i = start; i < end; i++) {
+		int b = binOf(items[i]);
+		counts[b]++;
+		binMin[b] = glm::min(binMin[b], items[i].min);
+		binMax[b] = glm::max(binMax[b], items[i].max);
+	}
+
+	// sweep from the right for the cost of everything past each plane
+	float rightCost[BVH_SAH_BINS];
+	glm::vec3 rmin(FLT_MAX), rmax(-FLT_MAX);
+	int rcount = 0;
+	for (int b = BVH_SAH_BINS - 1; b > 0; b--) {
+		rcount += counts[b];
+		rmin = glm::min(rmin, binMin[b]);
+		rmax = glm::max(rmax, binMax[b]);
+		rightCost[b] = rcount ? rcount * surfaceArea(rmin, rmax) : 0.0f;
+	}
+
+	glm::vec3 lmin(FLT_MAX), lmax(-FLT_MAX);
+	int lcount = 0;
+	int best = -1;
+	float bestCost = FLT_MAX;
+	for (int b = 1; b < BVH_SAH_BINS; b++) {
+		lcount += counts[b - 1];
+		lmin = glm::min(lmin, binMin[b - 1]);
+		lmax = glm::max(lmax, binMax[b - 1]);
+		if (lcount == 0 || lcount == end - start) continue;
+		float cost = lcount * surfaceArea(lmin, lmax) + rightCost[b];
+		if (cost < bestCost) {
+			bestCost = cost;
+			best = b;
+		}
+	}
+	if (best < 0) return splitMedian(start, end);
+
+	auto it = std::partition(items.begin() + start, items.begin() + end, [&](const Item& item) {
+		return binOf(item) < best;
+	});
+	return (int)(it - items.begin());
+}
+
+// xorshift, so a seed gives the same tree on every platform
+uint32_t BVHBuilder::nextRandom() {
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "BuffersStructs.h"
+
+#include <vector>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+// bins tried per node by the sah split
+#define BVH_SAH_BINS 12
+// below this depth the sah builder is free to make lopsided splits, past it every
+// node is a median split so the tree still fits the tracers' traversal stacks
+#define BVH_SAH_MAX_DEPTH 40
+
+enum BVHSplit {
+	BVH_SPLIT_MEDIAN, // random axis, half the spheres on each side
+	BVH_SPLIT_SAH // binned surface area heuristic on the widest centroid axis
+};
+
+// builds the flattened tree raytrace.frag and Tracer walk: nodes are stored depth first,
+// a leaf is a BVH_TYPE_SPHERE node with both indices pointing at its sphere.
+// raytrace.frag sizes its stack for a balanced tree, so the viewer only uses median splits.
+// with a leaf size above 1 leaves are BVH_TYPE_CLUSTER nodes of up to that many spheres, holding
+// their range of getOrder() until SphereStore::Build packs them
+class BVHBuilder
+{
+public:
+	BVHBuilder(BVHSplit split = BVH_SPLIT_MEDIAN, uint32_t seed = 1, int leafSize = 1);
+	std::vector<BVHBuffer> Build(const std::vector<SpheresBuffer>& spheres);
+	// sphere indices in leaf order, from the last Build
+	const std::vector<int>& getOrder() const { return order; };
+
+	static const char* SplitName(BVHSplit split);
+	static int Depth(const std::vector<BVHBuffer>& bvhs, int node = 0);
+private:
+	struct Item {
+		glm::vec3 min, max, centre;
+		int sphereIndex;
+	};
+
+	BVHSplit split;
+	uint32_t state;
+	int leafSize;
+	std::vector<Item> items;
+	std::vector<int> order;
+	std::vector<BVHBuffer> nodes;
+
+	int build(int start, int end, int depth);
+	int splitMedian(int start, int end);
+	int splitSAH(int start, int end);
+	uint32_t nextRandom();
+};
@@ -0,0 +1,396 @@
+// reproducible benchmarks of the CPU backends over the canonical scenes in SceneLibrary.
+// everything is seeded, so two runs trace the same rays through the same trees.
+//
+// Benchmark [--scenes balls,surface] [--repeats 7] [--quick] [--out benchmark.json]
+//           [--baseline old.json] [--threshold 0.1]
+//
+// with a baseline, exits with 1 if any result is more than threshold slower than it
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "SceneLibrary.h"
+#include "BVHBuilder.h"
+#include "Tracer.h"
+#include "SphereStore.h"
+#include "CpuRenderer.h"
+#include "Sampler.h"
+#include "RenderBuffers.h"
+
+#define BENCH_SEED 1
+// build times under this are too short to compare against a baseline
+#define BENCH_MIN_BUILD_MS 2.0
+// ray sphere tests per repeat of the brute force kernel benchmarks
+#define BENCH_KERNEL_TESTS 20000000
+
+struct BenchResult {
+	std::string key; // scene/backend/bvh
+	std::string unit; // "Mrays/s" is higher is better, "ms" lower is better
+	double median = 0.0, p10 = 0.0, p90 = 0.0;
+	unsigned long long rays = 0;
+	size_t bvhBytes = 0, sphereBytes = 0, materialBytes = 0;
+	int bvhNodes = 0, bvhDepth = 0;
+};
+
+struct BenchOptions {
+	std::vector<std::string> scenes = SceneLibrary::Names();
+	int repeats = 7;
+	int width = 320, height = 180;
+	int samples = 4, depth = 8;
+	std::string out = "benchmark.json";
+	std::string baseline;
+	double threshold = 0.1;
+};
+
+static double percentile(std::vector<double> values, double q) {
+	std::sort(values.begin(), values.end());
+	double i = q * (values.size() - 1);
+	size_t lo = (size_t)i;
+	size_t hi = std::min(lo + 1, values.size() - 1);
+	return values[lo] + (values[hi] - values[lo]) * (i - lo);
+}
+
+static void summarise(BenchResult& result, const std::vector<double>& values) {
+	result.median = percentile(values, 0.5);
+	result.p10 = percentile(values, 0.1);
+	result.p90 = percentile(values, 0.9);
+}
+
+template <typename F>
+static double timeMs(F f) {
+	auto start = std::chrono::high_resolution_clock::now();
+	f();
+	auto end = std::chrono::high_resolution_clock::now();
+	return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// camera rays, then one bounce ray per camera hit like a shadow or ao ray would be, as in RayQueryBenchmark
+static std::vector<Ray> makeRays(const CameraBuffer& cam, const Tracer& tracer, int width, int height) {
+	std::mt19937 rng(BENCH_SEED);
+	auto rand01 = [&]() { return (float)(rng() >> 8) / 16777216.0f; };
+
+	std::vector<Ray> rays;
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			glm::vec3 pixel = cam.viewportTopLeft + (float)x * cam.du + (float)y * cam.dv;
+			Ray r(cam.position, pixel - cam.position);
+			rays.push_back(r);
+
+			HitRecord rec;
+			if (tracer.Hit(r, 0.001f, INFINITY, rec)) {
+				float dx = rand01(), dy = rand01(), dz = rand01();
+				glm::vec3 d = glm::vec3(dx, dy, dz) * 2.0f - glm::vec3(1, 1, 1);
+				rays.push_back(Ray(rec.p, glm::dot(d, rec.normal) < 0 ? -d : d));
+			}
+		}
+	}
+	return rays;
+}
+
+// Tracer::hitSphere over the whole SpheresBuffer array like hitWorld does
+static int closestAoS(const std::vector<SpheresBuffer>& spheres, const Ray& r, float tmin, float tmax) {
+	int closest = -1;
+	float a = glm::dot(r.direction, r.direction);
+	for (int i = 0; i < (int)spheres.size(); i++) {
+		glm::vec3 oc = r.origin - spheres[i].position;
+		float halfb = glm::dot(oc, r.direction);
+		float len = glm::length(oc);
+		float radius = fabsf(spheres[i].radius);
+		float c = (len - radius) * (len + radius);
+		float discriminent = halfb * halfb - a * c;
+		if (discriminent < 0) continue;
+
+		float sqrtd = sqrtf(discriminent);
+		float t = (-halfb - sqrtd) / a;
+		if (t <= tmin || tmax <= t) {
+			t = (-halfb + sqrtd) / a;
+			if (t <= tmin || tmax <= t) continue;
+		}
+		closest = i;
+		tmax = t;
+	}
+	return closest;
+}
+
+// one ray against every sphere in the AoS array and in a single SphereStore cluster
+static void runKernels(const std::string& name, const SceneData& scene, const std::vector<Ray>& rays, const BenchOptions& options, std::vector<BenchResult>& results) {
+	size_t count = std::min(rays.size(), std::max((size_t)1, (size_t)BENCH_KERNEL_TESTS / scene.spheres.size()));
+	std::vector<int> indices(scene.spheres.size());
+	for (int i = 0; i < (int)indices.size(); i++) indices[i] = i;
+	SphereStore store;
+	store.AddCluster(scene.spheres, indices.data(), (int)indices.size());
+
+	std::vector<double> aos, soa;
+	int aosHits = 0, soaHits = 0;
+	for (int i = 0; i < options.repeats; i++) {
+		aos.push_back(timeMs([&]() {
+			for (size_t j = 0; j < count; j++) aosHits += closestAoS(scene.spheres, rays[j], 0.001f, INFINITY) >= 0;
+		}));
+		soa.push_back(timeMs([&]() {
+			for (size_t j = 0; j < count; j++) {
+				float tmax = INFINITY;
+				soaHits += store.Hit(0, store.getSize(), rays[j], 0.001f, tmax) >= 0;
+			}
+		}));
+	}
+
+	for (int layout = 0; layout < 2; layout++) {
+		std::vector<double> mrays;
+		for (double t : layout ? soa : aos) mrays.push_back(count / (t * 1000.0));
+		BenchResult r;
+		r.key = name + (layout ? "/kernel/soa" : "/kernel/aos");
+		r.unit = "Mrays/s";
+		r.rays = count;
+		r.sphereBytes = layout ? store.getBytes() : scene.spheres.size() * sizeof(SpheresBuffer);
+		summarise(r, mrays);
+		results.push_back(r);
+	}
+	printf("%-10s kernel %zu rays x %zu spheres (%zu materials), %d lanes, %d/%d hits\n", name.c_str(), count, scene.spheres.size(), scene.materials.size(), SPHERE_LANES, aosHits, soaHits);
+}
+
+static void runScene(const std::string& name, const BenchOptions& options, const BlueNoise& noise, std::vector<BenchResult>& results) {
+	SceneData scene = SceneLibrary::Create(name, BENCH_SEED);
+	CameraBuffer cam = scene.MakeCameraBuffer(glm::uvec2(options.width, options.height));
+	std::vector<Ray> rays;
+
+	for (BVHSplit split : { BVH_SPLIT_MEDIAN, BVH_SPLIT_SAH }) {
+		std::string suffix = std::string("/") + BVHBuilder::SplitName(split);
+
+		std::vector<BVHBuffer> bvhs;
+		std::vector<double> buildTimes, clusterTimes;
+		for (int i = 0; i < options.repeats; i++) {
+			buildTimes.push_back(timeMs([&]() { bvhs = BVHBuilder(split, BENCH_SEED).Build(scene.spheres); }));
+			clusterTimes.push_back(timeMs([&]() { scene.CalculateClusters(split, BENCH_SEED); }));
+		}
+
+		BenchResult build;
+		build.key = name + "/build" + suffix;
+		build.unit = "ms";
+		build.bvhBytes = bvhs.size() * sizeof(BVHBuffer);
+		build.sphereBytes = scene.spheres.size() * sizeof(SpheresBuffer);
+		build.materialBytes = scene.materials.size() * sizeof(MaterialBuffer) + scene.sphereMaterials.size() * sizeof(int);
+		build.bvhNodes = (int)bvhs.size();
+		build.bvhDepth = BVHBuilder::Depth(bvhs);
+		summarise(build, buildTimes);
+		results.push_back(build);
+
+		// the same tree with SphereStore clusters in the leaves
+		BenchResult clusterBuild;
+		clusterBuild.key = name + "/build-soa" + suffix;
+		clusterBuild.unit = "ms";
+		clusterBuild.bvhBytes = scene.clusters.size() * sizeof(BVHBuffer);
+		clusterBuild.sphereBytes = scene.packedSpheres.getBytes();
+		clusterBuild.materialBytes = build.materialBytes;
+		clusterBuild.bvhNodes = (int)scene.clusters.size();
+		clusterBuild.bvhDepth = BVHBuilder::Depth(scene.clusters);
+		summarise(clusterBuild, clusterTimes);
+		results.push_back(clusterBuild);
+
+		Tracer tracer(&scene.spheres, &bvhs);
+		Tracer packedTracer(&scene.spheres, &scene.clusters, &scene.packedSpheres);
+		// the rays only depend on the geometry, so every tree traces the same batch
+		if (rays.empty()) rays = makeRays(cam, tracer, options.width, options.height);
+
+		auto addThroughput = [&](const BenchResult& tree, const char* backend, unsigned long long count, const std::vector<double>& ms) {
+			std::vector<double> mrays;
+			for (double t : ms) mrays.push_back(count / (t * 1000.0));
+			BenchResult r = tree;
+			r.key = name + "/" + backend + suffix;
+			r.unit = "Mrays/s";
+			r.rays = count;
+			summarise(r, mrays);
+			results.push_back(r);
+		};
+
+		int hits = 0, occluded = 0, packedHits = 0, packedOccluded = 0;
+		auto traceAll = [&](const Tracer& t, const BenchResult& tree, const char* closestKey, const char* occlusionKey, int& hitCount, int& occludedCount) {
+			std::vector<double> closest, occlusion;
+			for (int i = 0; i < options.repeats; i++) {
+				closest.push_back(timeMs([&]() {
+					for (auto& r : rays) {
+						HitRecord rec;
+						hitCount += t.Hit(r, 0.001f, INFINITY, rec);
+					}
+				}));
+				occlusion.push_back(timeMs([&]() {
+					for (auto& r : rays) {
+						occludedCount += t.Occluded(r, 0.001f, INFINITY);
+					}
+				}));
+			}
+			addThroughput(tree, closestKey, rays.size(), closest);
+			addThroughput(tree, occlusionKey, rays.size(), occlusion);
+		};
+		traceAll(tracer, build, "closest", "occlusion", hits, occluded);
+		traceAll(packedTracer, clusterBuild, "closest-soa", "occlusion-soa", packedHits, packedOccluded);
+
+		// one thread so the number doesn't depend on the machine's core count,
+		// every path segment is a closest hit and most add a shadow ray
+		for (int packed = 0; packed < 2; packed++) {
+			std::vector<double> pathtrace;
+			unsigned long long segments = 0;
+			for (int i = 0; i < options.repeats; i++) {
+				CpuRenderer renderer = packed ? CpuRenderer(scene, &noise, options.samples, options.depth)
+					: CpuRenderer(&scene.spheres, &scene.materials, &scene.sphereMaterials, &bvhs, &scene.lights, &noise, options.samples, options.depth);
+				RenderBuffers buffers;
+				pathtrace.push_back(timeMs([&]() { renderer.Render(cam, options.width, options.height, buffers, 1); }));
+				segments = (unsigned long long)(renderer.getAveragePathLength() * options.width * options.height * options.samples + 0.5);
+			}
+			addThroughput(packed ? clusterBuild : build, packed ? "pathtrace-soa" : "pathtrace", segments, pathtrace);
+		}
+
+		// keeps the loops from being optimised away, and shows both trees and layouts agree
+		printf("%-10s %-6s %8d nodes, depth %3d, %zu rays, %d hits, %d occluded\n", name.c_str(), BVHBuilder::SplitName(split), build.bvhNodes, build.bvhDepth, rays.size(), hits, occluded);
+		printf("%-10s %-6s %8d nodes, depth %3d, %zu rays, %d hits, %d occluded (soa)\n", name.c_str(), BVHBuilder::SplitName(split), clusterBuild.bvhNodes, clusterBuild.bvhDepth, rays.size(), packedHits, packedOccluded);
+	}
+
+	runKernels(name, scene, rays, options, results);
+}
+
+static void writeJSON(const std::string& path, const std::vector<BenchResult>& results) {
+	std::ofstream out(path, std::ios::out | std::ios::trunc);
+	if (!out) {
+		fprintf(stderr, "Failed to write %s\n", path.c_str());
+		exit(1);
+	}
+	// one result per line, so readBaseline doesn't need a json parser
+	out << "[\n";
+	for (size_t i = 0; i < results.size(); i++) {
+		const BenchResult& r = results[i];
+		out << "  {\"key\": \"" << r.key << "\", \"unit\": \"" << r.unit << "\""
+			<< ", \"median\": " << r.median << ", \"p10\": " << r.p10 << ", \"p90\": " << r.p90
+			<< ", \"rays\": " << r.rays << ", \"bvh_nodes\": " << r.bvhNodes << ", \"bvh_depth\": " << r.bvhDepth
+			<< ", \"bvh_bytes\": " << r.bvhBytes << ", \"sphere_bytes\": " << r.sphereBytes << ", \"material_bytes\": " << r.materialBytes << "}"
+			<< (i + 1 < results.size() ? ",\n" : "\n");
+	}
+	out << "]\n";
+}
+
+static bool findField(const std::string& line, const std::string& field, std::string& value) {
+	std::string pattern = "\"" + field + "\": ";
+	size_t start = line.find(pattern);
+	if (start == std::string::npos) return false;
+	start += pattern.size();
+	if (line[start] == '"') {
+		size_t end = line.find('"', start + 1);
+		value = line.substr(start + 1, end - start - 1);
+	}
+	else {
+		size_t end = line.find_first_of(",}", start);
+		value = line.substr(start, end - start);
+	}
+	return true;
+}
+
+static std::map<std::string, BenchResult> readBaseline(const std::string& path) {
+	std::ifstream in(path);
+	if (!in) {
+		fprintf(stderr, "Failed to read baseline %s\n", path.c_str());
+		exit(1);
+	}
+	std::map<std::string, BenchResult> baseline;
+	std::string line, value;
+	while (std::getline(in, line)) {
+		BenchResult r;
+		if (!findField(line, "key", r.key)) continue;
+		if (findField(line, "unit", value)) r.unit = value;
+		if (findField(line, "median", value)) r.median = atof(value.c_str());
+		baseline[r.key] = r;
+	}
+	return baseline;
+}
+
+// prints every result next to its baseline, returns how many regressed past the threshold
+static int compare(const std::vector<BenchResult>& results, const std::map<std::string, BenchResult>& baseline, double threshold) {
+	int regressions = 0;
+	printf("\n%-32s %12s %12s %8s\n", "", "baseline", "current", "change");
+	for (const BenchResult& r : results) {
+		auto it = baseline.find(r.key);
+		if (it == baseline.end() || it->second.median <= 0.0) {
+			printf("%-32s %12s %12.3f %8s\n", r.key.c_str(), "-", r.median, "new");
+			continue;
+		}
+		double base = it->second.median;
+		double change = (r.median - base) / base;
+		bool lowerIsBetter = r.unit == "ms";
+		bool regressed = lowerIsBetter ? (change > threshold && r.median - base > BENCH_MIN_BUILD_MS) : change < -threshold;
+		regressions += regressed;
+		printf("%-32s %12.3f %12.3f %+7.1f%%%s\n", r.key.c_str(), base, r.median, change * 100.0, regressed ? "  REGRESSION" : "");
+	}
+	for (auto& b : baseline) {
+		bool found = std::any_of(results.begin(), results.end(), [&](const BenchResult& r) { return r.key == b.first; });
+		if (!found) printf("%-32s %12.3f %12s %8s\n", b.first.c_str(), b.second.median, "-", "missing");
+	}
+	return regressions;
+}
+
+static std::vector<std::string> split(const std::string& s, char delim) {
+	std::vector<std::string> parts;
+	std::stringstream ss(s);
+	std::string part;
+	while (std::getline(ss, part, delim)) {
+		if (!part.empty()) parts.push_back(part);
+	}
+	return parts;
+}
+
+static BenchOptions parseOptions(int argc, char** argv) {
+	BenchOptions options;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--quick") {
+			options.repeats = 3;
+			options.width = 160;
+			options.height = 90;
+			options.samples = 1;
+		}
+		else if (arg == "--scenes" && hasValue) options.scenes = split(argv[++i], ',');
+		else if (arg == "--repeats" && hasValue) options.repeats = std::max(1, atoi(argv[++i]));
+		else if (arg == "--out" && hasValue) options.out = argv[++i];
+		else if (arg == "--baseline" && hasValue) options.baseline = argv[++i];
+		else if (arg == "--threshold" && hasValue) options.threshold = atof(argv[++i]);
+		else {
+			fprintf(stderr, "Unknown argument \"%s\"\n", arg.c_str());
+			exit(1);
+		}
+	}
+	return options;
+}
+
+int main(int argc, char** argv) {
+	BenchOptions options = parseOptions(argc, argv);
+	BlueNoise noise(BLUE_NOISE_SIZE, BENCH_SEED);
+
+	printf("%dx%d, %d samples, %d repeats, 1 thread\n", options.width, options.height, options.samples, options.repeats);
+	std::vector<BenchResult> results;
+	for (auto& name : options.scenes) {
+		runScene(name, options, noise, results);
+	}
+
+	printf("\n%-32s %10s %10s %10s %8s\n", "", "median", "p10", "p90", "");
+	for (auto& r : results) {
+		printf("%-32s %10.3f %10.3f %10.3f %8s\n", r.key.c_str(), r.median, r.p10, r.p90, r.unit.c_str());
+	}
+	writeJSON(options.out, results);
+
+	if (!options.baseline.empty()) {
+		int regressions = compare(results, readBaseline(options.baseline), options.threshold);
+		if (regressions > 0) {
+			printf("\n%d regression(s) over %.0f%%\n", regressions, options.threshold * 100.0);
+			return 1;
+		}
+	}
+	return 0;
+}
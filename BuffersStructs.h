@@ -4,6 +4,13 @@
 
 #define BVH_TYPE_BVH 0
 #define BVH_TYPE_SPHERE 1
+// CPU only, left_index is the first SphereStore slot of the leaf and right_index how many
+#define BVH_TYPE_CLUSTER 2
+
+#define TEXTURE_NONE -1
+#define TEXTURE_TYPE_IMAGE 0
+#define TEXTURE_TYPE_CHECKER 1
+#define TEXTURE_TYPE_NOISE 2
 
 struct alignas(16) CameraBuffer {
     glm::vec3 position; float __p;
@@ -18,19 +25,25 @@ struct alignas(16) MaterialBuffer {
     glm::vec3 colour = glm::vec3(1, 1, 1);
     float reflective = 0.0f;
     float refractive = 0.0f;
-    bool emitter = false;
+    int emitter = 0; // read as a glsl bool, so all 4 bytes must be set
+    // SceneData::textures or TEXTURE_NONE. albedo multiplies colour, roughness replaces a metal's
+    // 1 - reflective and normal is a tangent space normal map
+    int albedoTexture = TEXTURE_NONE;
+    int roughnessTexture = TEXTURE_NONE;
+    int normalTexture = TEXTURE_NONE;
     MaterialBuffer(glm::vec3 _colour = glm::vec3(1, 1, 1), float _reflective = 0.0f, float _refractive = 0.0f, bool _emitter = false) {
         colour = _refractive > 0.0f ? glm::vec3(1, 1, 1) : _colour;
         reflective = _reflective;
         refractive = _refractive;
-        emitter = _emitter;
+        emitter = _emitter ? 1 : 0;
     }
 };
 
+// geometry only, one vec4. the material index is in SceneData::sphereMaterials, looked up
+// after the closest hit
 struct alignas(16) SpheresBuffer {
-    MaterialBuffer material;
     glm::vec3 position;
-    float radius;
+    float radius; // negative for the inside of a hollow sphere
 
     SpheresBuffer(glm::vec3 _position, float _radius) {
         position = _position;
@@ -38,6 +51,42 @@ struct alignas(16) SpheresBuffer {
     }
 };
 
+// an image in the TextureStore, which is also its layer of raytrace.frag's texture array,
+// or a procedural pattern between two colours
+struct alignas(16) TextureBuffer {
+    glm::vec3 colourA = glm::vec3(1, 1, 1);
+    float scale = 1.0f; // pattern repeats per unit
+    glm::vec3 colourB = glm::vec3(0, 0, 0);
+    int type = TEXTURE_TYPE_IMAGE;
+    int image = -1;
+    int width = 0;
+    int height = 0;
+};
+
+struct alignas(16) LightBuffer {
+    glm::vec3 position;
+    float radius = 0.0f;
+    glm::vec3 emission;
+    int sphereIndex = -1;
+
+    LightBuffer() {};
+    LightBuffer(glm::vec3 _position, float _radius, glm::vec3 _emission, int _sphereIndex) {
+        position = _position;
+        radius = _radius;
+        emission = _emission;
+        sphereIndex = _sphereIndex;
+    }
+};
+
+struct PathStatsBuffer {
+    // only counted when the shader is built with PATH_STATS
+    unsigned int pathCount = 0;
+    unsigned int segmentCount = 0;
+    // only counted when the shader is built with TRACE_STATS
+    unsigned int rayCount = 0;
+    unsigned int nodeVisits = 0;
+    unsigned int primitiveTests = 0;
+};
 
 struct alignas(16) BVHBuffer {
     glm::vec3 AABBmin; float __p;
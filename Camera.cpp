@@ -73,8 +73,12 @@ glm::vec3 Camera::getLookingAt() {
 	return position + direction * focalLength;
 }
 
+// also sets yaw and pitch, so rotating afterwards carries on from the new direction
 void Camera::LookAt(glm::vec3 pos) {
 	direction = glm::normalize(pos - position);
 	rightv = glm::normalize(glm::cross(direction, worldUp));
 	upv = glm::normalize(glm::cross(rightv, direction));
+
+	yaw = glm::degrees(atan2(direction.z, direction.x));
+	pitch = glm::degrees(asin(direction.y));
 }
\ No newline at end of file
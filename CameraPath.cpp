@@ -0,0 +1,99 @@
+#include "CameraPath.h"
+
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+void CameraPath::Load(const std::string& path) {
+	std::ifstream in(path);
+	if (!in) {
+		fprintf(stderr, "Failed to read camera path %s\n", path.c_str());
+		exit(1);
+	}
+
+	keyframes.clear();
+	std::string line;
+	int lineNumber = 0;
+	while (std::getline(in, line)) {
+		lineNumber++;
+		std::stringstream ss(line.substr(0, line.find('#')));
+		std::string keyword, extra;
+		if (!(ss >> keyword)) continue;
+
+		bool ok = true;
+		if (keyword == "key") {
+			CameraKeyframe k;
+			ok = (bool)(ss >> k.time >> k.position.x >> k.position.y >> k.position.z >> k.yaw >> k.pitch >> k.fov);
+			if (ok && !keyframes.empty() && k.time <= keyframes.back().time) {
+				fprintf(stderr, "%s:%d: keyframe times must increase\n", path.c_str(), lineNumber);
+				exit(1);
+			}
+			keyframes.push_back(k);
+		}
+		else if (keyword == "interpolation") {
+			std::string mode;
+			ok = (bool)(ss >> mode) && (mode == "linear" || mode == "smooth");
+			smooth = mode == "smooth";
+		}
+		else {
+			ok = false;
+		}
+
+		if (!ok || ss >> extra) {
+			fprintf(stderr, "%s:%d: expected \"key time x y z yaw pitch fov\" or \"interpolation linear|smooth\"\n", path.c_str(), lineNumber);
+			exit(1);
+		}
+	}
+
+	if (keyframes.empty()) {
+		fprintf(stderr, "%s: camera path has no keyframes\n", path.c_str());
+		exit(1);
+	}
+}
+
+// both ends are included, a path with one keyframe is one frame
+int CameraPath::getFrameCount(float fps) const {
+	return (int)(getDuration() * fps + 0.001f) + 1;
+}
+
+static float catmullRom(float p0, float p1, float p2, float p3, float t) {
+	return 0.5f * (2.0f * p1 + (p2 - p0) * t + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t * t + (3.0f * p1 - p0 - 3.0f * p2 + p3) * t * t * t);
+}
+
+CameraKeyframe CameraPath::Evaluate(float time) const {
+	if (time <= keyframes.front().time) return keyframes.front();
+	if (time >= keyframes.back().time) return keyframes.back();
+
+	size_t i = 1;
+	while (keyframes[i].time < time) i++;
+	const CameraKeyframe& k1 = keyframes[i - 1];
+	const CameraKeyframe& k2 = keyframes[i];
+	// the ends are repeated so the curve stops on the first and last keyframe
+	const CameraKeyframe& k0 = keyframes[i > 1 ? i - 2 : i - 1];
+	const CameraKeyframe& k3 = keyframes[std::min(i + 1, keyframes.size() - 1)];
+	float t = (time - k1.time) / (k2.time - k1.time);
+
+	auto blend = [&](float a0, float a1, float a2, float a3) {
+		return smooth ? catmullRom(a0, a1, a2, a3, t) : a1 + (a2 - a1) * t;
+	};
+	CameraKeyframe k;
+	k.time = time;
+	for (int c = 0; c < 3; c++) {
+		k.position[c] = blend(k0.position[c], k1.position[c], k2.position[c], k3.position[c]);
+	}
+	k.yaw = blend(k0.yaw, k1.yaw, k2.yaw, k3.yaw);
+	k.pitch = blend(k0.pitch, k1.pitch, k2.pitch, k3.pitch);
+	k.fov = blend(k0.fov, k1.fov, k2.fov, k3.fov);
+	return k;
+}
+
+void CameraPath::Apply(float time, Camera& camera) const {
+	CameraKeyframe k = Evaluate(time);
+	camera.position = k.position;
+	camera.yaw = k.yaw;
+	camera.pitch = glm::clamp(k.pitch, -89.0f, 89.0f);
+	camera.fov = k.fov;
+	camera.updateVectors();
+}
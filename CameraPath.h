@@ -0,0 +1,31 @@
+#pragma once
+
+#include "Camera.h"
+
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+struct CameraKeyframe {
+	float time = 0.0f; // seconds
+	glm::vec3 position = glm::vec3(0, 0, 0);
+	float yaw = 0.0f;
+	float pitch = 0.0f;
+	float fov = 45.0f;
+};
+
+// a camera flythrough, keyframes in time order with either linear or catmull-rom interpolation.
+// yaw isn't wrapped, so -170 to 170 turns the long way round, write 190 for the short one
+class CameraPath
+{
+public:
+	std::vector<CameraKeyframe> keyframes;
+	bool smooth = true;
+
+	// lines of "key time x y z yaw pitch fov" and an optional "interpolation linear|smooth", exits on an error
+	void Load(const std::string& path);
+	float getDuration() const { return keyframes.empty() ? 0.0f : keyframes.back().time - keyframes.front().time; };
+	int getFrameCount(float fps) const;
+	CameraKeyframe Evaluate(float time) const;
+	void Apply(float time, Camera& camera) const;
+};
@@ -0,0 +1,84 @@
+#include "Checkpoint.h"
+
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+struct CheckpointHeader {
+	char magic[4];
+	uint32_t version;
+	uint64_t key;
+	int32_t frame, pass, tile;
+	int32_t width, height;
+	CameraBuffer camera;
+};
+
+void Checkpoint::Save(const std::string& path) const {
+	CheckpointHeader header;
+	memcpy(header.magic, "RTCK", 4);
+	header.version = CHECKPOINT_VERSION;
+	header.key = key;
+	header.frame = frame;
+	header.pass = pass;
+	header.tile = tile;
+	header.width = sums.width;
+	header.height = sums.height;
+	header.camera = camera;
+
+	std::string temp = path + ".tmp";
+	{
+		std::ofstream out(temp, std::ios::out | std::ios::trunc | std::ios::binary);
+		out.write((const char*)&header, sizeof(header));
+		out.write((const char*)sums.colour.data(), sums.colour.size() * sizeof(float));
+		out.write((const char*)sums.albedo.data(), sums.albedo.size() * sizeof(float));
+		out.write((const char*)sums.normal.data(), sums.normal.size() * sizeof(float));
+		out.write((const char*)sums.depth.data(), sums.depth.size() * sizeof(float));
+		out.write((const char*)sampleCounts.data(), sampleCounts.size() * sizeof(uint32_t));
+		out.write((const char*)luminanceSquares.data(), luminanceSquares.size() * sizeof(float));
+		if (!out) {
+			fprintf(stderr, "Failed to write checkpoint %s\n", temp.c_str());
+			exit(1);
+		}
+	}
+
+#ifdef _WIN32
+	std::remove(path.c_str()); // rename won't replace a file on windows
+#endif
+	if (std::rename(temp.c_str(), path.c_str()) != 0) {
+		fprintf(stderr, "Failed to replace checkpoint %s\n", path.c_str());
+		exit(1);
+	}
+}
+
+bool Checkpoint::Load(const std::string& path) {
+	std::ifstream in(path, std::ios::in | std::ios::binary);
+	CheckpointHeader header;
+	if (!in.read((char*)&header, sizeof(header)) || memcmp(header.magic, "RTCK", 4) != 0 || header.version != CHECKPOINT_VERSION) return false;
+	if (header.width <= 0 || header.height <= 0) return false;
+
+	key = header.key;
+	frame = header.frame;
+	pass = header.pass;
+	tile = header.tile;
+	camera = header.camera;
+	sums.Resize(header.width, header.height);
+	sampleCounts.assign((size_t)header.width * header.height, 0);
+	luminanceSquares.assign((size_t)header.width * header.height, 0.0f);
+	in.read((char*)sums.colour.data(), sums.colour.size() * sizeof(float));
+	in.read((char*)sums.albedo.data(), sums.albedo.size() * sizeof(float));
+	in.read((char*)sums.normal.data(), sums.normal.size() * sizeof(float));
+	in.read((char*)sums.depth.data(), sums.depth.size() * sizeof(float));
+	in.read((char*)sampleCounts.data(), sampleCounts.size() * sizeof(uint32_t));
+	in.read((char*)luminanceSquares.data(), luminanceSquares.size() * sizeof(float));
+	return (bool)in;
+}
+
+uint64_t Checkpoint::Hash(const void* data, size_t size, uint64_t hash) {
+	const unsigned char* p = (const unsigned char*)data;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= p[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
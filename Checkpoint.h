@@ -0,0 +1,32 @@
+#pragma once
+
+#include "BuffersStructs.h"
+#include "RenderBuffers.h"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#define CHECKPOINT_VERSION 2
+#define CHECKPOINT_HASH_START 14695981039346656037ull
+
+// a frame part way through FrameRenderer::Render: the summed buffers before they are divided
+// by the sample counts, and where in the pass and tile order to carry on from
+struct Checkpoint {
+	uint64_t key = 0; // RenderOptions::SettingsKey of the run that saved it
+	int32_t frame = 0;
+	int32_t pass = 0; // next pass to render
+	int32_t tile = 0; // next tile of that pass
+	CameraBuffer camera;
+	RenderBuffers sums;
+	std::vector<uint32_t> sampleCounts;
+	std::vector<float> luminanceSquares;
+
+	// written next to path and renamed over it, so a kill mid write leaves the last one intact
+	void Save(const std::string& path) const;
+	// false if there is no file or it isn't a checkpoint of this version
+	bool Load(const std::string& path);
+
+	// fnv-1a, chained through hash
+	static uint64_t Hash(const void* data, size_t size, uint64_t hash = CHECKPOINT_HASH_START);
+};
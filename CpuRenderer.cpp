@@ -0,0 +1,284 @@
+#include "CpuRenderer.h"
+
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+
+#define CPU_PI 3.14159265359f
+
+static float powerHeuristic(float pdfA, float pdfB) {
+	float a2 = pdfA * pdfA;
+	float b2 = pdfB * pdfB;
+	return a2 / (a2 + b2);
+}
+
+static float reflectance(float cosine, float refIndex) {
+	float r0 = (1 - refIndex) / (1 + refIndex);
+	r0 = r0 * r0;
+	return r0 + (1 - r0) * powf(1 - cosine, 5);
+}
+
+// glsl refract
+static glm::vec3 refract(glm::vec3 i, glm::vec3 n, float eta) {
+	float cosi = glm::dot(n, i);
+	float k = 1.0f - eta * eta * (1.0f - cosi * cosi);
+	if (k < 0.0f) return glm::vec3(0, 0, 0);
+	return eta * i - (eta * cosi + sqrtf(k)) * n;
+}
+
+CpuRenderer::CpuRenderer(const std::vector<SpheresBuffer>* spheres, const std::vector<MaterialBuffer>* materials, const std::vector<int>* sphereMaterials, const std::vector<BVHBuffer>* bvhs, const std::vector<LightBuffer>* lights, const BlueNoise* noise, int samples, int depth, int rrDepth) {
+	this->tracer = Tracer(spheres, bvhs);
+	this->spheres = spheres;
+	this->materials = materials;
+	this->sphereMaterials = sphereMaterials;
+	this->lights = lights;
+	this->noise = noise;
+	this->samples = samples;
+	this->depth = depth;
+	this->rrDepth = rrDepth;
+}
+
+CpuRenderer::CpuRenderer(const SceneData& scene, const BlueNoise* noise, int samples, int depth, int rrDepth)
+	: CpuRenderer(&scene.spheres, &scene.materials, &scene.sphereMaterials, &scene.bvhs, &scene.lights, noise, samples, depth, rrDepth) {
+	if (!scene.clusters.empty()) tracer = Tracer(&scene.spheres, &scene.clusters, &scene.packedSpheres);
+	textures = &scene.textures;
+	textureStore = scene.textureStore.get();
+}
+
+// fills the same buffers as raytrace.frag's render targets
+void CpuRenderer::Render(const CameraBuffer& camera, int width, int height, RenderBuffers& buffers, int threads) {
+	this->camera = camera;
+	this->threads = threads;
+	RenderTile(Tile(0, 0, width, height), 0, buffers);
+}
+
+void CpuRenderer::RenderTile(const Tile& tile, int pass, RenderBuffers& buffers) {
+	int threadCount = threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
+	buffers.Resize(tile.width, tile.height);
+
+	std::atomic<int> nextRow(0);
+	std::atomic<unsigned long long> segmentCount(0);
+	std::vector<std::thread> workers;
+	for (int t = 0; t < threadCount; t++) {
+		workers.push_back(std::thread([&]() {
+			unsigned long long localSegments = 0;
+			for (int y = nextRow++; y < tile.height; y = nextRow++) {
+				for (int x = 0; x < tile.width; x++) {
+					unsigned int segments = 0;
+					PixelFeatures features;
+					glm::vec3 colour = GetPixel(camera, tile.x + x, tile.y + y, segments, features, pass);
+					localSegments += segments;
+
+					size_t i = (size_t)y * tile.width + x;
+					for (int c = 0; c < 3; c++) {
+						buffers.colour[i * 3 + c] = colour[c];
+						buffers.albedo[i * 3 + c] = features.albedo[c];
+						buffers.normal[i * 3 + c] = features.normal[c];
+					}
+					buffers.depth[i] = features.depth;
+				}
+			}
+			segmentCount += localSegments;
+		}));
+	}
+	for (auto& w : workers) w.join();
+
+	totalPaths += (unsigned long long)tile.width * tile.height * samples;
+	totalSegments += segmentCount;
+}
+
+// pass offsets the sample indices the same way raytrace.frag's frameIndex does
+glm::vec3 CpuRenderer::GetPixel(const CameraBuffer& camera, int x, int y, unsigned int& segments, PixelFeatures& features, int pass) const {
+	glm::vec3 pixelCenter = camera.viewportTopLeft + (x + 0.5f) * camera.du + (y + 0.5f) * camera.dv;
+
+	Sampler sampler(noise, x, y, 0);
+	// a pixel's height at the viewport, over the viewport's distance
+	float spread = glm::length(camera.dv) / glm::length(camera.viewportTopLeft - camera.position);
+	glm::vec3 accumColour(0, 0, 0);
+	features = PixelFeatures();
+	for (int i = 0; i < samples; i++) {
+		sampler.SetSampleIndex(pass * samples + i);
+		glm::vec2 u = sampler.Get2D(SAMPLER_DIM_PIXEL) - glm::vec2(0.5f, 0.5f);
+		glm::vec3 pos = pixelCenter + camera.du * u.x + camera.dv * u.y;
+
+		PixelFeatures firstHit;
+		accumColour += GetRayColour(Ray(camera.position, pos - camera.position), sampler, segments, &firstHit, spread);
+		features.albedo += firstHit.albedo;
+		features.normal += firstHit.normal;
+		features.depth += firstHit.depth;
+	}
+
+	features.albedo /= (float)samples;
+	features.normal = glm::normalize(features.normal);
+	features.depth /= (float)samples;
+	return accumColour / (float)samples;
+}
+
+float CpuRenderer::lightPdf(glm::vec3 p, glm::vec3 centre, float radius) const {
+	glm::vec3 d = centre - p;
+	float sin2ThetaMax = radius * radius / glm::dot(d, d);
+	if (sin2ThetaMax >= 1.0f) return 0.0f;
+	float cosThetaMax = sqrtf(1.0f - sin2ThetaMax);
+	return 1.0f / (2.0f * CPU_PI * (1.0f - cosThetaMax) * lights->size());
+}
+
+glm::vec3 CpuRenderer::sampleLights(glm::vec3 p, glm::vec3 normal, glm::vec3 albedo, const Sampler& sampler, int dimension) const {
+	int lightCount = (int)lights->size();
+	const LightBuffer& light = (*lights)[std::min((int)(sampler.Get1D(dimension + SAMPLER_DIM_CHOICE) * lightCount), lightCount - 1)];
+
+	glm::vec3 toCentre = light.position - p;
+	float dist2 = glm::dot(toCentre, toCentre);
+	float sin2ThetaMax = light.radius * light.radius / dist2;
+	if (sin2ThetaMax >= 1.0f) return glm::vec3(0, 0, 0);
+	float cosThetaMax = sqrtf(1.0f - sin2ThetaMax);
+
+	glm::vec2 u = sampler.Get2D(dimension + SAMPLER_DIM_LIGHT);
+	float cosTheta = 1.0f - u.x * (1.0f - cosThetaMax);
+	float sinTheta = sqrtf(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+	float phi = 2.0f * CPU_PI * u.y;
+
+	glm::vec3 w = toCentre / sqrtf(dist2);
+	glm::vec3 t = glm::normalize(glm::cross(fabsf(w.x) > 0.9f ? glm::vec3(0, 1, 0) : glm::vec3(1, 0, 0), w));
+	glm::vec3 b = glm::cross(w, t);
+	glm::vec3 direction = glm::normalize(t * (cosf(phi) * sinTheta) + b * (sinf(phi) * sinTheta) + w * cosTheta);
+
+	float cosSurface = glm::dot(direction, normal);
+	if (cosSurface <= 0.0f) return glm::vec3(0, 0, 0);
+
+	float halfb = glm::dot(-toCentre, direction);
+	float c = dist2 - light.radius * light.radius;
+	float tLight = -halfb - sqrtf(std::max(0.0f, halfb * halfb - c));
+
+	if (tracer.Occluded(Ray(p, direction), 0.001f, tLight - 0.001f)) return glm::vec3(0, 0, 0);
+
+	float pdfLight = 1.0f / (2.0f * CPU_PI * (1.0f - cosThetaMax) * lightCount);
+	float pdfBsdf = cosSurface / CPU_PI;
+
+	return albedo / CPU_PI * light.emission * (cosSurface / pdfLight * powerHeuristic(pdfLight, pdfBsdf));
+}
+
+// an image texture's mip level comes from the ray cone's width against the texels across the
+// sphere's circumference
+glm::vec3 CpuRenderer::sampleTexture(int index, glm::vec2 uv, glm::vec3 local, float coneWidth, float radius) const {
+	const TextureBuffer& t = (*textures)[index];
+	if (t.type != TEXTURE_TYPE_IMAGE) return TextureStore::Procedural(t, uv, local);
+	float lod = log2f(std::max(coneWidth / (2.0f * CPU_PI * radius) * t.width, 1e-6f));
+	return textureStore->Sample(t.image, uv, lod);
+}
+
+glm::vec3 CpuRenderer::GetRayColour(const Ray& ray, const Sampler& sampler, unsigned int& segments, PixelFeatures* firstHit, float spread) const {
+	glm::vec3 colour(1, 1, 1);
+	glm::vec3 radiance(0, 0, 0);
+	Ray currentRay = ray;
+	float pathLength = 0.0f;
+
+	bool lastDiffuse = false;
+	float lastPdfBsdf = 0.0f;
+
+	for (int i = 0; i < depth; i++) {
+		segments++;
+		int dimension = i * SAMPLER_DIMS_PER_BOUNCE;
+
+		HitRecord rec;
+		if (!tracer.Hit(currentRay, 0.001f, INFINITY, rec)) {
+			glm::vec3 unitDir = glm::normalize(currentRay.direction);
+			float a = 0.5f * unitDir.y + 1.0f;
+			glm::vec3 sky = (1.0f - a) * glm::vec3(1, 1, 1) + a * glm::vec3(0.5f, 0.7f, 1.0f);
+			radiance += colour * sky;
+
+			if (i == 0 && firstHit) {
+				firstHit->albedo = sky;
+				firstHit->normal = -unitDir;
+				firstHit->depth = RENDER_SKY_DEPTH;
+			}
+			break;
+		}
+
+		const SpheresBuffer& sphere = (*spheres)[rec.sphereIndex];
+		const MaterialBuffer& material = (*materials)[(*sphereMaterials)[rec.sphereIndex]];
+		float distance = glm::length(rec.p - currentRay.origin);
+		pathLength += distance;
+
+		// the textured surface, rec.normal stays the geometric one so metal bounces stay outside
+		glm::vec3 albedo = material.colour;
+		glm::vec3 normal = rec.normal;
+		float fuzz = 1.0f - material.reflective;
+		if (textures && !material.emitter && (material.albedoTexture != TEXTURE_NONE || material.roughnessTexture != TEXTURE_NONE || material.normalTexture != TEXTURE_NONE)) {
+			float radius = fabsf(sphere.radius);
+			glm::vec3 local = rec.p - sphere.position;
+			glm::vec3 d = local / radius;
+			glm::vec2 uv = Tracer::SphereUV(d);
+			float coneWidth = spread * pathLength;
+
+			if (material.albedoTexture != TEXTURE_NONE) albedo *= sampleTexture(material.albedoTexture, uv, local, coneWidth, radius);
+			if (material.roughnessTexture != TEXTURE_NONE) fuzz = sampleTexture(material.roughnessTexture, uv, local, coneWidth, radius).x;
+			// tangent along u and bitangent along v, undefined at the poles
+			if (material.normalTexture != TEXTURE_NONE && d.x * d.x + d.z * d.z > 1e-8f) {
+				glm::vec3 m = sampleTexture(material.normalTexture, uv, local, coneWidth, radius) * 2.0f - glm::vec3(1, 1, 1);
+				glm::vec3 t = glm::normalize(glm::vec3(d.z, 0.0f, -d.x));
+				glm::vec3 b = glm::cross(d, t);
+				normal = glm::normalize(t * m.x + b * m.y + d * m.z);
+				if (glm::dot(normal, rec.normal) < 0.0f) normal = -normal;
+			}
+		}
+
+		if (i == 0 && firstHit) {
+			firstHit->albedo = albedo;
+			firstHit->normal = normal;
+			firstHit->depth = distance;
+		}
+
+		if (material.emitter) {
+			if (rec.frontFace) {
+				float weight = 1.0f;
+				if (lastDiffuse) {
+					weight = powerHeuristic(lastPdfBsdf, lightPdf(currentRay.origin, sphere.position, fabsf(sphere.radius)));
+				}
+				radiance += colour * material.colour * weight;
+			}
+			break;
+		}
+		lastDiffuse = false;
+
+		glm::vec3 newDirection;
+		if (material.refractive > 0.0f) {
+			float refractionRatio = rec.frontFace ? (1.0f / material.refractive) : material.refractive;
+			glm::vec3 unitDir = glm::normalize(currentRay.direction);
+
+			float cosTheta = std::min(glm::dot(-unitDir, normal), 1.0f);
+			float sinTheta = sqrtf(1.0f - cosTheta * cosTheta);
+
+			bool cannotRefract = refractionRatio * sinTheta > 1.0f;
+			if (cannotRefract || reflectance(cosTheta, refractionRatio) > sampler.Get1D(dimension + SAMPLER_DIM_CHOICE)) {
+				newDirection = glm::reflect(unitDir, normal);
+			}
+			else {
+				newDirection = refract(unitDir, normal, refractionRatio);
+			}
+		}
+		else if (material.reflective > 0.0f) {
+			newDirection = glm::reflect(glm::normalize(currentRay.direction), normal) + fuzz * Sampler::UniformSphere(sampler.Get2D(dimension + SAMPLER_DIM_BSDF));
+			if (glm::dot(newDirection, rec.normal) < 0) break;
+		}
+		else {
+			newDirection = Sampler::CosineHemisphere(normal, sampler.Get2D(dimension + SAMPLER_DIM_BSDF));
+
+			if (!lights->empty()) {
+				radiance += colour * sampleLights(rec.p, normal, albedo, sampler, dimension);
+				lastDiffuse = true;
+				lastPdfBsdf = std::max(glm::dot(newDirection, normal), 0.0f) / CPU_PI;
+			}
+		}
+
+		currentRay = Ray(rec.p, newDirection);
+		colour *= albedo;
+
+		if (i + 1 >= rrDepth) {
+			float survival = std::min(std::max(colour.x, std::max(colour.y, colour.z)), 0.95f);
+			if (sampler.Get1D(dimension + SAMPLER_DIM_RR) >= survival) break;
+			colour /= survival;
+		}
+	}
+	return radiance;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "Tracer.h"
+#include "Sampler.h"
+#include "BuffersStructs.h"
+#include "RenderBuffers.h"
+#include "RenderBackend.h"
+#include "SceneData.h"
+
+#include <vector>
+#include <glm/glm.hpp>
+
+// first hit albedo, normal and distance of a path, the guide buffers for the denoiser
+struct PixelFeatures {
+	glm::vec3 albedo = glm::vec3(0, 0, 0);
+	glm::vec3 normal = glm::vec3(0, 0, 0);
+	float depth = 0.0f;
+};
+
+// CPU version of raytrace.frag's getRayColour, with the same materials, light sampling,
+// russian roulette and sample dimensions, so both paths converge to the same image
+class CpuRenderer : public RenderBackend
+{
+public:
+	// threads <= 0 uses every core
+	int threads = 0;
+
+	CpuRenderer(const std::vector<SpheresBuffer>* spheres, const std::vector<MaterialBuffer>* materials, const std::vector<int>* sphereMaterials, const std::vector<BVHBuffer>* bvhs, const std::vector<LightBuffer>* lights, const BlueNoise* noise, int samples, int depth, int rrDepth = 3);
+	// traces scene.clusters once SceneData::CalculateClusters has run, scene.bvhs before that.
+	// the only constructor that applies the materials' textures
+	CpuRenderer(const SceneData& scene, const BlueNoise* noise, int samples, int depth, int rrDepth = 3);
+	void Render(const CameraBuffer& camera, int width, int height, RenderBuffers& buffers, int threads = 0);
+	void SetCamera(const CameraBuffer& camera) override { this->camera = camera; };
+	void RenderTile(const Tile& tile, int pass, RenderBuffers& buffers) override;
+	glm::vec3 GetPixel(const CameraBuffer& camera, int x, int y, unsigned int& segments, PixelFeatures& features, int pass = 0) const;
+	// spread is the ray cone's width per unit of path length, for picking texture mip levels
+	glm::vec3 GetRayColour(const Ray& ray, const Sampler& sampler, unsigned int& segments, PixelFeatures* firstHit = nullptr, float spread = 0.0f) const;
+	double getAveragePathLength() const { return totalPaths == 0 ? 0.0 : (double)totalSegments / (double)totalPaths; };
+private:
+	Tracer tracer;
+	CameraBuffer camera;
+	const std::vector<SpheresBuffer>* spheres;
+	const std::vector<MaterialBuffer>* materials;
+	const std::vector<int>* sphereMaterials;
+	const std::vector<LightBuffer>* lights;
+	const std::vector<TextureBuffer>* textures = nullptr;
+	const TextureStore* textureStore = nullptr;
+	const BlueNoise* noise;
+	int samples, depth, rrDepth;
+	unsigned long long totalPaths = 0;
+	unsigned long long totalSegments = 0;
+
+	glm::vec3 sampleLights(glm::vec3 p, glm::vec3 normal, glm::vec3 albedo, const Sampler& sampler, int dimension) const;
+	float lightPdf(glm::vec3 p, glm::vec3 centre, float radius) const;
+	glm::vec3 sampleTexture(int index, glm::vec2 uv, glm::vec3 local, float coneWidth, float radius) const;
+};
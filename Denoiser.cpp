@@ -0,0 +1,259 @@
+#include "Denoiser.h"
+
+#include <thread>
+#include <algorithm>
+#include <cmath>
+
+// the vector filter is written with fused multiply adds, which -mavx2 alone doesn't enable
+#if defined(__AVX2__) && defined(__FMA__)
+#define DENOISER_AVX2
+#include <immintrin.h>
+#endif
+
+// 5 tap B3 spline
+static const float kernel[5] = { 1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+
+#define ALBEDO_EPSILON 0.01f
+#define VARIANCE_RADIUS 3
+
+static float luminance(float r, float g, float b) {
+	return 0.2126f * r + 0.7152f * g + 0.0722f * b;
+}
+
+static void toPlanes(const std::vector<float>& interleaved, std::vector<float>& r, std::vector<float>& g, std::vector<float>& b) {
+	size_t n = interleaved.size() / 3;
+	r.resize(n); g.resize(n); b.resize(n);
+	for (size_t i = 0; i < n; i++) {
+		r[i] = interleaved[i * 3];
+		g[i] = interleaved[i * 3 + 1];
+		b[i] = interleaved[i * 3 + 2];
+	}
+}
+
+#ifdef DENOISER_AVX2
+// exp for x <= 0, 2^x split into integer exponent bits and a polynomial for the fraction
+static inline __m256 exp256(__m256 x) {
+	x = _mm256_max_ps(x, _mm256_set1_ps(-87.0f));
+	__m256 t = _mm256_mul_ps(x, _mm256_set1_ps(1.44269504f));
+	__m256 fi = _mm256_floor_ps(t);
+	__m256 f = _mm256_sub_ps(t, fi);
+
+	__m256 p = _mm256_set1_ps(0.00133336f);
+	p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(0.00961813f));
+	p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(0.0555041f));
+	p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(0.240227f));
+	p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(0.693147f));
+	p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(1.0f));
+
+	__m256i e = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(fi), _mm256_set1_epi32(127)), 23);
+	return _mm256_mul_ps(p, _mm256_castsi256_ps(e));
+}
+
+static inline __m256 luminance256(__m256 r, __m256 g, __m256 b) {
+	__m256 l = _mm256_mul_ps(r, _mm256_set1_ps(0.2126f));
+	l = _mm256_fmadd_ps(g, _mm256_set1_ps(0.7152f), l);
+	return _mm256_fmadd_ps(b, _mm256_set1_ps(0.0722f), l);
+}
+#endif
+
+Denoiser::Denoiser(int iterations) {
+	this->iterations = iterations;
+}
+
+void Denoiser::Denoise(RenderBuffers& buffers, int threads) {
+	if (threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+	int width = buffers.width, height = buffers.height;
+	size_t n = (size_t)width * height;
+
+	Planes a, b;
+	a.width = b.width = albedo.width = normal.width = width;
+	a.height = b.height = albedo.height = normal.height = height;
+	toPlanes(buffers.colour, a.r, a.g, a.b);
+	toPlanes(buffers.albedo, albedo.r, albedo.g, albedo.b);
+	toPlanes(buffers.normal, normal.r, normal.g, normal.b);
+	depth = buffers.depth;
+	b.r.resize(n); b.g.resize(n); b.b.resize(n); b.variance.resize(n);
+
+	// demodulate
+	for (size_t i = 0; i < n; i++) {
+		a.r[i] /= std::max(albedo.r[i], ALBEDO_EPSILON);
+		a.g[i] /= std::max(albedo.g[i], ALBEDO_EPSILON);
+		a.b[i] /= std::max(albedo.b[i], ALBEDO_EPSILON);
+	}
+	estimateVariance(a);
+
+	Planes* in = &a;
+	Planes* out = &b;
+	for (int i = 0; i < iterations; i++) {
+		int step = 1 << i;
+
+		std::vector<std::thread> workers;
+		int rowsPerThread = (height + threads - 1) / threads;
+		for (int t = 0; t < threads; t++) {
+			int startY = t * rowsPerThread;
+			int endY = std::min(height, startY + rowsPerThread);
+			if (startY >= endY) break;
+			workers.push_back(std::thread(&Denoiser::filterRows, this, std::cref(*in), std::ref(*out), step, startY, endY));
+		}
+		for (auto& w : workers) w.join();
+
+		std::swap(in, out);
+	}
+
+	// remodulate
+	for (size_t i = 0; i < n; i++) {
+		buffers.colour[i * 3] = in->r[i] * std::max(albedo.r[i], ALBEDO_EPSILON);
+		buffers.colour[i * 3 + 1] = in->g[i] * std::max(albedo.g[i], ALBEDO_EPSILON);
+		buffers.colour[i * 3 + 2] = in->b[i] * std::max(albedo.b[i], ALBEDO_EPSILON);
+	}
+}
+
+// noise variance of the luminance, from the residual against a 3x3 mean averaged over a box.
+// unlike the plain box variance this mostly ignores smooth lighting gradients, so it shrinks
+// as the sample count goes up instead of blurring away real detail
+void Denoiser::estimateVariance(Planes& planes) const {
+	int width = planes.width, height = planes.height;
+	std::vector<float> l((size_t)width * height), residual((size_t)width * height);
+	for (size_t p = 0; p < l.size(); p++) l[p] = luminance(planes.r[p], planes.g[p], planes.b[p]);
+
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			float mean = 0.0f;
+			for (int j = -1; j <= 1; j++) {
+				int qy = std::min(std::max(y + j, 0), height - 1);
+				for (int i = -1; i <= 1; i++) {
+					int qx = std::min(std::max(x + i, 0), width - 1);
+					mean += l[(size_t)qy * width + qx];
+				}
+			}
+			// for independent noise the residual has 8/9 of the pixel variance
+			float d = l[(size_t)y * width + x] - mean / 9.0f;
+			residual[(size_t)y * width + x] = d * d * (9.0f / 8.0f);
+		}
+	}
+
+	// box average with a summed area table
+	std::vector<double> sum((size_t)(width + 1) * (height + 1), 0.0);
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			size_t s = (size_t)(y + 1) * (width + 1) + x + 1;
+			sum[s] = residual[(size_t)y * width + x] + sum[s - 1] + sum[s - width - 1] - sum[s - width - 2];
+		}
+	}
+
+	planes.variance.resize((size_t)width * height);
+	for (int y = 0; y < height; y++) {
+		int y0 = std::max(y - VARIANCE_RADIUS, 0), y1 = std::min(y + VARIANCE_RADIUS + 1, height);
+		for (int x = 0; x < width; x++) {
+			int x0 = std::max(x - VARIANCE_RADIUS, 0), x1 = std::min(x + VARIANCE_RADIUS + 1, width);
+			double total = sum[(size_t)y1 * (width + 1) + x1] - sum[(size_t)y0 * (width + 1) + x1] - sum[(size_t)y1 * (width + 1) + x0] + sum[(size_t)y0 * (width + 1) + x0];
+			planes.variance[(size_t)y * width + x] = (float)std::max(total / ((double)(x1 - x0) * (y1 - y0)), 0.0);
+		}
+	}
+}
+
+void Denoiser::filterPixelScalar(const Planes& in, Planes& out, int x, int y, int step) const {
+	int width = in.width, height = in.height;
+	size_t p = (size_t)y * width + x;
+
+	float lp = luminance(in.r[p], in.g[p], in.b[p]);
+	float invSigma = 1.0f / (colourPhi * sqrtf(in.variance[p]) + 1e-4f);
+
+	float sumR = 0.0f, sumG = 0.0f, sumB = 0.0f, sumV = 0.0f, sumW = 0.0f;
+	for (int j = -2; j <= 2; j++) {
+		int qy = std::min(std::max(y + j * step, 0), height - 1);
+		for (int i = -2; i <= 2; i++) {
+			int qx = std::min(std::max(x + i * step, 0), width - 1);
+			size_t q = (size_t)qy * width + qx;
+
+			float dl = fabsf(lp - luminance(in.r[q], in.g[q], in.b[q]));
+			float ar = albedo.r[p] - albedo.r[q], ag = albedo.g[p] - albedo.g[q], ab = albedo.b[p] - albedo.b[q];
+			float nDot = normal.r[p] * normal.r[q] + normal.g[p] * normal.g[q] + normal.b[p] * normal.b[q];
+			float dz = fabsf(depth[p] - depth[q]);
+
+			float e = dl * invSigma
+				+ (ar * ar + ag * ag + ab * ab) / albedoPhi
+				+ (1.0f - nDot) * normalPhi
+				+ dz / (depthPhi * depth[p] * step + 1e-4f);
+			float w = kernel[i + 2] * kernel[j + 2] * expf(-e);
+
+			sumR += in.r[q] * w; sumG += in.g[q] * w; sumB += in.b[q] * w;
+			sumV += in.variance[q] * w * w;
+			sumW += w;
+		}
+	}
+
+	out.r[p] = sumR / sumW;
+	out.g[p] = sumG / sumW;
+	out.b[p] = sumB / sumW;
+	out.variance[p] = sumV / (sumW * sumW);
+}
+
+void Denoiser::filterRows(const Planes& in, Planes& out, int step, int startY, int endY) const {
+	int width = in.width;
+
+	for (int y = startY; y < endY; y++) {
+		int x = 0;
+#ifdef DENOISER_AVX2
+		int height = in.height;
+		// 8 pixels per iteration wherever every tap of the row stays inside the image
+		for (; x < 2 * step && x < width; x++) filterPixelScalar(in, out, x, y, step);
+		for (; x + 8 + 2 * step <= width; x += 8) {
+			size_t p = (size_t)y * width + x;
+			__m256 lp = luminance256(_mm256_loadu_ps(&in.r[p]), _mm256_loadu_ps(&in.g[p]), _mm256_loadu_ps(&in.b[p]));
+			__m256 par = _mm256_loadu_ps(&albedo.r[p]), pag = _mm256_loadu_ps(&albedo.g[p]), pab = _mm256_loadu_ps(&albedo.b[p]);
+			__m256 pnx = _mm256_loadu_ps(&normal.r[p]), pny = _mm256_loadu_ps(&normal.g[p]), pnz = _mm256_loadu_ps(&normal.b[p]);
+			__m256 pz = _mm256_loadu_ps(&depth[p]);
+
+			__m256 one = _mm256_set1_ps(1.0f);
+			__m256 epsilon = _mm256_set1_ps(1e-4f);
+			__m256 invSigma = _mm256_div_ps(one, _mm256_fmadd_ps(_mm256_set1_ps(colourPhi), _mm256_sqrt_ps(_mm256_loadu_ps(&in.variance[p])), epsilon));
+			__m256 invAlbedoPhi = _mm256_set1_ps(1.0f / albedoPhi);
+			__m256 normalScale = _mm256_set1_ps(normalPhi);
+			__m256 invDepthScale = _mm256_div_ps(one, _mm256_fmadd_ps(pz, _mm256_set1_ps(depthPhi * step), epsilon));
+			__m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+
+			__m256 sumR = _mm256_setzero_ps(), sumG = _mm256_setzero_ps(), sumB = _mm256_setzero_ps(), sumV = _mm256_setzero_ps(), sumW = _mm256_setzero_ps();
+			for (int j = -2; j <= 2; j++) {
+				int qy = std::min(std::max(y + j * step, 0), height - 1);
+				for (int i = -2; i <= 2; i++) {
+					size_t q = (size_t)qy * width + x + i * step;
+					__m256 qr = _mm256_loadu_ps(&in.r[q]), qg = _mm256_loadu_ps(&in.g[q]), qb = _mm256_loadu_ps(&in.b[q]);
+
+					__m256 dl = _mm256_and_ps(_mm256_sub_ps(lp, luminance256(qr, qg, qb)), absMask);
+
+					__m256 d = _mm256_sub_ps(par, _mm256_loadu_ps(&albedo.r[q]));
+					__m256 albedoDist = _mm256_mul_ps(d, d);
+					d = _mm256_sub_ps(pag, _mm256_loadu_ps(&albedo.g[q])); albedoDist = _mm256_fmadd_ps(d, d, albedoDist);
+					d = _mm256_sub_ps(pab, _mm256_loadu_ps(&albedo.b[q])); albedoDist = _mm256_fmadd_ps(d, d, albedoDist);
+
+					__m256 nDot = _mm256_mul_ps(pnx, _mm256_loadu_ps(&normal.r[q]));
+					nDot = _mm256_fmadd_ps(pny, _mm256_loadu_ps(&normal.g[q]), nDot);
+					nDot = _mm256_fmadd_ps(pnz, _mm256_loadu_ps(&normal.b[q]), nDot);
+
+					__m256 dz = _mm256_and_ps(_mm256_sub_ps(pz, _mm256_loadu_ps(&depth[q])), absMask);
+
+					__m256 e = _mm256_mul_ps(dl, invSigma);
+					e = _mm256_fmadd_ps(albedoDist, invAlbedoPhi, e);
+					e = _mm256_fmadd_ps(_mm256_sub_ps(one, nDot), normalScale, e);
+					e = _mm256_fmadd_ps(dz, invDepthScale, e);
+
+					__m256 w = _mm256_mul_ps(_mm256_set1_ps(kernel[i + 2] * kernel[j + 2]), exp256(_mm256_sub_ps(_mm256_setzero_ps(), e)));
+
+					sumR = _mm256_fmadd_ps(qr, w, sumR);
+					sumG = _mm256_fmadd_ps(qg, w, sumG);
+					sumB = _mm256_fmadd_ps(qb, w, sumB);
+					sumV = _mm256_fmadd_ps(_mm256_mul_ps(_mm256_loadu_ps(&in.variance[q]), w), w, sumV);
+					sumW = _mm256_add_ps(sumW, w);
+				}
+			}
+
+			_mm256_storeu_ps(&out.r[p], _mm256_div_ps(sumR, sumW));
+			_mm256_storeu_ps(&out.g[p], _mm256_div_ps(sumG, sumW));
+			_mm256_storeu_ps(&out.b[p], _mm256_div_ps(sumB, sumW));
+			_mm256_storeu_ps(&out.variance[p], _mm256_div_ps(sumV, _mm256_mul_ps(sumW, sumW)));
+		}
+#endif
+		for (; x < width; x++) filterPixelScalar(in, out, x, y, step);
+	}
+}
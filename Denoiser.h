@@ -0,0 +1,34 @@
+#pragma once
+
+#include "RenderBuffers.h"
+
+#include <vector>
+
+// edge avoiding a-trous wavelet filter (Dammertz et al. 2010), guided by the albedo, normal
+// and depth buffers. colour is divided by albedo first so only the lighting gets blurred, and
+// like SVGF the luminance edge stopping is scaled by a spatial variance estimate, which is
+// filtered alongside the colour
+class Denoiser
+{
+public:
+	int iterations = 5;
+	float colourPhi = 2.0f;
+	float normalPhi = 32.0f;
+	float depthPhi = 0.05f;
+	float albedoPhi = 0.1f;
+
+	Denoiser(int iterations = 5);
+	void Denoise(RenderBuffers& buffers, int threads = 0);
+private:
+	// one plane per channel so rows can be filtered 8 pixels at a time
+	struct Planes {
+		int width = 0, height = 0;
+		std::vector<float> r, g, b, variance;
+	};
+	Planes albedo, normal;
+	std::vector<float> depth;
+
+	void estimateVariance(Planes& planes) const;
+	void filterRows(const Planes& in, Planes& out, int step, int startY, int endY) const;
+	void filterPixelScalar(const Planes& in, Planes& out, int x, int y, int step) const;
+};
@@ -0,0 +1,371 @@
+#include "Distributed.h"
+#include "FrameRenderer.h"
+#include "Denoiser.h"
+#include "CpuRenderer.h"
+#include "SceneLibrary.h"
+#include "Sampler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#define DIST_INVALID_SOCKET INVALID_SOCKET
+#define DIST_SEND_FLAGS 0
+#define closeSocket closesocket
+#define pollSockets WSAPoll
+#else
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#define DIST_INVALID_SOCKET -1
+// a worker dying mid send must not kill the coordinator with SIGPIPE
+#define DIST_SEND_FLAGS MSG_NOSIGNAL
+#define closeSocket close
+#define pollSockets poll
+#endif
+
+struct MessageHeader {
+	uint32_t type;
+	uint32_t size;
+};
+
+static void initSockets() {
+#ifdef _WIN32
+	static bool started = false;
+	if (!started) {
+		WSADATA data;
+		WSAStartup(MAKEWORD(2, 2), &data);
+		started = true;
+	}
+#endif
+}
+
+// "host:port", exits on anything getaddrinfo can't resolve
+static addrinfo* resolve(const std::string& address, bool passive) {
+	size_t colon = address.find_last_of(':');
+	if (colon == std::string::npos) {
+		fprintf(stderr, "Expected an address as host:port, got \"%s\"\n", address.c_str());
+		exit(1);
+	}
+	std::string host = address.substr(0, colon);
+	std::string port = address.substr(colon + 1);
+
+	addrinfo hints = {};
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = passive ? AI_PASSIVE : 0;
+	addrinfo* result = nullptr;
+	if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &result) != 0 || result == nullptr) {
+		fprintf(stderr, "Failed to resolve %s\n", address.c_str());
+		exit(1);
+	}
+	return result;
+}
+
+// tiles are sent as soon as they are written, not held back to fill a packet
+static void setNoDelay(SocketHandle s) {
+	int on = 1;
+	setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&on, sizeof(on));
+}
+
+static bool sendAll(SocketHandle s, const void* data, size_t size) {
+	const char* p = (const char*)data;
+	while (size > 0) {
+		int sent = send(s, p, (int)std::min(size, (size_t)1 << 20), DIST_SEND_FLAGS);
+		if (sent <= 0) return false;
+		p += sent;
+		size -= sent;
+	}
+	return true;
+}
+
+static bool receiveAll(SocketHandle s, void* data, size_t size) {
+	char* p = (char*)data;
+	while (size > 0) {
+		int got = recv(s, p, (int)std::min(size, (size_t)1 << 20), 0);
+		if (got <= 0) return false;
+		p += got;
+		size -= got;
+	}
+	return true;
+}
+
+static bool sendMessage(SocketHandle s, uint32_t type, const void* data, size_t size) {
+	MessageHeader header = { type, (uint32_t)size };
+	return sendAll(s, &header, sizeof(header)) && sendAll(s, data, size);
+}
+
+RenderCoordinator::RenderCoordinator(const RenderOptions& options) : options(options) {
+	initSockets();
+	addrinfo* address = resolve(options.address, true);
+	listener = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+	int on = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&on, sizeof(on));
+	if (listener == DIST_INVALID_SOCKET || bind(listener, address->ai_addr, (int)address->ai_addrlen) != 0 || listen(listener, 64) != 0) {
+		fprintf(stderr, "Failed to listen on %s\n", options.address.c_str());
+		exit(1);
+	}
+	freeaddrinfo(address);
+}
+
+RenderCoordinator::~RenderCoordinator() {
+	if (writer.joinable()) writer.join();
+	for (Connection& c : connections) closeSocket(c.socket);
+	closeSocket(listener);
+}
+
+void RenderCoordinator::Run(SceneData& scene) {
+	auto start = std::chrono::high_resolution_clock::now();
+	std::vector<Tile> tiles = FrameRenderer::SplitBands(options.width, options.height, options.tiles);
+	int passSamples = options.getPassSamples();
+	passes = std::max(1, (options.samples + passSamples - 1) / passSamples);
+	int frameCount = options.getFrameCount();
+
+	// frame by frame, so finished frames can be written while later ones render
+	for (int frame = 0; frame < frameCount; frame++) {
+		options.ApplyCamera(frame, scene.camera);
+		CameraBuffer camera = scene.MakeCameraBuffer(glm::uvec2(options.width, options.height));
+		for (int pass = 0; pass < passes; pass++) {
+			for (const Tile& tile : tiles) {
+				DistJob job;
+				job.id = (uint32_t)jobs.size();
+				job.frame = frame;
+				job.pass = pass;
+				job.tile = tile;
+				job.camera = camera;
+				queue.push_back(job.id);
+				jobs.push_back(job);
+			}
+		}
+	}
+	jobsPerFrame = (int)(tiles.size() * passes);
+	framesLeft = frameCount;
+
+	printf("%d frames of %d jobs, listening on %s\n", frameCount, jobsPerFrame, options.address.c_str());
+	bool waiting = false;
+	while (framesLeft > 0) {
+		if (connections.empty() && !waiting) {
+			printf("waiting for workers\n");
+			waiting = true;
+		}
+
+		std::vector<pollfd> fds(connections.size() + 1);
+		fds[0].fd = listener;
+		fds[0].events = POLLIN;
+		for (size_t i = 0; i < connections.size(); i++) {
+			fds[i + 1].fd = connections[i].socket;
+			fds[i + 1].events = POLLIN;
+		}
+		pollSockets(fds.data(), (unsigned long)fds.size(), 1000);
+
+		// backwards so dropping a connection doesn't move the ones still to check
+		for (size_t i = connections.size(); i > 0; i--) {
+			if (fds[i].revents && !receive(connections[i - 1])) drop(i - 1);
+		}
+		if (fds[0].revents & POLLIN) {
+			accept();
+			waiting = false;
+		}
+		for (Connection& c : connections) assign(c);
+	}
+	if (writer.joinable()) writer.join();
+
+	double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	printf("%d frames in %.1fs, %.0f frames/hour, %d workers at the end\n", frameCount, seconds, frameCount / seconds * 3600.0, (int)connections.size());
+}
+
+void RenderCoordinator::accept() {
+	SocketHandle s = ::accept(listener, nullptr, nullptr);
+	if (s == DIST_INVALID_SOCKET) return;
+	setNoDelay(s);
+
+	DistSetup setup;
+	setup.width = options.width;
+	setup.height = options.height;
+	setup.passSamples = options.getPassSamples();
+	setup.depth = options.depth;
+	setup.rrDepth = options.rrDepth;
+	setup.seed = options.seed;
+	snprintf(setup.scene, sizeof(setup.scene), "%s", options.scene.c_str());
+	if (!sendMessage(s, DIST_MSG_SETUP, &setup, sizeof(setup))) {
+		closeSocket(s);
+		return;
+	}
+
+	Connection c;
+	c.socket = s;
+	connections.push_back(c);
+	printf("worker connected, %d workers\n", (int)connections.size());
+}
+
+void RenderCoordinator::assign(Connection& c) {
+	while (c.jobs.size() < DIST_JOBS_IN_FLIGHT && !queue.empty()) {
+		const DistJob& job = jobs[queue.front()];
+		if (frames.find(job.frame) == frames.end()) {
+			FrameProgress& progress = frames[job.frame];
+			progress.result.Resize(options.width, options.height);
+			progress.remaining = jobsPerFrame;
+		}
+
+		// a failed send shows up as a closed socket on the next poll, which requeues the job
+		c.jobs.push_back(job.id);
+		queue.pop_front();
+		if (!sendMessage(c.socket, DIST_MSG_JOB, &job, sizeof(job))) return;
+	}
+}
+
+// false once the worker is gone
+bool RenderCoordinator::receive(Connection& c) {
+	char chunk[1 << 16];
+	int got = recv(c.socket, chunk, sizeof(chunk), 0);
+	if (got <= 0) return false;
+	c.received.insert(c.received.end(), chunk, chunk + got);
+
+	size_t offset = 0;
+	while (c.received.size() - offset >= sizeof(MessageHeader)) {
+		MessageHeader header;
+		memcpy(&header, c.received.data() + offset, sizeof(header));
+		if (c.received.size() - offset - sizeof(header) < header.size) break;
+		const char* payload = c.received.data() + offset + sizeof(header);
+		offset += sizeof(header) + header.size;
+
+		uint32_t id;
+		if (header.type != DIST_MSG_RESULT || header.size < sizeof(id)) return false;
+		memcpy(&id, payload, sizeof(id));
+		auto it = std::find(c.jobs.begin(), c.jobs.end(), id);
+		if (it == c.jobs.end()) return false;
+		const DistJob& job = jobs[id];
+		size_t pixels = (size_t)job.tile.width * job.tile.height;
+		if (header.size != sizeof(id) + pixels * 10 * sizeof(float)) return false;
+		c.jobs.erase(it);
+		c.completed++;
+
+		tileBuffers.Resize(job.tile.width, job.tile.height);
+		const char* p = payload + sizeof(id);
+		memcpy(tileBuffers.colour.data(), p, pixels * 3 * sizeof(float));
+		memcpy(tileBuffers.albedo.data(), p + pixels * 3 * sizeof(float), pixels * 3 * sizeof(float));
+		memcpy(tileBuffers.normal.data(), p + pixels * 6 * sizeof(float), pixels * 3 * sizeof(float));
+		memcpy(tileBuffers.depth.data(), p + pixels * 9 * sizeof(float), pixels * sizeof(float));
+		finishJob(job);
+	}
+	c.received.erase(c.received.begin(), c.received.begin() + offset);
+	return true;
+}
+
+void RenderCoordinator::finishJob(const DistJob& job) {
+	FrameProgress& progress = frames[job.frame];
+	FrameRenderer::AccumulateTile(progress.result, job.tile, tileBuffers);
+	if (--progress.remaining == 0) writeFrame(job.frame);
+}
+
+// the worker's unfinished jobs go to the front so the frame they belong to isn't held up
+void RenderCoordinator::drop(size_t index) {
+	Connection& c = connections[index];
+	for (auto it = c.jobs.rbegin(); it != c.jobs.rend(); it++) queue.push_front(*it);
+	printf("worker lost after %d jobs, %d requeued, %d workers\n", c.completed, (int)c.jobs.size(), (int)connections.size() - 1);
+	closeSocket(c.socket);
+	connections.erase(connections.begin() + index);
+}
+
+void RenderCoordinator::writeFrame(int frame) {
+	if (writer.joinable()) writer.join();
+	writing = std::move(frames[frame].result);
+	frames.erase(frame);
+	framesLeft--;
+
+	std::string path = options.OutputPath(frame);
+	int samples = passes * options.getPassSamples();
+	int workers = (int)connections.size();
+	writer = std::thread([this, path, samples, workers]() {
+		FrameRenderer::Scale(writing, 1.0f / passes);
+		if (options.denoise) {
+			Denoiser denoiser;
+			denoiser.Denoise(writing);
+		}
+		FrameRenderer::WriteImage(path.c_str(), writing);
+		printf("%s: %d samples from %d workers\n", path.c_str(), samples, workers);
+	});
+}
+
+RenderWorker::RenderWorker(const std::string& address) {
+	initSockets();
+	addrinfo* resolved = resolve(address, false);
+
+	// the coordinator may still be starting, so keep trying for a while
+	socket = DIST_INVALID_SOCKET;
+	for (int attempt = 0; attempt < 50 && socket == DIST_INVALID_SOCKET; attempt++) {
+		socket = ::socket(resolved->ai_family, resolved->ai_socktype, resolved->ai_protocol);
+		if (connect(socket, resolved->ai_addr, (int)resolved->ai_addrlen) != 0) {
+			closeSocket(socket);
+			socket = DIST_INVALID_SOCKET;
+			std::this_thread::sleep_for(std::chrono::milliseconds(200));
+		}
+	}
+	freeaddrinfo(resolved);
+	if (socket == DIST_INVALID_SOCKET) {
+		fprintf(stderr, "Failed to connect to %s\n", address.c_str());
+		exit(1);
+	}
+	setNoDelay(socket);
+
+	MessageHeader header;
+	if (!receiveAll(socket, &header, sizeof(header)) || header.type != DIST_MSG_SETUP || header.size != sizeof(setup) || !receiveAll(socket, &setup, sizeof(setup))) {
+		fprintf(stderr, "Expected a setup message from %s\n", address.c_str());
+		exit(1);
+	}
+	setup.scene[sizeof(setup.scene) - 1] = '\0';
+}
+
+RenderWorker::~RenderWorker() {
+	closeSocket(socket);
+}
+
+void RenderWorker::Serve(RenderBackend* backend) {
+	RenderBuffers buffers;
+	MessageHeader header;
+	DistJob job;
+	int completed = 0;
+	while (receiveAll(socket, &header, sizeof(header))) {
+		if (header.type != DIST_MSG_JOB || header.size != sizeof(job) || !receiveAll(socket, &job, sizeof(job))) {
+			fprintf(stderr, "Unexpected message from the coordinator\n");
+			break;
+		}
+
+		backend->SetCamera(job.camera);
+		backend->RenderTile(job.tile, job.pass, buffers);
+
+		size_t pixels = (size_t)job.tile.width * job.tile.height;
+		header.type = DIST_MSG_RESULT;
+		header.size = (uint32_t)(sizeof(job.id) + pixels * 10 * sizeof(float));
+		bool sent = sendAll(socket, &header, sizeof(header)) && sendAll(socket, &job.id, sizeof(job.id))
+			&& sendAll(socket, buffers.colour.data(), pixels * 3 * sizeof(float))
+			&& sendAll(socket, buffers.albedo.data(), pixels * 3 * sizeof(float))
+			&& sendAll(socket, buffers.normal.data(), pixels * 3 * sizeof(float))
+			&& sendAll(socket, buffers.depth.data(), pixels * sizeof(float));
+		if (!sent) break;
+		completed++;
+	}
+	printf("coordinator closed after %d jobs\n", completed);
+}
+
+void RenderWorker::ServeCpu(int threads) {
+	SceneData scene = SceneLibrary::Open(setup.scene, setup.seed);
+	scene.CalculateClusters(BVH_SPLIT_SAH);
+	BlueNoise noise(BLUE_NOISE_SIZE);
+
+	CpuRenderer renderer(scene, &noise, setup.passSamples, setup.depth, setup.rrDepth);
+	renderer.threads = threads;
+	Serve(&renderer);
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "RenderBackend.h"
+#include "RenderBuffers.h"
+#include "RenderOptions.h"
+#include "SceneData.h"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <thread>
+#include <cstdint>
+
+#define DIST_MSG_SETUP 1
+#define DIST_MSG_JOB 2
+#define DIST_MSG_RESULT 3
+// jobs handed to a worker before it returns the first, so it never waits on the coordinator
+#define DIST_JOBS_IN_FLIGHT 2
+
+#ifdef _WIN32
+typedef uintptr_t SocketHandle;
+#else
+typedef int SocketHandle;
+#endif
+
+// everything a worker needs to build the same scene and backend as the coordinator.
+// the scene is a library name or a file both processes can read
+struct DistSetup {
+	int32_t width = 0;
+	int32_t height = 0;
+	int32_t passSamples = 0;
+	int32_t depth = 0;
+	int32_t rrDepth = 0;
+	uint32_t seed = 0;
+	char scene[256] = {};
+};
+
+// one pass of one tile of one frame, the camera travels with it so workers don't need the path
+struct DistJob {
+	uint32_t id = 0;
+	int32_t frame = 0;
+	int32_t pass = 0;
+	Tile tile;
+	CameraBuffer camera;
+};
+
+// splits frames into tile and pass jobs, hands them to workers connecting over tcp and adds the
+// returned tiles into each frame. jobs of a worker that disconnects go back in the queue, and
+// workers can join at any time
+class RenderCoordinator
+{
+public:
+	RenderCoordinator(const RenderOptions& options);
+	~RenderCoordinator();
+	void Run(SceneData& scene);
+private:
+	struct Connection {
+		SocketHandle socket;
+		std::vector<char> received;
+		std::deque<uint32_t> jobs;
+		int completed = 0;
+	};
+	struct FrameProgress {
+		RenderBuffers result;
+		int remaining = 0;
+	};
+
+	const RenderOptions& options;
+	SocketHandle listener;
+	std::vector<Connection> connections;
+	std::vector<DistJob> jobs;
+	std::deque<uint32_t> queue;
+	std::map<int, FrameProgress> frames;
+	int passes = 1;
+	int jobsPerFrame = 0;
+	int framesLeft = 0;
+	RenderBuffers tileBuffers;
+	// a finished frame is denoised and written from here on another thread, so the poll loop keeps
+	// feeding the workers. the next finished frame waits for it
+	RenderBuffers writing;
+	std::thread writer;
+
+	void accept();
+	void assign(Connection& c);
+	bool receive(Connection& c);
+	void finishJob(const DistJob& job);
+	void drop(size_t index);
+	void writeFrame(int frame);
+};
+
+// connects to a coordinator and renders the jobs it hands out until the coordinator closes
+class RenderWorker
+{
+public:
+	// exits if the coordinator can't be reached
+	RenderWorker(const std::string& address);
+	~RenderWorker();
+	const DistSetup& getSetup() const { return setup; };
+	void Serve(RenderBackend* backend);
+	// Serve on a CpuRenderer over the setup's scene
+	void ServeCpu(int threads);
+private:
+	SocketHandle socket;
+	DistSetup setup;
+};
@@ -0,0 +1,39 @@
+#include "FrameGovernor.h"
+
+#include <algorithm>
+#include <cmath>
+
+// fraction of the way towards the ideal scale taken per measurement, to avoid oscillating
+#define GOVERNOR_GAIN 0.25f
+// checkerboarding halves the cost, so it is only dropped once there is room for double
+#define GOVERNOR_CHECKERBOARD_OFF 0.45f
+
+FrameGovernor::FrameGovernor(float targetMs) {
+	this->targetMs = targetMs;
+}
+
+void FrameGovernor::Update(double gpuMs) {
+	smoothedMs = smoothedMs == 0.0 ? gpuMs : smoothedMs * 0.8 + gpuMs * 0.2;
+
+	// pixels go with scale squared
+	float ideal = scale * sqrtf((float)(targetMs / std::max(smoothedMs, 0.01)));
+	scale *= powf(ideal / scale, GOVERNOR_GAIN);
+
+	if (allowCheckerboard && !checkerboard && scale < minScale) {
+		// half the pixels at sqrt 2 the scale costs the same
+		checkerboard = true;
+		scale *= sqrtf(2.0f);
+	}
+	else if (checkerboard && scale >= maxScale && smoothedMs < targetMs * GOVERNOR_CHECKERBOARD_OFF) {
+		checkerboard = false;
+		scale /= sqrtf(2.0f);
+	}
+
+	scale = std::min(std::max(scale, minScale), maxScale);
+}
+
+void FrameGovernor::Reset() {
+	scale = maxScale;
+	checkerboard = false;
+	smoothedMs = 0.0;
+}
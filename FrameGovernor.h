@@ -0,0 +1,23 @@
+#pragma once
+
+// picks the viewer's render scale and checkerboarding from measured gpu frame times,
+// to hold a frame time target. cost is treated as proportional to the pixels traced
+class FrameGovernor
+{
+public:
+	float targetMs = 16.6f;
+	float minScale = 0.25f;
+	float maxScale = 1.0f;
+	bool allowCheckerboard = true;
+
+	FrameGovernor(float targetMs = 16.6f);
+	void Update(double gpuMs);
+	void Reset();
+	float getScale() const { return scale; };
+	bool getCheckerboard() const { return checkerboard; };
+	double getFrameMs() const { return smoothedMs; };
+private:
+	float scale = 1.0f;
+	bool checkerboard = false;
+	double smoothedMs = 0.0;
+};
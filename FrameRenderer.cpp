@@ -0,0 +1,360 @@
+#include "FrameRenderer.h"
+#include "CpuRenderer.h"
+#include "Denoiser.h"
+#include "Sampler.h"
+#include "Utils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <csignal>
+#include <cmath>
+#include <cstdint>
+
+FrameRenderer::FrameRenderer(RenderBackend* backend, int width, int height, int samples, int passSamples, int tiles) {
+	this->backend = backend;
+	this->width = width;
+	this->height = height;
+	this->passSamples = passSamples;
+	passes = std::max(1, (samples + passSamples - 1) / passSamples);
+	this->tiles = SplitBands(width, height, tiles);
+}
+
+std::vector<Tile> FrameRenderer::SplitBands(int width, int height, int count) {
+	std::vector<Tile> bands;
+	count = std::max(1, std::min(count, height));
+	for (int i = 0; i < count; i++) {
+		int startY = height * i / count;
+		int endY = height * (i + 1) / count;
+		bands.push_back(Tile(0, startY, width, endY - startY));
+	}
+	return bands;
+}
+
+void FrameRenderer::AccumulateTile(RenderBuffers& result, const Tile& tile, const RenderBuffers& tileBuffers) {
+	for (int y = 0; y < tile.height; y++) {
+		size_t src = (size_t)y * tile.width;
+		size_t dst = (size_t)(tile.y + y) * result.width + tile.x;
+		for (size_t i = 0; i < (size_t)tile.width * 3; i++) {
+			result.colour[dst * 3 + i] += tileBuffers.colour[src * 3 + i];
+			result.albedo[dst * 3 + i] += tileBuffers.albedo[src * 3 + i];
+			result.normal[dst * 3 + i] += tileBuffers.normal[src * 3 + i];
+		}
+		for (int x = 0; x < tile.width; x++) {
+			result.depth[dst + x] += tileBuffers.depth[src + x];
+		}
+	}
+}
+
+void FrameRenderer::Scale(RenderBuffers& buffers, float scale) {
+	for (auto& c : buffers.colour) c *= scale;
+	for (auto& a : buffers.albedo) a *= scale;
+	for (auto& n : buffers.normal) n *= scale;
+	for (auto& d : buffers.depth) d *= scale;
+}
+
+static float luminance(float r, float g, float b) {
+	return 0.2126f * r + 0.7152f * g + 0.0722f * b;
+}
+
+// field by field, the padding isn't initialised
+static bool sameCamera(const CameraBuffer& a, const CameraBuffer& b) {
+	return a.position == b.position && a.viewportTopLeft == b.viewportTopLeft && a.du == b.du && a.dv == b.dv
+		&& a.backgroundColour == b.backgroundColour && a.screenRes == b.screenRes;
+}
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void onStopSignal(int) {
+	stopRequested = 1;
+}
+
+FrameStats FrameRenderer::Render(const CameraBuffer& camera, RenderBuffers& result, int frame, const Checkpoint* resume) {
+	auto start = std::chrono::high_resolution_clock::now();
+	auto elapsedMs = [&]() {
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	};
+
+	backend->SetCamera(camera);
+	result.Resize(width, height);
+	sampleCounts.assign((size_t)width * height, 0);
+	luminanceSquares.assign((size_t)width * height, 0.0f);
+
+	int firstPass = 0;
+	size_t firstTile = 0;
+	if (resume && resume->frame == frame && resume->sums.width == width && resume->sums.height == height && sameCamera(resume->camera, camera)) {
+		result = resume->sums;
+		sampleCounts = resume->sampleCounts;
+		luminanceSquares = resume->luminanceSquares;
+		firstPass = resume->pass;
+		firstTile = resume->tile;
+		printf("resuming frame %d at pass %d/%d, tile %d/%d\n", frame, firstPass, passes, (int)firstTile, (int)tiles.size());
+	}
+
+	Checkpoint checkpoint;
+	auto lastCheckpoint = std::chrono::high_resolution_clock::now();
+	auto saveCheckpoint = [&](int pass, size_t tile) {
+		checkpoint.key = checkpointKey;
+		checkpoint.frame = frame;
+		checkpoint.pass = pass;
+		checkpoint.tile = (int)tile;
+		checkpoint.camera = camera;
+		checkpoint.sums = result;
+		checkpoint.sampleCounts = sampleCounts;
+		checkpoint.luminanceSquares = luminanceSquares;
+		checkpoint.Save(checkpointPath);
+		lastCheckpoint = std::chrono::high_resolution_clock::now();
+	};
+	auto stopAtCheckpoint = [&](int pass, size_t tile) {
+		saveCheckpoint(pass, tile);
+		printf("stopped at a checkpoint in %s\n", checkpointPath.c_str());
+		exit(0);
+	};
+	// with the next pass and tile to render, saved every checkpointInterval seconds or on a stop
+	auto reachCheckpoint = [&](int pass, size_t tile) {
+		if (checkpointPath.empty()) return;
+		if (stopRequested) stopAtCheckpoint(pass, tile);
+		double sinceCheckpoint = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - lastCheckpoint).count();
+		if (sinceCheckpoint >= checkpointInterval) saveCheckpoint(pass, tile);
+	};
+
+	// the cost of a tile is predicted from the time per pixel pass of everything rendered so far,
+	// and a tile that wouldn't end before the deadline isn't started
+	double renderedMs = 0.0, renderedPixels = 0.0;
+	auto fitsBudget = [&](const Tile& tile) {
+		if (timeBudget <= 0.0 || renderedPixels == 0.0) return true;
+		double predictedMs = renderedMs / renderedPixels * tile.width * tile.height;
+		return elapsedMs() + predictedMs * DEADLINE_MARGIN <= timeBudget * 1000.0 - reservedMs;
+	};
+	auto renderTile = [&](const Tile& tile, int pass) {
+		auto tileStart = std::chrono::high_resolution_clock::now();
+		backend->RenderTile(tile, pass, tileBuffers);
+		AccumulateTile(result, tile, tileBuffers);
+		for (int y = 0; y < tile.height; y++) {
+			for (int x = 0; x < tile.width; x++) {
+				size_t i = (size_t)(tile.y + y) * width + tile.x + x;
+				size_t j = (size_t)y * tile.width + x;
+				float l = luminance(tileBuffers.colour[j * 3], tileBuffers.colour[j * 3 + 1], tileBuffers.colour[j * 3 + 2]);
+				luminanceSquares[i] += l * l;
+				sampleCounts[i] += passSamples;
+			}
+		}
+		renderedMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tileStart).count();
+		renderedPixels += (double)tile.width * tile.height;
+	};
+
+	// uniform passes over the whole frame first. the first always completes so every pixel has
+	// samples, after that the deadline can stop a pass part way and the unrendered bands keep one fewer
+	FrameStats stats;
+	int uniformPasses = adaptive ? std::min(passes, ADAPTIVE_MIN_PASSES) : passes;
+	bool outOfTime = false;
+	for (int pass = firstPass; pass < uniformPasses && !outOfTime; pass++) {
+		for (size_t t = pass == firstPass ? firstTile : 0; t < tiles.size(); t++) {
+			const Tile& tile = tiles[t];
+			if (pass > 0 && !fitsBudget(tile)) {
+				outOfTime = true;
+				break;
+			}
+			renderTile(tile, pass);
+
+			// the next tile, or the start of the next pass after the last one
+			bool lastTile = t + 1 == tiles.size();
+			reachCheckpoint(lastTile ? pass + 1 : pass, lastTile ? 0 : t + 1);
+		}
+	}
+
+	// then rounds of one more pass on the noisiest half of the blocks still over the threshold,
+	// until none are, they reach the sample count or the next block wouldn't fit the deadline.
+	// checkpointed only between rounds, as the end of the uniform passes with the blocks' extra
+	// samples already in the sums, so a resumed run picks the same blocks from the same sums
+	if (adaptive && !outOfTime) {
+		std::vector<Tile> blocks;
+		for (int y = 0; y < height; y += ADAPTIVE_BLOCK_SIZE) {
+			for (int x = 0; x < width; x += ADAPTIVE_BLOCK_SIZE) {
+				blocks.push_back(Tile(x, y, std::min(ADAPTIVE_BLOCK_SIZE, width - x), std::min(ADAPTIVE_BLOCK_SIZE, height - y)));
+			}
+		}
+
+		std::vector<std::pair<float, size_t>> noisy;
+		while (!outOfTime) {
+			noisy.clear();
+			for (size_t b = 0; b < blocks.size(); b++) {
+				const Tile& block = blocks[b];
+				if ((int)(sampleCounts[(size_t)block.y * width + block.x] / passSamples) >= passes) continue;
+				float error = blockError(result, block);
+				if (error > noiseThreshold) noisy.push_back(std::make_pair(error, b));
+			}
+			if (noisy.empty()) break;
+
+			std::sort(noisy.begin(), noisy.end(), [](const std::pair<float, size_t>& a, const std::pair<float, size_t>& b) { return a.first > b.first; });
+			noisy.resize((noisy.size() + 1) / 2);
+			for (const auto& n : noisy) {
+				const Tile& block = blocks[n.second];
+				if (!fitsBudget(block)) {
+					outOfTime = true;
+					break;
+				}
+				renderTile(block, sampleCounts[(size_t)block.y * width + block.x] / passSamples);
+			}
+			stats.adaptiveRounds++;
+			if (!outOfTime) reachCheckpoint(uniformPasses, 0);
+		}
+	}
+
+	// per pixel, tiles don't have to end with the same sample count
+	stats.minSamples = INT32_MAX;
+	double totalSamples = 0.0;
+	for (size_t i = 0; i < sampleCounts.size(); i++) {
+		float scale = 1.0f / (float)(sampleCounts[i] / passSamples);
+		for (int c = 0; c < 3; c++) {
+			result.colour[i * 3 + c] *= scale;
+			result.albedo[i * 3 + c] *= scale;
+			result.normal[i * 3 + c] *= scale;
+		}
+		result.depth[i] *= scale;
+
+		stats.minSamples = std::min(stats.minSamples, (int)sampleCounts[i]);
+		stats.maxSamples = std::max(stats.maxSamples, (int)sampleCounts[i]);
+		totalSamples += sampleCounts[i];
+	}
+	stats.meanSamples = totalSamples / sampleCounts.size();
+	stats.ms = elapsedMs();
+	return stats;
+}
+
+// mean over the block of each pixel's standard error, from the spread of its pass means,
+// relative to its brightness. result still holds sums here
+float FrameRenderer::blockError(const RenderBuffers& result, const Tile& block) const {
+	double error = 0.0;
+	for (int y = block.y; y < block.y + block.height; y++) {
+		for (int x = block.x; x < block.x + block.width; x++) {
+			size_t i = (size_t)y * width + x;
+			float n = (float)(sampleCounts[i] / passSamples);
+			float mean = luminance(result.colour[i * 3], result.colour[i * 3 + 1], result.colour[i * 3 + 2]) / n;
+			float variance = std::max(luminanceSquares[i] / n - mean * mean, 0.0f) / (n - 1.0f);
+			error += sqrtf(variance) / (ADAPTIVE_ERROR_FLOOR + mean);
+		}
+	}
+	return (float)(error / ((double)block.width * block.height));
+}
+
+void FrameRenderer::WriteSampleCounts(const char* path, int width, int height, const std::vector<uint32_t>& counts) {
+	std::vector<float> pixels(counts.size() * 3);
+	for (size_t i = 0; i < counts.size(); i++) {
+		pixels[i * 3] = pixels[i * 3 + 1] = pixels[i * 3 + 2] = (float)counts[i];
+	}
+	writePFM(path, width, height, pixels.data());
+}
+
+void FrameRenderer::WriteImage(const char* path, const RenderBuffers& buffers) {
+	std::string p = path;
+	if (p.size() >= 4 && p.compare(p.size() - 4, 4, ".pfm") == 0) {
+		writePFM(path, buffers.width, buffers.height, buffers.colour.data());
+	}
+	else {
+		writePPM(path, buffers.width, buffers.height, buffers.ToBytes().data());
+	}
+}
+
+void FrameRenderer::RenderFrames(RenderBackend* backend, SceneData& scene, const RenderOptions& options) {
+	FrameRenderer frames(backend, options.width, options.height, options.samples, options.getPassSamples(), options.tiles);
+	frames.timeBudget = options.timeBudget;
+	frames.adaptive = options.adaptive;
+	frames.noiseThreshold = options.noiseThreshold;
+	frames.checkpointPath = options.checkpoint;
+	frames.checkpointInterval = options.checkpointInterval;
+	frames.checkpointKey = options.SettingsKey();
+	Denoiser denoiser;
+	int frameCount = options.getFrameCount();
+	auto start = std::chrono::high_resolution_clock::now();
+
+	// frames before the checkpoint's were written before it was saved
+	Checkpoint resume;
+	int firstFrame = 0;
+	bool resuming = !options.checkpoint.empty() && resume.Load(options.checkpoint);
+	if (resuming && resume.key != frames.checkpointKey) {
+		printf("%s was saved with other settings, starting over\n", options.checkpoint.c_str());
+		resuming = false;
+	}
+	if (resuming) firstFrame = std::min((int)resume.frame, frameCount);
+	if (!options.checkpoint.empty()) {
+		signal(SIGINT, onStopSignal);
+		signal(SIGTERM, onStopSignal);
+	}
+
+	// frame n is denoised and written on another thread while frame n + 1 renders into the other buffers.
+	// the time that took is read once the writer is joined, and kept out of the budget of the frames after
+	RenderBuffers buffers[2];
+	std::thread writer;
+	double writeMs = 0.0;
+	for (int frame = firstFrame; frame < frameCount; frame++) {
+		RenderBuffers& result = buffers[frame & 1];
+		options.ApplyCamera(frame, scene.camera);
+		FrameStats stats = frames.Render(scene.MakeCameraBuffer(glm::uvec2(options.width, options.height)), result, frame, resuming ? &resume : nullptr);
+
+		// nothing can be checkpointed after the last frame has rendered, so a stop ends the run as usual
+		if (!options.checkpoint.empty() && frame + 1 == frameCount) {
+			signal(SIGINT, SIG_DFL);
+			signal(SIGTERM, SIG_DFL);
+		}
+
+		if (writer.joinable()) writer.join();
+		frames.reservedMs = writeMs;
+		std::string path = options.OutputPath(frame);
+		std::string samplesPath = options.SamplesPath(frame);
+		std::vector<uint32_t> counts = samplesPath.empty() ? std::vector<uint32_t>() : frames.getSampleCounts();
+		writer = std::thread([&options, &denoiser, &result, &writeMs, path, samplesPath, counts, stats]() {
+			auto writeStart = std::chrono::high_resolution_clock::now();
+			if (options.denoise) denoiser.Denoise(result);
+			WriteImage(path.c_str(), result);
+			if (!samplesPath.empty()) WriteSampleCounts(samplesPath.c_str(), result.width, result.height, counts);
+			writeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - writeStart).count();
+			printf("%s: %.0fms + %.0fms denoise and write, %d to %d samples per pixel, %.1f mean", path.c_str(), stats.ms, writeMs, stats.minSamples, stats.maxSamples, stats.meanSamples);
+			if (options.adaptive) printf(", %d adaptive rounds", stats.adaptiveRounds);
+			printf("\n");
+		});
+		// a checkpoint of the next frame must not be saved before this one is on disk
+		if (!options.checkpoint.empty()) {
+			writer.join();
+			frames.reservedMs = writeMs;
+		}
+
+		// a stop during the denoise and write, or the last part of Render, is caught here with an
+		// empty checkpoint of the next frame, which starts it from the beginning
+		if (stopRequested && frame + 1 < frameCount) {
+			Checkpoint next;
+			next.key = frames.checkpointKey;
+			next.frame = frame + 1;
+			options.ApplyCamera(frame + 1, scene.camera);
+			next.camera = scene.MakeCameraBuffer(glm::uvec2(options.width, options.height));
+			next.sums.Resize(options.width, options.height);
+			next.sampleCounts.assign((size_t)options.width * options.height, 0);
+			next.luminanceSquares.assign((size_t)options.width * options.height, 0.0f);
+			next.Save(options.checkpoint);
+			printf("stopped at a checkpoint in %s\n", options.checkpoint.c_str());
+			exit(0);
+		}
+	}
+	if (writer.joinable()) writer.join();
+	if (!options.checkpoint.empty()) std::remove(options.checkpoint.c_str());
+
+	if (frameCount > 1) {
+		double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+		printf("%d frames in %.1fs, %.0f frames/hour\n", frameCount, seconds, frameCount / seconds * 3600.0);
+	}
+}
+
+void FrameRenderer::RenderFramesCpu(SceneData& scene, const RenderOptions& options) {
+	// without the shader's balanced stack limit the CPU tracer can use the faster sah tree,
+	// with leaves of SphereStore clusters
+	scene.CalculateClusters(BVH_SPLIT_SAH);
+	BlueNoise noise(BLUE_NOISE_SIZE);
+
+	CpuRenderer renderer(scene, &noise, options.getPassSamples(), options.depth, options.rrDepth);
+	renderer.threads = options.threads;
+	RenderFrames(&renderer, scene, options);
+	printf("Average path length: %.3f segments.\n", renderer.getAveragePathLength());
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "RenderBackend.h"
+#include "RenderBuffers.h"
+#include "RenderOptions.h"
+#include "SceneData.h"
+#include "Checkpoint.h"
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+// predicted tile times are padded by this much before checking them against the deadline
+#define DEADLINE_MARGIN 1.2
+// adaptive sampling: uniform passes before the first round, the square blocks rounds add passes to,
+// and the brightness below which the noise threshold stops being relative
+#define ADAPTIVE_MIN_PASSES 2
+#define ADAPTIVE_BLOCK_SIZE 32
+#define ADAPTIVE_ERROR_FLOOR 0.05f
+
+// what one call to FrameRenderer::Render achieved
+struct FrameStats {
+	int minSamples = 0;
+	int maxSamples = 0;
+	double meanSamples = 0.0;
+	int adaptiveRounds = 0;
+	double ms = 0.0;
+};
+
+// renders whole frames through a backend: every pass goes over the frame in horizontal bands,
+// short enough to keep each draw under the driver's timeout, and the passes are averaged.
+// with a time budget it doesn't start a tile it predicts would end after the deadline. adaptive
+// frames follow a couple of uniform passes with rounds of extra passes on the noisiest blocks.
+// with a checkpoint path it saves its progress there every checkpointInterval seconds
+class FrameRenderer
+{
+public:
+	// seconds per frame, 0 to always render every pass
+	double timeBudget = 0.0;
+	// ms of the budget kept for what happens to the frame after Render, its denoise and write
+	double reservedMs = 0.0;
+	bool adaptive = false;
+	// relative standard error a block is sampled down to, see blockError
+	float noiseThreshold = 0.02f;
+	std::string checkpointPath;
+	double checkpointInterval = 60.0;
+	uint64_t checkpointKey = 0;
+
+	FrameRenderer(RenderBackend* backend, int width, int height, int samples, int passSamples, int tiles = 1);
+	// carries on from resume when it is a checkpoint of this frame and camera
+	FrameStats Render(const CameraBuffer& camera, RenderBuffers& result, int frame = 0, const Checkpoint* resume = nullptr);
+	int getPasses() const { return passes; };
+	const std::vector<Tile>& getTiles() const { return tiles; };
+	const std::vector<uint32_t>& getSampleCounts() const { return sampleCounts; };
+
+	// count horizontal bands covering the image, at most one per row
+	static std::vector<Tile> SplitBands(int width, int height, int count);
+	// adds a tile's buffers into the same rectangle of a whole frame
+	static void AccumulateTile(RenderBuffers& result, const Tile& tile, const RenderBuffers& tileBuffers);
+	static void Scale(RenderBuffers& buffers, float scale);
+	// .pfm writes the linear float colour, anything else the gamma corrected 8 bit ppm
+	static void WriteImage(const char* path, const RenderBuffers& buffers);
+	// samples per pixel as a greyscale pfm
+	static void WriteSampleCounts(const char* path, int width, int height, const std::vector<uint32_t>& counts);
+	// every frame the options ask for, one after another on the same backend, so the bvh and
+	// shaders are built once. scene.camera is moved to each frame's camera. with a checkpoint,
+	// SIGINT and SIGTERM save one after the current tile and exit
+	static void RenderFrames(RenderBackend* backend, SceneData& scene, const RenderOptions& options);
+	// RenderFrames on a CpuRenderer, after building the sah bvh it prefers
+	static void RenderFramesCpu(SceneData& scene, const RenderOptions& options);
+private:
+	RenderBackend* backend;
+	int width, height;
+	int passSamples;
+	int passes;
+	std::vector<Tile> tiles;
+	RenderBuffers tileBuffers;
+	std::vector<uint32_t> sampleCounts;
+	std::vector<float> luminanceSquares; // sum of each pass's squared luminance, for the noise estimate
+
+	float blockError(const RenderBuffers& result, const Tile& block) const;
+};
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+#include <iostream>
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+static void checkGlErrors(std::string desc)
+{
+	GLenum e = glGetError();
+	if (e != GL_NO_ERROR) {
+		fprintf(stderr, "OpenGL error in \"%s\": (%d)\n", desc.c_str(), e);
+		exit(20);
+	}
+}
+
+static void glErrorCallback(int code, const char* desc) {
+	std::cout << "OpenGL error: " << desc << "\n(Code " << code << ")\n";
+	exit(20);
+}
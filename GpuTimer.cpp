@@ -0,0 +1,38 @@
+#include "GpuTimer.h"
+
+void GpuTimer::Create() {
+	glGenQueries(GPU_TIMER_QUERIES, queries);
+	created = true;
+}
+
+void GpuTimer::Begin() {
+	// drop the oldest result rather than wait for it
+	if (written - read >= GPU_TIMER_QUERIES) read = written - GPU_TIMER_QUERIES + 1;
+	glBeginQuery(GL_TIME_ELAPSED, queries[written % GPU_TIMER_QUERIES]);
+}
+
+void GpuTimer::End() {
+	glEndQuery(GL_TIME_ELAPSED);
+	written++;
+}
+
+// oldest finished measurement, if there is one
+bool GpuTimer::Poll(double& ms) {
+	if (read == written) return false;
+
+	GLuint query = queries[read % GPU_TIMER_QUERIES];
+	GLint available = 0;
+	glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available) return false;
+
+	GLuint64 ns = 0;
+	glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+	ms = (double)ns / 1e6;
+	read++;
+	return true;
+}
+
+void GpuTimer::Delete() {
+	if (created) glDeleteQueries(GPU_TIMER_QUERIES, queries);
+	created = false;
+}
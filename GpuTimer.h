@@ -0,0 +1,24 @@
+#pragma once
+
+#include <glad/glad.h>
+
+// how many frames a GL_TIME_ELAPSED result may lag behind before Begin reuses its query
+#define GPU_TIMER_QUERIES 4
+
+// times gpu work between Begin and End with a ring of queries, so reading a result
+// never stalls on a frame that is still in flight
+class GpuTimer
+{
+public:
+	GpuTimer() {};
+	void Create();
+	void Begin();
+	void End();
+	bool Poll(double& ms);
+	void Delete();
+private:
+	GLuint queries[GPU_TIMER_QUERIES] = { 0 };
+	int written = 0; // queries ended so far
+	int read = 0; // results collected so far
+	bool created = false;
+};
@@ -9,8 +9,17 @@
 #include "RenderQuad.h"
 #include "Scene.h"
 #include "Shader.h"
-
-// TIMES: ---------
+#include "Tracer.h"
+#include "Denoiser.h"
+#include "RenderBuffers.h"
+#include "Profiler.h"
+#include "SceneLibrary.h"
+#include "FrameRenderer.h"
+#include "RenderOptions.h"
+#include "Distributed.h"
+#include "GLUtils.h"
+
+// TIMES: --------- (old notes, the Benchmark project gives reproducible numbers)
 // v?.1 - spheres mem - 2522
 // v2.0 - empty bvh -> gpu - 2630
 // v2.1 bvh aabbs 2137
@@ -19,13 +28,19 @@
 // 1920x1080, 256 samples, 32 depth, 256 steps
 // 33.5s
 
-// MODE = 0 for interactable camera (WASD, SPACE, SHIFT, MOUSE) [lower samples & depth]
-// MODE = 1 for render single image [higher quality]
-#define MODE 1
+// the first argument picks the mode, see RenderOptions::PrintUsage or --help:
+// view for interactable camera (WASD, SPACE, SHIFT, MOUSE, N to toggle denoising, H to toggle temporal accumulation, G to toggle dynamic resolution) [lower samples & depth]
+// render for images [higher quality], on the GPU or with --backend cpu the CPU path tracer
+// variants for timing table of specialised shader variants against the generic kernel
+// rays for CPU closest-hit vs occlusion ray throughput
+// denoise for error and time of denoised low sample renders against brute force samples
+// coordinator and worker to split renders over several processes, see Distributed.h
+// (the headless Render program renders on the CPU without GLFW, see Render.cpp)
 
 class Window {
 public:
-	Window(int width, int height) {
+	Window(const RenderOptions& options) {
+		int width = options.width, height = options.height;
 		window = glfwCreateWindow(width, height, "Ray Tracing!", NULL, NULL);
 
 		if (window == NULL) {
@@ -48,7 +63,8 @@ public:
 		gladLoadGL();
 		glViewport(0, 0, width, height);
 
-		Scene scene(width, height, 8, 8);
+		Scene scene(SceneLibrary::Open(options.scene, options.seed), width, height, options.samples, options.depth, options.rrDepth);
+		options.ApplyCamera(0, scene.camera);
 		scene_p = &scene;
 
 		glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
@@ -68,6 +84,7 @@ public:
 
 			processKeyInput();
 			scene_p->Render();
+			updateTitle();
 
 			glfwSwapBuffers(window);
 			glfwPollEvents();
@@ -118,12 +135,23 @@ public:
 		else if (key == GLFW_KEY_T) {
 			toggleFocus();
 		}
+		else if (key == GLFW_KEY_N) {
+			scene_p->ToggleDenoise();
+		}
+		else if (key == GLFW_KEY_H) {
+			scene_p->ToggleTemporal();
+		}
+		else if (key == GLFW_KEY_G) {
+			scene_p->ToggleDynamicResolution();
+		}
 		else if (key == GLFW_KEY_P) {
 			std::cout << "----CAMERA INFO----" << "\n"
 				<< "POSITION: " << toString(scene_p->camera.position) << "\n"
 				<< "YAW: " << scene_p->camera.yaw << "\n"
 				<< "PITCH: " << scene_p->camera.pitch << "\n"
-				<< "FOV: " << scene_p->camera.fov << "\n";
+				<< "FOV: " << scene_p->camera.fov << "\n"
+				<< "PATH KEY: key " << lastTime << " " << scene_p->camera.position.x << " " << scene_p->camera.position.y << " " << scene_p->camera.position.z << " "
+				<< scene_p->camera.yaw << " " << scene_p->camera.pitch << " " << scene_p->camera.fov << "\n";
 		}
 	}
 
@@ -132,6 +160,7 @@ private:
 	Scene* scene_p;
 
 	float lastTime, deltaTime = 0.0f;
+	float lastTitleTime = 0.0f;
 	float lastx, lasty = 0.0f;
 	bool firstMouse = true;
 	bool focused = true;
@@ -176,6 +205,22 @@ private:
 			scene_p->camera.Move(RIGHT, deltaTime);
 	}
 
+	// gpu frame time and what the governor is doing, twice a second
+	void updateTitle() {
+		if (lastTime - lastTitleTime < 0.5f) return;
+		lastTitleTime = lastTime;
+
+		const FrameGovernor& governor = scene_p->getGovernor();
+		char title[128];
+		if (scene_p->getDynamicResolution()) {
+			snprintf(title, sizeof(title), "Ray Tracing! | %.1f ms | %d%% scale%s", governor.getFrameMs(), (int)(governor.getScale() * 100.0f + 0.5f), governor.getCheckerboard() ? " | checkerboard" : "");
+		}
+		else {
+			snprintf(title, sizeof(title), "Ray Tracing! | %.1f ms", governor.getFrameMs());
+		}
+		glfwSetWindowTitle(window, title);
+	}
+
 	void toggleFocus() {
 		if (focused) {
 			focused = false;
@@ -191,52 +236,217 @@ private:
 
 class ImageRenderer {
 public:
-	ImageRenderer(int width, int height, int samples, int depth, int steps = 1) {
+	ImageRenderer(const RenderOptions& options) {
+		Profiler& profiler = Profiler::Get();
+		profiler.enabled = options.profile;
 		auto start = std::chrono::high_resolution_clock::now();
 
-		GLFWwindow* window = glfwCreateWindow(width, height, "Rendering...", NULL, NULL);
+		// only the context is needed, everything is drawn into the scene's render targets
+		GLFWwindow* window;
+		{
+			ScopedTimer timer("window");
+			glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+			window = glfwCreateWindow(options.width, options.height, "Rendering...", NULL, NULL);
+			if (window == NULL) {
+				fprintf(stderr, "Failed to create GLFW window, --backend cpu renders without one\n");
+				glfwTerminate();
+				exit(1);
+			}
+			glfwMakeContextCurrent(window);
+			gladLoadGL();
+		}
+
+		auto sceneStart = std::chrono::high_resolution_clock::now();
+		Scene scene(SceneLibrary::Open(options.scene, options.seed), options.width, options.height, options.getPassSamples(), options.depth, options.rrDepth, true, options.profile);
+		scene.RenderTextureInit();
+		profiler.AddCpu("scene", std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - sceneStart).count());
+
+		{
+			ScopedTimer timer("render");
+			FrameRenderer::RenderFrames(&scene, scene, options);
+			glFinish();
+		}
+
+		auto end = std::chrono::high_resolution_clock::now();
+		auto runtime = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+		std::cout << "Elapsed time: " << runtime.count() << "ms.\n";
+		std::cout << "Average path length: " << scene.getAveragePathLength() << " segments.\n";
+
+		if (options.profile) {
+			const TraceStats& stats = scene.getTraceStats();
+			profiler.CollectGpu(true);
+			profiler.AddCounter("paths", stats.paths);
+			profiler.AddCounter("segments", stats.segments);
+			profiler.AddCounter("rays", stats.rays);
+			profiler.AddCounter("node visits", stats.nodeVisits);
+			profiler.AddCounter("primitive tests", stats.primitiveTests);
+			profiler.Print();
+			profiler.WriteJSON("profile.json");
+			profiler.WriteCSV("profile.csv");
+		}
+
+		profiler.Delete();
+		scene.Delete();
+		glfwDestroyWindow(window);
+		glfwTerminate();
+	}
+};
+
+// a worker rendering on the GPU, everything but the camera comes from the coordinator's setup
+class GpuWorker {
+public:
+	GpuWorker(const RenderOptions& options) {
+		RenderWorker worker(options.address);
+		const DistSetup& setup = worker.getSetup();
+
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+		GLFWwindow* window = glfwCreateWindow(setup.width, setup.height, "Rendering...", NULL, NULL);
+		if (window == NULL) {
+			fprintf(stderr, "Failed to create GLFW window, --backend cpu renders without one\n");
+			glfwTerminate();
+			exit(1);
+		}
 		glfwMakeContextCurrent(window);
 		gladLoadGL();
-		glViewport(0, 0, width, height);
-		Scene scene(width, height, samples, depth);
-		
-		int step = height / steps;
 
+		srand(setup.seed);
+		Scene scene(SceneLibrary::Open(setup.scene, setup.seed), setup.width, setup.height, setup.passSamples, setup.depth, setup.rrDepth);
 		scene.RenderTextureInit();
-		for (int i = 0; i < height / step; i++) {
-			scene.RenderTexture(i * step, std::min((i + 1) * step, height));
-			scene.TextureToScreen();
-			glfwSwapBuffers(window);
-			glfwPollEvents();
-		}
-		
-		unsigned char* pixels = (unsigned char*) malloc(width * height * 3);
+		worker.Serve(&scene);
 
-		glBindFramebuffer(GL_FRAMEBUFFER, scene.getFrameBuffer());
-		glReadBuffer(GL_COLOR_ATTACHMENT0);
-		glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+		scene.Delete();
+		glfwDestroyWindow(window);
+		glfwTerminate();
+	}
+};
+
+class DenoiseBenchmark {
+public:
+	DenoiseBenchmark(const std::string& sceneName, int width, int height, int depth, int referenceSamples, unsigned int seed) {
+		this->sceneName = sceneName;
+		GLFWwindow* window = glfwCreateWindow(width, height, "Benchmarking...", NULL, NULL);
+		glfwMakeContextCurrent(window);
+		gladLoadGL();
+		glViewport(0, 0, width, height);
 
-		std::fstream output_image("output.ppm", std::ios::out | std::ios::trunc);
-		output_image << "P3\n"
-			<< width << " " << height << "\n"
-			<< "255\n";
+		RenderBuffers reference;
+		renderFrame(width, height, referenceSamples, depth, seed, reference);
+
+		const int sampleCounts[] = { 1, 2, 4, 8, 16, 32, 64, 128, 256 };
+		std::vector<float> rawErrors, rawTimes;
+		float targetError = 0.0f, targetTime = 0.0f;
+		int targetSamples = 0;
+
+		printf("%dx%d, %d depth, reference %d samples\n", width, height, depth, referenceSamples);
+		printf("%7s | %11s | %9s | %13s | %13s\n", "samples", "render (ms)", "raw rmse", "denoise (ms)", "denoised rmse");
+		for (int samples : sampleCounts) {
+			RenderBuffers buffers;
+			float renderTime = renderFrame(width, height, samples, depth, seed, buffers);
+			float rawError = rmse(buffers, reference);
+
+			Denoiser denoiser;
+			auto start = std::chrono::high_resolution_clock::now();
+			denoiser.Denoise(buffers);
+			auto end = std::chrono::high_resolution_clock::now();
+			float denoiseTime = std::chrono::duration<float, std::milli>(end - start).count();
+			float denoisedError = rmse(buffers, reference);
+
+			printf("%7d | %11.2f | %9.4f | %13.2f | %13.4f\n", samples, renderTime, rawError, denoiseTime, denoisedError);
+			rawErrors.push_back(rawError);
+			rawTimes.push_back(renderTime);
+
+			// 16 samples is the budget the denoiser is meant for
+			if (samples == 16) {
+				targetError = denoisedError;
+				targetTime = renderTime + denoiseTime;
+				targetSamples = samples;
+			}
+			glfwPollEvents();
+		}
 
-		for (int y = 0; y < height; y++) {
-			for (int x = 0; x < width; x++) {
-				int pos = (x + (height - y - 1) * width) * 3;
-				output_image << (unsigned int) pixels[pos] << " " << (unsigned int) pixels[pos + 1] << " " << (unsigned int) pixels[pos + 2] << " ";
+		for (size_t i = 0; i < rawErrors.size(); i++) {
+			if (rawErrors[i] <= targetError) {
+				printf("brute force matches denoised %d samples (%.2fms) at %d samples (%.2fms)\n", targetSamples, targetTime, sampleCounts[i], rawTimes[i]);
+				break;
+			}
+			if (i + 1 == rawErrors.size()) {
+				printf("brute force does not match denoised %d samples (%.2fms) within %d samples\n", targetSamples, targetTime, sampleCounts[i]);
 			}
-			output_image << "\n";
 		}
 
-		free(pixels);
-		output_image.close();
+		glfwDestroyWindow(window);
+		glfwTerminate();
+	}
+
+private:
+	std::string sceneName;
+
+	// the seed rebuilds the same random ball layout for every sample count
+	float renderFrame(int width, int height, int samples, int depth, unsigned int seed, RenderBuffers& buffers) {
+		srand(seed);
+		Scene scene(SceneLibrary::Open(sceneName, rand()), width, height, samples, depth);
+		scene.RenderTextureInit();
 
+		// bands keep each draw short at high sample counts
+		int bandHeight = std::max(1, height * 16 / samples);
+		scene.RenderTexture(0, std::min(bandHeight, height));
+		glFinish();
+
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int y = 0; y < height; y += bandHeight) {
+			scene.RenderTexture(y, std::min(y + bandHeight, height));
+		}
+		glFinish();
 		auto end = std::chrono::high_resolution_clock::now();
-		auto runtime = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-		std::cout << "Elapsed time: " << runtime.count() << "ms.\n";
 
-		while (!glfwWindowShouldClose(window)) {
+		scene.ReadBuffers(buffers);
+		scene.Delete();
+		return std::chrono::duration<float, std::milli>(end - start).count();
+	}
+
+	// on gamma corrected values, the same space the image is viewed in
+	float rmse(const RenderBuffers& a, const RenderBuffers& b) {
+		double sum = 0.0;
+		for (size_t i = 0; i < a.colour.size(); i++) {
+			double d = sqrt(std::min(std::max(a.colour[i], 0.0f), 1.0f)) - sqrt(std::min(std::max(b.colour[i], 0.0f), 1.0f));
+			sum += d * d;
+		}
+		return (float)sqrt(sum / a.colour.size());
+	}
+};
+
+class VariantBenchmark {
+public:
+	VariantBenchmark(const std::string& sceneName, unsigned int seed, int width, int height, int samples, int depth, int frames) {
+		GLFWwindow* window = glfwCreateWindow(width, height, "Benchmarking...", NULL, NULL);
+		glfwMakeContextCurrent(window);
+		gladLoadGL();
+		glViewport(0, 0, width, height);
+		Scene scene(SceneLibrary::Open(sceneName, seed), width, height, samples, depth);
+		scene.RenderTextureInit();
+
+		// the same ball layout with progressively fewer material classes
+		const unsigned int materialSets[] = {
+			FEATURE_LAMBERTIAN | FEATURE_SPECULAR | FEATURE_REFRACTIVE,
+			FEATURE_LAMBERTIAN | FEATURE_SPECULAR,
+			FEATURE_LAMBERTIAN | FEATURE_REFRACTIVE,
+			FEATURE_LAMBERTIAN,
+		};
+
+		// LimitMaterials rewrites the table, so every row starts again from the scene's own materials
+		std::vector<MaterialBuffer> sceneMaterials = scene.materials;
+
+		printf("%dx%d, %d samples, %d depth, %d frames\n", width, height, samples, depth, frames);
+		printf("%-36s | %12s | %16s | %7s\n", "scene features", "generic (ms)", "specialised (ms)", "speedup");
+		for (unsigned int materials : materialSets) {
+			scene.materials = sceneMaterials;
+			scene.LimitMaterials(materials);
+			SceneFeatures specialised = scene.getFeatures();
+
+			float generic = timeVariant(scene, SceneFeatures(FEATURE_ALL), height, frames);
+			float special = timeVariant(scene, specialised, height, frames);
+			printf("%-36s | %12.2f | %16.2f | %6.2fx\n", specialised.ToString().c_str(), generic, special, generic / special);
+
 			glfwPollEvents();
 		}
 
@@ -244,20 +454,121 @@ public:
 		glfwDestroyWindow(window);
 		glfwTerminate();
 	}
+
+private:
+	// average ms per full frame, after one untimed warmup frame
+	float timeVariant(Scene& scene, const SceneFeatures& variant, int height, int frames) {
+		scene.UseVariant(variant);
+		scene.RenderTexture(0, height);
+		glFinish();
+
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < frames; i++) {
+			scene.RenderTexture(0, height);
+		}
+		glFinish();
+		auto end = std::chrono::high_resolution_clock::now();
+
+		return std::chrono::duration<float, std::milli>(end - start).count() / frames;
+	}
 };
 
-int main() {
-	srand(time(NULL));
+class RayQueryBenchmark {
+public:
+	RayQueryBenchmark(const std::string& sceneName, unsigned int seed, int width, int height, int repeats) {
+		SceneData scene = SceneLibrary::Open(sceneName, seed);
+		scene.CalculateBVHs(BVH_SPLIT_MEDIAN, seed);
+
+		Tracer tracer(&scene.spheres, &scene.bvhs);
+		CameraBuffer cam = scene.MakeCameraBuffer(glm::uvec2(width, height));
+
+		// camera rays, then one bounce ray per camera hit like a shadow or ao ray would be
+		std::vector<Ray> rays;
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) {
+				glm::vec3 pixel = cam.viewportTopLeft + (float)x * cam.du + (float)y * cam.dv;
+				Ray r(cam.position, pixel - cam.position);
+				rays.push_back(r);
+
+				HitRecord rec;
+				if (tracer.Hit(r, 0.001f, INFINITY, rec)) {
+					glm::vec3 d = randomVec3() * 2.0f - glm::vec3(1, 1, 1);
+					rays.push_back(Ray(rec.p, glm::dot(d, rec.normal) < 0 ? -d : d));
+				}
+			}
+		}
+
+		int hits = 0, occluded = 0;
+
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < repeats; i++) {
+			for (auto& r : rays) {
+				HitRecord rec;
+				hits += tracer.Hit(r, 0.001f, INFINITY, rec);
+			}
+		}
+		auto mid = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < repeats; i++) {
+			for (auto& r : rays) {
+				occluded += tracer.Occluded(r, 0.001f, INFINITY);
+			}
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+
+		float total = (float)rays.size() * repeats;
+		float closestSecs = std::chrono::duration<float>(mid - start).count();
+		float anySecs = std::chrono::duration<float>(end - mid).count();
+		printf("%zu rays x %d, 1 thread\n", rays.size(), repeats);
+		printf("closest hit: %8.3f Mrays/s (%d hits)\n", total / closestSecs / 1e6f, hits);
+		printf("occlusion:   %8.3f Mrays/s (%d hits)\n", total / anySecs / 1e6f, occluded);
+	}
+};
+
+int main(int argc, char** argv) {
+	RenderOptions options;
+	options.Parse(argc, argv);
+	srand(options.seed);
+
+	if (options.mode == "render" && options.backend == "cpu") {
+		SceneData scene = SceneLibrary::Open(options.scene, options.seed);
+		FrameRenderer::RenderFramesCpu(scene, options);
+		return 0;
+	}
+	if (options.mode == "coordinator") {
+		SceneData scene = SceneLibrary::Open(options.scene, options.seed);
+		RenderCoordinator coordinator(options);
+		coordinator.Run(scene);
+		return 0;
+	}
+	if (options.mode == "worker" && options.backend == "cpu") {
+		RenderWorker worker(options.address);
+		worker.ServeCpu(options.threads);
+		return 0;
+	}
+	if (options.mode == "rays") {
+		RayQueryBenchmark b(options.scene, options.seed, options.width, options.height, options.samples);
+		return 0;
+	}
+
 	glfwInit();
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
-	if (MODE == 0) {
-		Window window(1280, 720);
+	if (options.mode == "view") {
+		Window window(options);
+	}
+	else if (options.mode == "render") {
+		ImageRenderer r(options);
+	}
+	else if (options.mode == "worker") {
+		GpuWorker w(options);
+	}
+	else if (options.mode == "variants") {
+		VariantBenchmark b(options.scene, options.seed, options.width, options.height, options.samples, options.depth, 10);
 	}
 	else {
-		ImageRenderer r(1920, 1080, 256, 16, 256);
+		DenoiseBenchmark b(options.scene, options.width, options.height, options.depth, options.samples, options.seed);
 	}
 	return 0;
-}
\ No newline at end of file
+}
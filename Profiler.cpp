@@ -0,0 +1,173 @@
+#include "Profiler.h"
+
+#include <cstdio>
+#include <fstream>
+
+Profiler& Profiler::Get() {
+	static Profiler profiler;
+	return profiler;
+}
+
+Profiler::Phase& Profiler::getPhase(const std::string& name) {
+	auto it = phaseIndex.find(name);
+	if (it != phaseIndex.end()) return phases[it->second];
+
+	// phases keep the order they first ran in
+	phaseIndex[name] = phases.size();
+	Phase phase;
+	phase.name = name;
+	phases.push_back(phase);
+	return phases.back();
+}
+
+void Profiler::AddCpu(const std::string& phase, double ms) {
+	if (!enabled) return;
+	Phase& p = getPhase(phase);
+	p.cpuCalls++;
+	p.cpuMs += ms;
+}
+
+GLuint Profiler::getQuery() {
+	if (freeQueries.empty()) {
+		GLuint query;
+		glGenQueries(1, &query);
+		return query;
+	}
+	GLuint query = freeQueries.back();
+	freeQueries.pop_back();
+	return query;
+}
+
+void Profiler::BeginGpu(const std::string& phase) {
+	if (!enabled) return;
+	getPhase(phase);
+	GpuScope scope;
+	scope.phase = phaseIndex[phase];
+	scope.begin = getQuery();
+	scope.end = 0;
+	glQueryCounter(scope.begin, GL_TIMESTAMP);
+	openScopes.push_back(scope);
+}
+
+void Profiler::EndGpu() {
+	if (!enabled || openScopes.empty()) return;
+	GpuScope scope = openScopes.back();
+	openScopes.pop_back();
+	scope.end = getQuery();
+	glQueryCounter(scope.end, GL_TIMESTAMP);
+	pendingScopes.push_back(scope);
+}
+
+// turn finished timestamp pairs into phase times. without wait, stops at the first scope
+// the gpu hasn't reached yet, so it can be called every frame
+void Profiler::CollectGpu(bool wait) {
+	size_t done = 0;
+	for (; done < pendingScopes.size(); done++) {
+		GpuScope& scope = pendingScopes[done];
+		if (!wait) {
+			GLint available = 0;
+			glGetQueryObjectiv(scope.end, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available) break;
+		}
+
+		GLuint64 begin = 0, end = 0;
+		glGetQueryObjectui64v(scope.begin, GL_QUERY_RESULT, &begin);
+		glGetQueryObjectui64v(scope.end, GL_QUERY_RESULT, &end);
+
+		Phase& p = phases[scope.phase];
+		p.gpuCalls++;
+		p.gpuMs += (double)(end - begin) / 1e6;
+
+		freeQueries.push_back(scope.begin);
+		freeQueries.push_back(scope.end);
+	}
+	pendingScopes.erase(pendingScopes.begin(), pendingScopes.begin() + done);
+}
+
+void Profiler::AddCounter(const std::string& name, unsigned long long value) {
+	if (!enabled) return;
+	for (auto& c : counters) {
+		if (c.first == name) {
+			c.second += value;
+			return;
+		}
+	}
+	counters.push_back(std::make_pair(name, value));
+}
+
+// scopes refer to phases by index, so the pending ones are collected into the old phases first
+// and the open ones are dropped, their EndGpu then does nothing
+void Profiler::Reset() {
+	CollectGpu(true);
+	for (auto& s : openScopes) freeQueries.push_back(s.begin);
+	openScopes.clear();
+	phases.clear();
+	phaseIndex.clear();
+	counters.clear();
+}
+
+void Profiler::Print() const {
+	printf("%-24s | %6s | %12s | %6s | %12s\n", "phase", "calls", "cpu (ms)", "gpu n", "gpu (ms)");
+	for (auto& p : phases) {
+		printf("%-24s | %6d | %12.3f | %6d | %12.3f\n", p.name.c_str(), p.cpuCalls, p.cpuMs, p.gpuCalls, p.gpuMs);
+	}
+	if (counters.empty()) return;
+	printf("%-24s | %s\n", "counter", "value");
+	for (auto& c : counters) {
+		printf("%-24s | %llu\n", c.first.c_str(), c.second);
+	}
+}
+
+void Profiler::WriteJSON(const char* path) const {
+	std::ofstream out(path);
+	if (!out) {
+		fprintf(stderr, "Could not write profile to '%s'\n", path);
+		return;
+	}
+
+	out << "{\n  \"phases\": [\n";
+	for (size_t i = 0; i < phases.size(); i++) {
+		const Phase& p = phases[i];
+		out << "    { \"name\": \"" << p.name << "\", \"cpu_calls\": " << p.cpuCalls << ", \"cpu_ms\": " << p.cpuMs
+			<< ", \"gpu_calls\": " << p.gpuCalls << ", \"gpu_ms\": " << p.gpuMs << " }" << (i + 1 < phases.size() ? "," : "") << "\n";
+	}
+	out << "  ],\n  \"counters\": {\n";
+	for (size_t i = 0; i < counters.size(); i++) {
+		out << "    \"" << counters[i].first << "\": " << counters[i].second << (i + 1 < counters.size() ? "," : "") << "\n";
+	}
+	out << "  }\n}\n";
+}
+
+void Profiler::WriteCSV(const char* path) const {
+	std::ofstream out(path);
+	if (!out) {
+		fprintf(stderr, "Could not write profile to '%s'\n", path);
+		return;
+	}
+
+	out << "kind,name,cpu_calls,cpu_ms,gpu_calls,gpu_ms,value\n";
+	for (auto& p : phases) {
+		out << "phase," << p.name << "," << p.cpuCalls << "," << p.cpuMs << "," << p.gpuCalls << "," << p.gpuMs << ",\n";
+	}
+	for (auto& c : counters) {
+		out << "counter," << c.first << ",,,,," << c.second << "\n";
+	}
+}
+
+void Profiler::Delete() {
+	CollectGpu(true);
+	for (auto& s : openScopes) glDeleteQueries(1, &s.begin);
+	openScopes.clear();
+	if (!freeQueries.empty()) glDeleteQueries((GLsizei)freeQueries.size(), freeQueries.data());
+	freeQueries.clear();
+}
+
+ScopedTimer::ScopedTimer(const char* phase) {
+	this->phase = phase;
+	start = std::chrono::high_resolution_clock::now();
+}
+
+ScopedTimer::~ScopedTimer() {
+	auto end = std::chrono::high_resolution_clock::now();
+	Profiler::Get().AddCpu(phase, std::chrono::duration<double, std::milli>(end - start).count());
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <chrono>
+
+// per phase cpu and gpu times plus named counters for a run, printed to stdout and written
+// out as json/csv. disabled by default so the viewer pays nothing; only use it from the gl thread
+class Profiler
+{
+public:
+	bool enabled = false;
+
+	static Profiler& Get();
+	void AddCpu(const std::string& phase, double ms);
+	void BeginGpu(const std::string& phase);
+	void EndGpu();
+	void CollectGpu(bool wait);
+	void AddCounter(const std::string& name, unsigned long long value);
+	void Reset();
+	void Print() const;
+	void WriteJSON(const char* path) const;
+	void WriteCSV(const char* path) const;
+	void Delete();
+private:
+	struct Phase {
+		std::string name;
+		int cpuCalls = 0;
+		double cpuMs = 0.0;
+		int gpuCalls = 0;
+		double gpuMs = 0.0;
+	};
+	// a gpu scope is a pair of GL_TIMESTAMP queries, so scopes can nest and overlap
+	// other GL_TIME_ELAPSED queries, which can't be nested
+	struct GpuScope {
+		size_t phase;
+		GLuint begin, end;
+	};
+
+	std::vector<Phase> phases;
+	std::unordered_map<std::string, size_t> phaseIndex;
+	std::vector<std::pair<std::string, unsigned long long>> counters;
+	std::vector<GpuScope> openScopes;
+	std::vector<GpuScope> pendingScopes;
+	std::vector<GLuint> freeQueries;
+
+	Phase& getPhase(const std::string& name);
+	GLuint getQuery();
+};
+
+// adds the time until it goes out of scope to a phase
+class ScopedTimer
+{
+public:
+	ScopedTimer(const char* phase);
+	~ScopedTimer();
+private:
+	const char* phase;
+	std::chrono::high_resolution_clock::time_point start;
+};
+
+class ScopedGpuTimer
+{
+public:
+	ScopedGpuTimer(const char* phase) { Profiler::Get().BeginGpu(phase); };
+	~ScopedGpuTimer() { Profiler::Get().EndGpu(); };
+};
@@ -0,0 +1,41 @@
+// headless offline renderer on the CPU path tracer, for machines without a GPU or display.
+// takes the same options as "OpenGLRayTracer render", see RenderOptions::PrintUsage
+#include <iostream>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "SceneLibrary.h"
+#include "FrameRenderer.h"
+#include "RenderOptions.h"
+#include "Distributed.h"
+
+int main(int argc, char** argv) {
+	RenderOptions options;
+	options.backend = "cpu";
+	options.Parse(argc, argv);
+	if (options.backend != "cpu" || (options.mode != "render" && options.mode != "coordinator" && options.mode != "worker")) {
+		fprintf(stderr, "Render only renders on the cpu backend, use OpenGLRayTracer for the rest\n");
+		return 1;
+	}
+	if (options.mode == "worker") {
+		RenderWorker worker(options.address);
+		worker.ServeCpu(options.threads);
+		return 0;
+	}
+
+	auto start = std::chrono::high_resolution_clock::now();
+	SceneData scene = SceneLibrary::Open(options.scene, options.seed);
+	if (options.mode == "coordinator") {
+		RenderCoordinator coordinator(options);
+		coordinator.Run(scene);
+	}
+	else {
+		FrameRenderer::RenderFramesCpu(scene, options);
+	}
+
+	auto end = std::chrono::high_resolution_clock::now();
+	auto runtime = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+	std::cout << "Elapsed time: " << runtime.count() << "ms.\n";
+	return 0;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "BuffersStructs.h"
+#include "RenderBuffers.h"
+
+// a rectangle of pixels, rows counted from the bottom like the gl framebuffer
+struct Tile {
+	int x = 0;
+	int y = 0;
+	int width = 0;
+	int height = 0;
+
+	Tile() {};
+	Tile(int _x, int _y, int _width, int _height) {
+		x = _x;
+		y = _y;
+		width = _width;
+		height = _height;
+	}
+};
+
+// traces a camera's view, either raytrace.frag through Scene or CpuRenderer. pass p covers
+// sample indices p * samples to (p + 1) * samples - 1 of every pixel, so passes rendered
+// separately, in any order or on either backend, average into the same image
+class RenderBackend
+{
+public:
+	virtual ~RenderBackend() {};
+	virtual void SetCamera(const CameraBuffer& camera) = 0;
+	// buffers are resized to the tile
+	virtual void RenderTile(const Tile& tile, int pass, RenderBuffers& buffers) = 0;
+};
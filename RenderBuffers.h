@@ -0,0 +1,37 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+
+// depth written for rays that miss everything, matches SKY_DEPTH in raytrace.frag
+#define RENDER_SKY_DEPTH 10000.0f
+
+// everything one frame produces, interleaved floats with rows bottom to top like the gl framebuffer.
+// colour is linear, albedo/normal/depth are the first hit features averaged over the pixel's samples
+struct RenderBuffers {
+	int width = 0;
+	int height = 0;
+	std::vector<float> colour;
+	std::vector<float> albedo;
+	std::vector<float> normal;
+	std::vector<float> depth;
+
+	void Resize(int _width, int _height) {
+		width = _width;
+		height = _height;
+		colour.assign((size_t)width * height * 3, 0.0f);
+		albedo.assign((size_t)width * height * 3, 0.0f);
+		normal.assign((size_t)width * height * 3, 0.0f);
+		depth.assign((size_t)width * height, 0.0f);
+	}
+
+	// gamma corrected 8 bit rgb, the same transform texture.frag applies on screen
+	std::vector<unsigned char> ToBytes() const {
+		std::vector<unsigned char> bytes(colour.size());
+		for (size_t i = 0; i < colour.size(); i++) {
+			float c = sqrtf(colour[i] > 0.0f ? colour[i] : 0.0f);
+			bytes[i] = (unsigned char)((c < 1.0f ? c : 1.0f) * 255.0f + 0.5f);
+		}
+		return bytes;
+	}
+};
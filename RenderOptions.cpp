@@ -0,0 +1,342 @@
+#include "RenderOptions.h"
+#include "Checkpoint.h"
+
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <ctime>
+
+static std::string trim(const std::string& s) {
+	size_t start = s.find_first_not_of(" \t\r\n");
+	if (start == std::string::npos) return "";
+	size_t end = s.find_last_not_of(" \t\r\n");
+	return s.substr(start, end - start + 1);
+}
+
+static int toInt(const std::string& key, const std::string& value) {
+	char* end;
+	long v = strtol(value.c_str(), &end, 10);
+	if (value.empty() || *end != '\0') {
+		fprintf(stderr, "Expected a whole number for %s, got \"%s\"\n", key.c_str(), value.c_str());
+		exit(1);
+	}
+	return (int)v;
+}
+
+static double toDouble(const std::string& key, const std::string& value) {
+	char* end;
+	double v = strtod(value.c_str(), &end);
+	if (value.empty() || *end != '\0') {
+		fprintf(stderr, "Expected a number for %s, got \"%s\"\n", key.c_str(), value.c_str());
+		exit(1);
+	}
+	return v;
+}
+
+static bool toBool(const std::string& key, const std::string& value) {
+	if (value == "true" || value == "1" || value == "on") return true;
+	if (value == "false" || value == "0" || value == "off") return false;
+	fprintf(stderr, "Expected true or false for %s, got \"%s\"\n", key.c_str(), value.c_str());
+	exit(1);
+}
+
+// the frame number in an output path, %d or %0Nd, with %% for a literal %. false for any other
+// % or a second number, start is npos without one
+static bool findFrameField(const std::string& pattern, size_t& start, size_t& length, int& digits) {
+	start = std::string::npos;
+	for (size_t i = 0; i < pattern.size(); i++) {
+		if (pattern[i] != '%') continue;
+		if (i + 1 < pattern.size() && pattern[i + 1] == '%') {
+			i++;
+			continue;
+		}
+
+		size_t end = i + 1;
+		int width = 0;
+		if (end < pattern.size() && pattern[end] == '0') {
+			end++;
+			while (end < pattern.size() && isdigit((unsigned char)pattern[end]) && end - i <= 3) {
+				width = width * 10 + (pattern[end] - '0');
+				end++;
+			}
+			if (width == 0) return false;
+		}
+		if (end >= pattern.size() || pattern[end] != 'd' || start != std::string::npos) return false;
+		start = i;
+		length = end + 1 - i;
+		digits = width;
+		i = end;
+	}
+	return true;
+}
+
+static std::string zeroPadded(int n, int digits) {
+	std::string s = std::to_string(n);
+	if ((int)s.size() < digits) s.insert(0, digits - s.size(), '0');
+	return s;
+}
+
+// "x,y,z,tx,ty,tz[,fov]", commas or spaces
+static CameraOverride toCamera(const std::string& value) {
+	std::string spaced = value;
+	std::replace(spaced.begin(), spaced.end(), ',', ' ');
+	std::stringstream ss(spaced);
+	std::vector<float> v;
+	float f;
+	while (ss >> f) v.push_back(f);
+	if (!ss.eof() || (v.size() != 6 && v.size() != 7)) {
+		fprintf(stderr, "Expected a camera as x,y,z,targetx,targety,targetz[,fov], got \"%s\"\n", value.c_str());
+		exit(1);
+	}
+
+	CameraOverride camera;
+	camera.position = glm::vec3(v[0], v[1], v[2]);
+	camera.target = glm::vec3(v[3], v[4], v[5]);
+	if (v.size() == 7) camera.fov = v[6];
+	return camera;
+}
+
+void RenderOptions::Parse(int argc, char** argv) {
+	int i = 1;
+	if (i < argc && argv[i][0] != '-') mode = argv[i++];
+	applyModeDefaults();
+
+	for (; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--help" || arg == "-h") {
+			PrintUsage(argv[0]);
+			exit(0);
+		}
+		if (arg.compare(0, 2, "--") != 0) {
+			fprintf(stderr, "Unexpected argument \"%s\", see --help\n", arg.c_str());
+			exit(1);
+		}
+
+		std::string key = arg.substr(2);
+		if (key == "denoise" || key == "profile" || key == "adaptive") {
+			Set(key, "true");
+		}
+		else if (i + 1 < argc) {
+			Set(key, argv[++i]);
+		}
+		else {
+			fprintf(stderr, "Missing value for %s\n", arg.c_str());
+			exit(1);
+		}
+	}
+
+	// a resumed run has to rebuild the same scene
+	if (seed == 0 && !checkpoint.empty()) seed = 1;
+	if (seed == 0) seed = (unsigned int)time(NULL);
+	if (!cameras.empty() && !path.keyframes.empty()) {
+		fprintf(stderr, "--camera and --path can't be used together\n");
+		exit(1);
+	}
+	// the profiler's phases and counters come from the gl image renderer, nothing else reports them
+	if (profile && (mode != "render" || backend != "gl")) {
+		fprintf(stderr, "--profile only works when rendering on the gl backend\n");
+		exit(1);
+	}
+	// the coordinator hands out whole passes and the workers render what they're given, neither
+	// measures frame time, picks blocks, saves progress or keeps per pixel counts
+	if ((mode == "coordinator" || mode == "worker") && (timeBudget > 0.0 || adaptive || !checkpoint.empty() || !samplesOutput.empty())) {
+		fprintf(stderr, "--time-budget, --adaptive, --checkpoint and --samples-output don't work with distributed rendering\n");
+		exit(1);
+	}
+}
+
+void RenderOptions::LoadConfig(const std::string& path) {
+	std::ifstream in(path);
+	if (!in) {
+		fprintf(stderr, "Failed to read config %s\n", path.c_str());
+		exit(1);
+	}
+
+	std::string line;
+	int lineNumber = 0;
+	while (std::getline(in, line)) {
+		lineNumber++;
+		line = trim(line.substr(0, line.find('#')));
+		if (line.empty()) continue;
+
+		size_t equals = line.find('=');
+		if (equals == std::string::npos) {
+			fprintf(stderr, "%s:%d: expected key = value\n", path.c_str(), lineNumber);
+			exit(1);
+		}
+		Set(trim(line.substr(0, equals)), trim(line.substr(equals + 1)));
+	}
+}
+
+void RenderOptions::Set(const std::string& key, const std::string& value) {
+	if (key == "config") LoadConfig(value);
+	else if (key == "scene") scene = value;
+	else if (key == "seed") seed = (unsigned int)toInt(key, value);
+	else if (key == "width") width = toInt(key, value);
+	else if (key == "height") height = toInt(key, value);
+	else if (key == "samples") samples = toInt(key, value);
+	else if (key == "pass-samples") passSamples = toInt(key, value);
+	else if (key == "depth") depth = toInt(key, value);
+	else if (key == "rr-depth") rrDepth = toInt(key, value);
+	else if (key == "tiles") tiles = toInt(key, value);
+	else if (key == "threads") threads = toInt(key, value);
+	else if (key == "backend") backend = value;
+	else if (key == "output") output = value;
+	else if (key == "time-budget") timeBudget = toDouble(key, value);
+	else if (key == "denoise") denoise = toBool(key, value);
+	else if (key == "profile") profile = toBool(key, value);
+	else if (key == "camera") cameras.push_back(toCamera(value));
+	else if (key == "path") path.Load(value);
+	else if (key == "fps") fps = (float)toDouble(key, value);
+	else if (key == "address") address = value;
+	else if (key == "checkpoint") checkpoint = value;
+	else if (key == "adaptive") adaptive = toBool(key, value);
+	else if (key == "noise-threshold") noiseThreshold = (float)toDouble(key, value);
+	else if (key == "samples-output") samplesOutput = value;
+	else if (key == "checkpoint-interval") checkpointInterval = toDouble(key, value);
+	else {
+		fprintf(stderr, "Unknown option \"%s\", see --help\n", key.c_str());
+		exit(1);
+	}
+
+	size_t start, length;
+	int digits;
+	if ((key == "output" || key == "samples-output") && !findFrameField(value, start, length, digits)) {
+		fprintf(stderr, "Expected at most one %%d or %%0Nd for the frame number in %s, and %%%% for a %%, got \"%s\"\n", key.c_str(), value.c_str());
+		exit(1);
+	}
+
+	if (width <= 0 || height <= 0 || samples <= 0 || depth <= 0 || tiles <= 0 || fps <= 0.0f) {
+		fprintf(stderr, "width, height, samples, depth, tiles and fps must be positive\n");
+		exit(1);
+	}
+	if (backend != "gl" && backend != "cpu") {
+		fprintf(stderr, "Unknown backend \"%s\", expected gl or cpu\n", backend.c_str());
+		exit(1);
+	}
+}
+
+// the settings each mode used when it was picked with MODE in Main.cpp
+void RenderOptions::applyModeDefaults() {
+	if (mode == "view") {
+		width = 1280; height = 720;
+		samples = 8; depth = 8;
+	}
+	else if (mode == "variants") {
+		samples = 16; depth = 16;
+	}
+	else if (mode == "rays") {
+		samples = 4; // repeats over the ray batch
+	}
+	else if (mode == "denoise") {
+		width = 960; height = 540;
+		samples = 4096; depth = 16; // samples of the reference
+		seed = 1;
+	}
+	else if (mode == "worker") {
+		backend = "cpu";
+	}
+	else if (mode != "render" && mode != "coordinator") {
+		fprintf(stderr, "Unknown mode \"%s\", see --help\n", mode.c_str());
+		exit(1);
+	}
+}
+
+int RenderOptions::getFrameCount() const {
+	if (!path.keyframes.empty()) return path.getFrameCount(fps);
+	return cameras.empty() ? 1 : (int)cameras.size();
+}
+
+uint64_t RenderOptions::SettingsKey() const {
+	int32_t values[] = { width, height, samples, getPassSamples(), depth, rrDepth, tiles, (int32_t)seed, getFrameCount(), adaptive, (int32_t)(noiseThreshold * 1e6f) };
+	uint64_t hash = Checkpoint::Hash(values, sizeof(values));
+	hash = Checkpoint::Hash(scene.data(), scene.size(), hash);
+	hash = Checkpoint::Hash(backend.data(), backend.size(), hash);
+	return hash;
+}
+
+void RenderOptions::ApplyCamera(int frame, Camera& camera) const {
+	if (!path.keyframes.empty()) {
+		path.Apply(path.keyframes.front().time + frame / fps, camera);
+		return;
+	}
+	if (cameras.empty()) return;
+	const CameraOverride& c = cameras[frame];
+	camera.position = c.position;
+	camera.LookAt(c.target);
+	if (c.fov > 0.0f) camera.fov = c.fov;
+}
+
+std::string RenderOptions::OutputPath(int frame) const {
+	return framePath(output, frame);
+}
+
+std::string RenderOptions::SamplesPath(int frame) const {
+	return samplesOutput.empty() ? "" : framePath(samplesOutput, frame);
+}
+
+std::string RenderOptions::framePath(const std::string& base, int frame) const {
+	std::string path = base;
+	size_t start, length;
+	int digits;
+	findFrameField(path, start, length, digits);
+	if (start != std::string::npos) {
+		path.replace(start, length, zeroPadded(frame, digits));
+	}
+	else if (getFrameCount() > 1) {
+		size_t dot = path.find_last_of('.');
+		if (dot == std::string::npos || path.find_first_of("/\\", dot) != std::string::npos) dot = path.size();
+		path.insert(dot, "_" + zeroPadded(frame, 4));
+	}
+
+	// the number has no %, so every one left is half of a %%
+	for (size_t i = path.find('%'); i != std::string::npos; i = path.find('%', i + 1)) {
+		path.erase(i, 1);
+	}
+	return path;
+}
+
+void RenderOptions::PrintUsage(const char* program) {
+	printf(
+		"usage: %s [mode] [--option value ...]\n"
+		"\n"
+		"modes:\n"
+		"  render      render images (default)\n"
+		"  view        interactive viewer\n"
+		"  variants    timing table of specialised shader variants against the generic kernel\n"
+		"  rays        CPU closest hit vs occlusion ray throughput, samples sets the repeats\n"
+		"  denoise     error and time of denoised low sample renders against a reference\n"
+		"  coordinator render by handing tile and pass jobs to workers that connect to --address\n"
+		"  worker      render jobs for the coordinator at --address on --backend (cpu)\n"
+		"\n"
+		"options, also accepted as \"key = value\" lines in a config file:\n"
+		"  --config file        read options from file\n"
+		"  --scene name|file    balls, field100k, deepglass, surface or a scene file (balls)\n"
+		"  --seed n             seed for random scenes and bvh splits (from the time, 1 with --checkpoint)\n"
+		"  --width n --height n image size (1920x1080)\n"
+		"  --samples n          samples per pixel (256)\n"
+		"  --pass-samples n     samples per pass, the rest are traced in more passes (all)\n"
+		"  --depth n            max bounces (16)\n"
+		"  --rr-depth n         bounces before russian roulette (3)\n"
+		"  --tiles n            horizontal bands each pass is split into (256)\n"
+		"  --threads n          CPU backend threads (all cores)\n"
+		"  --backend gl|cpu     (gl)\n"
+		"  --output path        .ppm or .pfm, %%d or %%04d for the frame number (output.ppm)\n"
+		"  --time-budget s      don't start tiles that would end a frame, with its last\n"
+		"                       measured denoise and write, after s seconds\n"
+		"  --adaptive           after 2 passes, add passes to the noisiest blocks up to samples\n"
+		"  --noise-threshold e  relative noise adaptive sampling stops at (0.02)\n"
+		"  --samples-output path  write the samples each pixel got as a pfm\n"
+		"  --camera x,y,z,tx,ty,tz[,fov]  camera position and target, repeat for more frames\n"
+		"  --path file          camera keyframes to render a frame sequence along\n"
+		"  --fps n              frames per second of the path's keyframe times (24)\n"
+		"  --address host:port  coordinator address (127.0.0.1:7878)\n"
+		"  --checkpoint file    save progress to file and resume from it if it exists\n"
+		"  --checkpoint-interval s  seconds between checkpoints (60)\n"
+		"  --denoise            denoise before writing\n"
+		"  --profile            print phase timings, write profile.json and profile.csv (gl render only)\n",
+		program);
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "Camera.h"
+#include "CameraPath.h"
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+// a camera from the command line or a config file, replacing the scene's own
+struct CameraOverride {
+	glm::vec3 position = glm::vec3(0, 0, 0);
+	glm::vec3 target = glm::vec3(0, 0, -1);
+	float fov = 0.0f; // 0 keeps the scene's
+};
+
+// everything a run can be told, from "--key value" arguments and config files of "key = value"
+// lines, applied in order so later ones win. the first argument without -- picks the mode
+class RenderOptions
+{
+public:
+	std::string mode = "render";
+	std::string scene = "balls"; // a SceneLibrary name or a scene file
+	unsigned int seed = 0; // 0 picks one from the time
+	int width = 1920;
+	int height = 1080;
+	int samples = 256;
+	int passSamples = 0; // 0 traces every sample in one pass
+	int depth = 16;
+	int rrDepth = 3;
+	int tiles = 256;
+	int threads = 0;
+	std::string backend = "gl";
+	std::string output = "output.ppm";
+	double timeBudget = 0.0; // seconds per frame
+	bool denoise = false;
+	bool profile = false;
+	std::vector<CameraOverride> cameras;
+	CameraPath path; // a flythrough, rendered at fps frames per second of its keyframe times
+	float fps = 24.0f;
+	std::string address = "127.0.0.1:7878"; // coordinator's listening address, workers connect to it
+	std::string checkpoint; // saved every checkpointInterval seconds and resumed from when it exists
+	double checkpointInterval = 60.0;
+	bool adaptive = false; // samples is then the most any pixel gets
+	float noiseThreshold = 0.02f;
+	std::string samplesOutput; // where each frame's samples per pixel go, like output
+
+	void Parse(int argc, char** argv);
+	void LoadConfig(const std::string& path);
+	void Set(const std::string& key, const std::string& value);
+
+	int getPassSamples() const { return passSamples > 0 ? std::min(passSamples, samples) : samples; };
+	int getFrameCount() const;
+	// hash of every setting that changes the image, a checkpoint only resumes a run with the same
+	uint64_t SettingsKey() const;
+	void ApplyCamera(int frame, Camera& camera) const;
+	// with several frames and no %d or %0Nd in output, the frame number goes before the extension
+	std::string OutputPath(int frame) const;
+	// empty without samplesOutput
+	std::string SamplesPath(int frame) const;
+	static void PrintUsage(const char* program);
+private:
+	void applyModeDefaults();
+	std::string framePath(const std::string& base, int frame) const;
+};
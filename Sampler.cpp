@@ -0,0 +1,200 @@
+#include "Sampler.h"
+
+#include <random>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+
+#define SAMPLER_PI 3.14159265359f
+
+static uint32_t reverseBits(uint32_t x) {
+	x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+	x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+	x = ((x >> 4) & 0x0F0F0F0Fu) | ((x & 0x0F0F0F0Fu) << 4);
+	x = ((x >> 8) & 0x00FF00FFu) | ((x & 0x00FF00FFu) << 8);
+	return (x >> 16) | (x << 16);
+}
+
+// second sobol dimension, direction numbers v_k = v_(k-1) ^ (v_(k-1) >> 1)
+static uint32_t sobol1(uint32_t i) {
+	uint32_t r = 0;
+	for (uint32_t v = 1u << 31; i != 0; i >>= 1, v ^= v >> 1) {
+		if (i & 1) r ^= v;
+	}
+	return r;
+}
+
+// https://psychopath.io/post/2021_01_30_building_a_better_lk_hash
+static uint32_t laineKarras(uint32_t x, uint32_t seed) {
+	x += seed;
+	x ^= x * 0x6c50b47cu;
+	x ^= x * 0xb82f1e52u;
+	x ^= x * 0xc7afe638u;
+	x ^= x * 0x8d22f6e6u;
+	return x;
+}
+
+static uint32_t owenScramble(uint32_t x, uint32_t seed) {
+	return reverseBits(laineKarras(reverseBits(x), seed));
+}
+
+static float toUnitFloat(uint32_t x) {
+	return (float)(x >> 8) * (1.0f / 16777216.0f);
+}
+
+BlueNoise::BlueNoise(int size, uint32_t seed) {
+	// Get wraps coordinates with a mask
+	if (size <= 0 || (size & (size - 1)) != 0) {
+		fprintf(stderr, "Blue noise size %d isn't a power of two\n", size);
+		exit(1);
+	}
+	this->size = size;
+	int n = size * size;
+	values.assign(n, 0.0f);
+
+	// gaussian energy of a point at every toroidal offset
+	const float sigma = 1.5f;
+	std::vector<float> kernel(n);
+	for (int dy = 0; dy < size; dy++) {
+		for (int dx = 0; dx < size; dx++) {
+			int wx = std::min(dx, size - dx);
+			int wy = std::min(dy, size - dy);
+			kernel[dy * size + dx] = expf(-(wx * wx + wy * wy) / (2.0f * sigma * sigma));
+		}
+	}
+
+	std::vector<char> pattern(n, 0);
+	std::vector<float> energy(n, 0.0f);
+	auto splat = [&](int p, float sign) {
+		int px = p % size, py = p / size;
+		for (int y = 0; y < size; y++) {
+			for (int x = 0; x < size; x++) {
+				energy[y * size + x] += sign * kernel[((y - py + size) % size) * size + (x - px + size) % size];
+			}
+		}
+	};
+	// tightest cluster is the busiest set pixel, largest void the emptiest unset one
+	auto tightestCluster = [&]() {
+		int best = -1;
+		for (int i = 0; i < n; i++) {
+			if (pattern[i] && (best < 0 || energy[i] > energy[best])) best = i;
+		}
+		return best;
+	};
+	auto largestVoid = [&]() {
+		int best = -1;
+		for (int i = 0; i < n; i++) {
+			if (!pattern[i] && (best < 0 || energy[i] < energy[best])) best = i;
+		}
+		return best;
+	};
+
+	// random initial points, relaxed until moving the tightest cluster doesn't change anything
+	std::mt19937 rng(seed);
+	// at least one point, or there would be no cluster to relax
+	int initial = std::max(1, n / 10);
+	for (int placed = 0; placed < initial; ) {
+		int p = rng() % n;
+		if (pattern[p]) continue;
+		pattern[p] = 1;
+		splat(p, 1.0f);
+		placed++;
+	}
+	while (true) {
+		int cluster = tightestCluster();
+		if (cluster < 0) break;
+		pattern[cluster] = 0;
+		splat(cluster, -1.0f);
+		int empty = largestVoid();
+		if (empty < 0) break;
+		pattern[empty] = 1;
+		splat(empty, 1.0f);
+		if (empty == cluster) break;
+	}
+
+	std::vector<int> rank(n, 0);
+	std::vector<char> initialPattern = pattern;
+	std::vector<float> initialEnergy = energy;
+
+	// ranks below the initial points, removing clusters first
+	for (int r = initial - 1; r >= 0; r--) {
+		int cluster = tightestCluster();
+		if (cluster < 0) break;
+		pattern[cluster] = 0;
+		splat(cluster, -1.0f);
+		rank[cluster] = r;
+	}
+
+	// ranks above, filling voids until every pixel is set
+	pattern = initialPattern;
+	energy = initialEnergy;
+	for (int r = initial; r < n; r++) {
+		int empty = largestVoid();
+		if (empty < 0) break;
+		pattern[empty] = 1;
+		splat(empty, 1.0f);
+		rank[empty] = r;
+	}
+
+	for (int i = 0; i < n; i++) {
+		values[i] = ((float)rank[i] + 0.5f) / (float)n;
+	}
+}
+
+Sampler::Sampler(const BlueNoise* noise, int x, int y, uint32_t sampleIndex) {
+	this->noise = noise;
+	this->x = x;
+	this->y = y;
+	this->sampleIndex = sampleIndex;
+}
+
+// same hash as raytrace.frag
+uint32_t Sampler::Hash(uint32_t x) {
+	x += (x << 10u);
+	x ^= (x >> 6u);
+	x += (x << 3u);
+	x ^= (x >> 11u);
+	x += (x << 15u);
+	return x;
+}
+
+float Sampler::Get1D(int dimension) const {
+	return Get2D(dimension).x;
+}
+
+glm::vec2 Sampler::Get2D(int dimension) const {
+	uint32_t seed = Hash((uint32_t)dimension * 0x9E3779B9u + 1u);
+	uint32_t seed2 = Hash(seed);
+
+	// shuffling the index per dimension keeps dimensions from being correlated
+	uint32_t index = owenScramble(sampleIndex, Hash(seed2));
+
+	glm::vec2 u(toUnitFloat(owenScramble(reverseBits(index), seed)), toUnitFloat(owenScramble(sobol1(index), seed2)));
+
+	glm::vec2 shift(
+		noise->Get(x + (seed & 63u), y + ((seed >> 8) & 63u)),
+		noise->Get(x + (seed2 & 63u), y + ((seed2 >> 8) & 63u))
+	);
+
+	u += shift;
+	u.x -= floorf(u.x);
+	u.y -= floorf(u.y);
+	return u;
+}
+
+glm::vec3 Sampler::UniformSphere(glm::vec2 u) {
+	float z = 1.0f - 2.0f * u.x;
+	float r = sqrtf(std::max(0.0f, 1.0f - z * z));
+	float phi = 2.0f * SAMPLER_PI * u.y;
+	return glm::vec3(r * cosf(phi), r * sinf(phi), z);
+}
+
+glm::vec3 Sampler::CosineHemisphere(glm::vec3 normal, glm::vec2 u) {
+	float r = sqrtf(u.x);
+	float phi = 2.0f * SAMPLER_PI * u.y;
+
+	glm::vec3 t = glm::normalize(glm::cross(fabsf(normal.x) > 0.9f ? glm::vec3(0, 1, 0) : glm::vec3(1, 0, 0), normal));
+	glm::vec3 b = glm::cross(normal, t);
+	return t * (r * cosf(phi)) + b * (r * sinf(phi)) + normal * sqrtf(std::max(0.0f, 1.0f - u.x));
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+#define BLUE_NOISE_SIZE 64
+
+// sample dimensions, these match the DIM_ defines in raytrace.frag
+#define SAMPLER_DIM_PIXEL 0
+#define SAMPLER_DIMS_PER_BOUNCE 4
+#define SAMPLER_DIM_BSDF 1
+#define SAMPLER_DIM_CHOICE 2
+#define SAMPLER_DIM_LIGHT 3
+#define SAMPLER_DIM_RR 4
+
+// tileable blue noise ranks in [0, 1), made with void and cluster
+class BlueNoise
+{
+public:
+	BlueNoise() {};
+	BlueNoise(int size, uint32_t seed = 1);
+	float Get(int x, int y) const { return values[(y & (size - 1)) * size + (x & (size - 1))]; };
+	int getSize() const { return size; };
+	const float* data() const { return values.data(); };
+private:
+	int size = 0;
+	std::vector<float> values;
+};
+
+// owen scrambled sobol points, shifted per pixel by blue noise.
+// every dimension gets its own scramble and noise offset, the same as the shader
+class Sampler
+{
+public:
+	Sampler(const BlueNoise* noise, int x, int y, uint32_t sampleIndex);
+	void SetSampleIndex(uint32_t i) { sampleIndex = i; };
+	float Get1D(int dimension) const;
+	glm::vec2 Get2D(int dimension) const;
+
+	static uint32_t Hash(uint32_t x);
+	static glm::vec3 UniformSphere(glm::vec2 u);
+	static glm::vec3 CosineHemisphere(glm::vec3 normal, glm::vec2 u);
+private:
+	const BlueNoise* noise;
+	int x, y;
+	uint32_t sampleIndex;
+};
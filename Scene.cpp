@@ -1,173 +1,40 @@
 #include "Scene.h"
 #include <algorithm>
-#include <unordered_set>
+#include <cmath>
 
-class BVHNodeTemp {
-public:
-	glm::vec3 AABBmin;
-	glm::vec3 AABBmax;
-	std::shared_ptr<BVHNodeTemp> left, right;
-	std::shared_ptr<SpheresBuffer> sphere;
-	int type;
-
-	BVHNodeTemp(const std::vector<std::shared_ptr<BVHNodeTemp>>& src_objects, size_t start, size_t end) {
-		auto objects = src_objects;
-
-		int axis = randomInt(0, 2);
-		auto comparator = (axis == 0) ? box_compare_x 
-						: (axis == 1) ? box_compare_y
-					                  : box_compare_z;
-
-		size_t span = end - start;
-
-		if (span == 1) {
-			left = right = objects[start];
-		}
-		else if (span == 2) {
-			if (comparator(objects[start], objects[start + 1])) {
-				left = objects[start];
-				right = objects[start + 1];
-			}
-			else {
-				left = objects[start + 1];
-				right = objects[start];
-			}
-		}
-		else {
-			std::sort(objects.begin() + start, objects.begin() + end, comparator);
-			auto mid = start + span / 2;
-			left = std::make_shared<BVHNodeTemp>(objects, start, mid);
-			right = std::make_shared<BVHNodeTemp>(objects, mid, end);
-		}
-
-		genAABB(*left, *right, AABBmin, AABBmax);
-		type = BVH_TYPE_BVH;
-	}
-
-	BVHNodeTemp(SpheresBuffer& s) {
-		glm::vec3 rvec(s.radius, s.radius, s.radius);
-		glm::vec3 posa = s.position - rvec;
-		glm::vec3 posb = s.position + rvec;
-		AABBmin = glm::vec3(fmin(posa.x, posb.x), fmin(posa.y, posb.y), fmin(posa.z, posb.z));
-		AABBmax = glm::vec3(fmax(posa.x, posb.x), fmax(posa.y, posb.y), fmax(posa.z, posb.z));
-		type = BVH_TYPE_SPHERE;
-		sphere = std::make_shared<SpheresBuffer>(s);
-	}
-
-	void genAABB(BVHNodeTemp a, BVHNodeTemp b, glm::vec3& _aabbmin, glm::vec3& _aabbmax) {
-		_aabbmin = glm::vec3(fmin(a.AABBmin.x, b.AABBmin.x), fmin(a.AABBmin.y, b.AABBmin.y), fmin(a.AABBmin.z, b.AABBmin.z));
-		_aabbmax = glm::vec3(fmax(a.AABBmax.x, b.AABBmax.x), fmax(a.AABBmax.y, b.AABBmax.y), fmax(a.AABBmax.z, b.AABBmax.z));
-	}
-
-	static bool box_compare_x(const std::shared_ptr<BVHNodeTemp> a, const std::shared_ptr<BVHNodeTemp> b) {
-		return a->AABBmin.x < b->AABBmin.x;
-	};
-
-	static bool box_compare_y(const std::shared_ptr<BVHNodeTemp> a, const std::shared_ptr<BVHNodeTemp> b) {
-		return a->AABBmin.y < b->AABBmin.y;
-	};
-
-	static bool box_compare_z(const std::shared_ptr<BVHNodeTemp> a, const std::shared_ptr<BVHNodeTemp> b) {
-		return a->AABBmin.z < b->AABBmin.z;
-	};
-
-};
-
-std::vector<BVHBuffer> createVector(std::shared_ptr<BVHNodeTemp> node) {
-	BVHBuffer b;
-	b.AABBmin = node->AABBmin;
-	b.AABBmax = node->AABBmax;
-	b.type = node->type;
-
-	std::vector<BVHBuffer> bs;
-	bs.push_back(b);
-
-	if (b.type == BVH_TYPE_BVH) {
-		auto left_v = createVector(node->left);
-		auto right_v = createVector(node->right);
-		bs.insert(bs.end(), left_v.begin(), left_v.end());
-		bs.insert(bs.end(), right_v.begin(), right_v.end());
-	}
-
-	return bs;
-};
-
-static bool operator == (const BVHBuffer& buf, const BVHNodeTemp& node) {
-	return (
-		buf.AABBmin == node.AABBmin &&
-		buf.AABBmax == node.AABBmax &&
-		buf.type == node.type
-		);
-}
-
-static std::ostream& operator << (std::ostream& os, const glm::vec3& v) {
-	os << "(" << v.x << ", " << v.y << ", " << v.z << ")";
-	return os;
-}
-
-int getIndex(const std::vector<BVHBuffer>& bufs, const BVHNodeTemp& node, std::unordered_set<int>& exclude, const int headIndex = -1) {
-	int i = -1;
-	for (auto& b : bufs) {
-		i++;
-		if (headIndex == i) continue;
-		if (b == node && exclude.count(i) == 0) {
-			exclude.insert(i);
-			return i;
-		}
-	}
-	std::cout << "NOT GOOD";
-}
-
-int getIndex(const std::vector<SpheresBuffer>& bufs, const SpheresBuffer& s) {
-	int i = 0;
-	for (auto& b : bufs) {
-		if (b.radius == s.radius && b.position == s.position) {
-			return i;
-		}
-		i++;
-	}
-	std::cout << "NOT GOOD";
-}
-
-void printNode(const BVHNodeTemp& b) {
-	std::cout << "TYPE: " << b.type << " | Left: " << b.left << " | Right: " << b.right << "\n";
-}
-
-void indexVector(std::vector<BVHBuffer>& bufs, const BVHNodeTemp& node, const std::vector<SpheresBuffer>& sphereBufs, std::unordered_set<int>& cacheHeadNodes, std::unordered_set<int>& cachePointerNodes) {
-	int curNodeIndex = getIndex(bufs, node, cacheHeadNodes);
-	if (bufs[curNodeIndex].type == BVH_TYPE_SPHERE) {
-		int sphereIndex = getIndex(sphereBufs, *node.sphere);
-		// std::cout << curNodeIndex << ": SPHERE-"<<sphereIndex<<"\n";
-		bufs[curNodeIndex].left_index = sphereIndex;
-		bufs[curNodeIndex].right_index = sphereIndex;
-		return;
-	};
-	int leftIndex = getIndex(bufs, *node.left, cachePointerNodes, curNodeIndex);
-	int rightIndex = getIndex(bufs, *node.right, cachePointerNodes, curNodeIndex);
-
-	bufs[curNodeIndex].left_index = leftIndex;
-	bufs[curNodeIndex].right_index = rightIndex;
-	// std::cout << curNodeIndex << bufs[curNodeIndex].AABBmin << bufs[curNodeIndex].AABBmax <<": " << leftIndex << " | " << rightIndex << "\n";
-
-	indexVector(bufs, *node.left, sphereBufs, cacheHeadNodes, cachePointerNodes);
-	indexVector(bufs, *node.right, sphereBufs, cacheHeadNodes, cachePointerNodes);
-}
-
-Scene::Scene(int width, int height, int samples, int depth) {
+Scene::Scene(const SceneData& data, int width, int height, int samples, int depth, int rrDepth, bool pathStats, bool traceStats) : SceneData(data) {
 	imageSize = glm::uvec2(width, height);
+	windowSize = imageSize;
 
 	shader = Shader("quad.vert", "raytrace.frag");
 	textShader = Shader("passthrough.vert", "texture.frag");
 	textShader.Create();
-	CreateBalls();
 
-	CalculateBVHs();
+	// raytrace.frag's traversal stack only fits a balanced tree
+	{
+		ScopedTimer timer("scene/bvh build");
+		CalculateBVHs(BVH_SPLIT_MEDIAN, (uint32_t)rand());
+		CalculateLights();
+	}
 
 	shader.SetDefine("1//{SPHERE_COUNT}", (int)spheres.size());
+	shader.SetDefine("1//{MATERIAL_COUNT}", (int)materials.size());
 	shader.SetDefine("1//{BVH_COUNT}", (int)bvhs.size());
+	shader.SetDefine("1//{LIGHT_COUNT}", (int)lights.size());
+	shader.SetDefine("1//{TEXTURE_COUNT}", std::max(1, (int)textures.size()));
 	shader.SetDefine("1//{SAMPLES}", samples);
 	shader.SetDefine("1//{MAX_BOUNCES}", depth);
-	shader.Create();
+	shader.SetDefine("1//{RR_MIN_DEPTH}", rrDepth);
+	collectStats = pathStats || traceStats;
+	if (collectStats) shader.AddDefine("PATH_STATS");
+	if (traceStats) shader.AddDefine("TRACE_STATS");
+
+	shaderCache = ShaderCache(shader);
+	features = SceneFeatures::Analyse(spheres, materials);
+	{
+		ScopedTimer timer("scene/shader compile");
+		shader = shaderCache.Get(features);
+	}
 
 	shader.Activate();
 
@@ -176,187 +43,264 @@ Scene::Scene(int width, int height, int samples, int depth) {
 	createUniformBuffer(&cameraUBO, "cameraBuffer", 0, sizeof(CameraBuffer), &cameraBuf);
 	createUniformBuffer(&spheresUBO, "spheresBuffer", 1, sizeof(SpheresBuffer) * spheres.size(), spheres.data());
 	createUniformBuffer(&bvhUBO, "bvhsBuffer", 2, sizeof(BVHBuffer) * bvhs.size(), bvhs.data());
+	// 4 is the previous camera, see below
+	createUniformBuffer(&materialsUBO, "materialsBuffer", 5, sizeof(MaterialBuffer) * materials.size(), materials.data());
+	// padded to whole ivec4s
+	std::vector<int> sphereMaterialData = sphereMaterials;
+	sphereMaterialData.resize((sphereMaterialData.size() + 3) / 4 * 4, 0);
+	createUniformBuffer(&sphereMaterialsUBO, "sphereMaterialsBuffer", 7, sizeof(int) * sphereMaterialData.size(), sphereMaterialData.data());
+
+	// the shader always declares at least one light, a zero radius one is skipped
+	std::vector<LightBuffer> lightData = lights;
+	if (lightData.empty()) lightData.push_back(LightBuffer());
+	createUniformBuffer(&lightsUBO, "lightsBuffer", 3, sizeof(LightBuffer) * lightData.size(), lightData.data());
+
+	// likewise at least one texture
+	std::vector<TextureBuffer> textureData = textures;
+	if (textureData.empty()) textureData.push_back(TextureBuffer());
+	createUniformBuffer(&texturesUBO, "texturesBuffer", 6, sizeof(TextureBuffer) * textureData.size(), textureData.data());
+	{
+		ScopedTimer timer("scene/texture upload");
+		createTextureArray();
+	}
 
-	textShader.Activate();
-
-	glGenFramebuffers(1, &framebuffer);
-	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
-
-	glGenTextures(1, &renderedTexture);
-
-	glBindTexture(GL_TEXTURE_2D, renderedTexture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, imageSize.x, imageSize.y, 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
+	PathStatsBuffer cleared;
+	glGenBuffers(1, &statsSSBO);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, statsSSBO);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(PathStatsBuffer), &cleared, GL_DYNAMIC_READ);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, statsSSBO);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	// blue noise for the sampler lives on texture unit 1, the rendered texture on 0
+	{
+		ScopedTimer timer("scene/blue noise");
+		blueNoise = BlueNoise(BLUE_NOISE_SIZE);
+	}
+	glGenTextures(1, &blueNoiseTexture);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, blueNoiseTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, BLUE_NOISE_SIZE, BLUE_NOISE_SIZE, 0, GL_RED, GL_FLOAT, blueNoise.data());
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glActiveTexture(GL_TEXTURE0);
+
+	denoiseShader = Shader("passthrough.vert", "denoise.frag");
+	denoiseShader.Create();
+	temporalShader = Shader("passthrough.vert", "temporal.frag");
+	temporalShader.Create();
+	frameTimer.Create();
+
+	// temporal.frag declares its camera blocks with explicit bindings
+	previousCameraBuf = cameraBuf;
+	glGenBuffers(1, &previousCameraUBO);
+	glBindBuffer(GL_UNIFORM_BUFFER, previousCameraUBO);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(CameraBuffer), &previousCameraBuf, GL_DYNAMIC_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, 4, previousCameraUBO);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
 
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, renderedTexture, 0);
-	glDrawBuffers(1, drawBuffers);
-	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-		std::cout << "UH OH!";
-		exit(-1);
-	}
+	textShader.Activate();
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	createRenderTargets();
 }
 
-void Scene::AddSphere(SpheresBuffer s, MaterialBuffer m) {
-	s.material = m;
-	spheres.push_back(s);
+// switch to the raytrace.frag variant compiled for the given features,
+// which must cover everything in the scene to render it correctly
+void Scene::UseVariant(const SceneFeatures& variant) {
+	shader = shaderCache.Get(variant);
+	shader.Activate();
+	bindUniformBlock("cameraBuffer", 0);
+	bindUniformBlock("spheresBuffer", 1);
+	bindUniformBlock("bvhsBuffer", 2);
+	bindUniformBlock("lightsBuffer", 3);
+	bindUniformBlock("materialsBuffer", 5);
+	bindUniformBlock("texturesBuffer", 6);
+	bindUniformBlock("sphereMaterialsBuffer", 7);
 }
 
-void Scene::CreateBalls() {
-	camera.position = glm::vec3(13, 2, 3);
-	camera.yaw = -173.5f;
-	camera.pitch = -6.5f;
-	camera.fov = 20.0;
-	cameraBuf.backgroundColour = glm::vec3(0.1f, 0.1f, 0.1f);
-	camera.LookAt(glm::vec3(0, 0, 0));
-
-	camera.updateVectors();
-	// floor
-	AddSphere(
-		SpheresBuffer(
-			glm::vec3(0.0f, -1000.0f, 0.0f),
-			1000.0f
-		),
-		MaterialBuffer(
-			glm::vec3(0.5f, 0.5f, 0.5f),
-			0.0f,
-			0.0f
-		)
-	);
-
-	const int n = 11;
-	for (int a = -n; a < n; a++) {
-		for (int b = -n; b < n; b++) {
-			float c = randomFloat();
-			glm::vec3 center(a + 0.9f * randomFloat(), 0.2f, b + 0.9f * randomFloat());
-
-			if ((center - glm::vec3(4, 0.2f, 0)).length() > 0.9f) {
-				MaterialBuffer mat;
-				if (c < 0.8f) {
-					mat.colour = randomVec3() * randomVec3();
-				}
-				else if (c < 0.95) {
-					mat.colour = randomVec3() * 0.5f + glm::vec3(0.5f, 0.5f, 0.5f);
-					mat.reflective = randomFloat() * 0.5f + 0.5f;
-				}
-				else {
-					mat.refractive = 1.5f;
-				}
-				AddSphere(SpheresBuffer(center, 0.2f), mat);
-			}
+// turn every material not in materialFlags into a lambertian one, only the material table changes
+void Scene::LimitMaterials(unsigned int materialFlags) {
+	for (auto& m : materials) {
+		bool refractive = m.refractive > 0.0f;
+		bool specular = !refractive && m.reflective > 0.0f;
+		if ((refractive && !(materialFlags & FEATURE_REFRACTIVE)) || (specular && !(materialFlags & FEATURE_SPECULAR))) {
+			m.refractive = 0.0f;
+			m.reflective = 0.0f;
 		}
 	}
-
-	AddSphere(SpheresBuffer(glm::vec3(0, 1, 0), 1.0f), MaterialBuffer(glm::vec3(1.0f, 1.0f, 1.0f), 0.0f, 1.5f));
-	AddSphere(SpheresBuffer(glm::vec3(0, 1, 0), -0.95f), MaterialBuffer(glm::vec3(1.0f, 1.0f, 1.0f), 0.0f, 1.5f));
-
-	AddSphere(SpheresBuffer(glm::vec3(-4, 1, 0), 1.0f), MaterialBuffer(glm::vec3(0.1f, 0.3f, 0.1f), 0.0f, 0.0f, true));
-
-	AddSphere(SpheresBuffer(glm::vec3(4, 1, 0), 1.0f), MaterialBuffer(glm::vec3(0.7f, 0.6f, 0.5f), 1.0f, 0.0f));
+	features = SceneFeatures::Analyse(spheres, materials);
+	UpdateMaterials();
 }
 
-void Scene::CalculateBVHs() {
-	// std::cout<<spheres.size()<<"\n";
-	std::vector<std::shared_ptr<BVHNodeTemp>> tempSpheres;
-	for (auto& sphere : spheres) {
-		auto s = std::make_shared<BVHNodeTemp>(sphere);
-		tempSpheres.push_back(s);
-	}
-	BVHNodeTemp root = BVHNodeTemp(tempSpheres, 0, tempSpheres.size());
-
-	bvhs = createVector(std::make_shared<BVHNodeTemp>(root));
-	std::unordered_set<int> cacheHeadNodes, cacheLeafNodes;
-	indexVector(bvhs, root, spheres, cacheHeadNodes, cacheLeafNodes);
-
-	// [DEBUG] trial traversial
-	//std::cout << "BVH SIZE: " << bvhs.size() << "\n";
-	//std::cout << "SPHERE SIZE: " << spheres.size() << "\n";
-
-	//int k = 0;
-	//for (auto& node : bvhs) {
-	//	if (node.type == BVH_TYPE_SPHERE) {
-	//		k++;
-	//		std::cout << "SPHERE: " << node.left_index << "\n";
-	//	}
-	//	else {
-	//		std::cout << "NODE " << node.AABBmin << " " << node.AABBmax << ": " << node.left_index << " | " << node.right_index << "\n";
-	//	}
-	//}
-
-	//std::cout << "BVH SPHERES: " << k << "\n";
-
-	//int nodeIndexStack[100];
-	//int stackPtr = 0;
-	//nodeIndexStack[stackPtr++] = 0;
-	//int n = 0;
-	//while (stackPtr > 0) {
-	//	int nodeIndex = nodeIndexStack[--stackPtr];
-	//	BVHBuffer node = bvhs[nodeIndex];
-	//	// std::cout << "NODE: " << nodeIndex << " | " << node.left_index << " | " << node.right_index << " | " << node.type << "\n";
-	//	if (node.type == BVH_TYPE_SPHERE) {
-	//		n++;
-	//	}
-	//	else {
-	//		nodeIndexStack[stackPtr++] = node.left_index;
-	//		nodeIndexStack[stackPtr++] = node.right_index;
-	//	}
-	//}
-
-	//std::cout << "FOUND SPHERES: " << n << "\n";
-
-	//std::cout << "DONE!\n\n\n\n";
+void Scene::UpdateMaterials() {
+	updateBuffer(materialsUBO, sizeof(MaterialBuffer) * materials.size(), materials.data());
 }
 
 void Scene::CalculateViewport() {
-	float theta = glm::radians(camera.fov);
-	float h = tan(theta / 2.0f);
-	float viewportHeight = 2.0f * h * camera.focalLength;
-	float viewportWidth = viewportHeight * ((float)imageSize.x / (float)imageSize.y);
-
-	glm::vec3 w, u, v;
-	w = -camera.direction;
-	u = camera.rightv;
-	v = camera.upv;
-
-	glm::vec3 viewportU = viewportWidth * u;
-	glm::vec3 viewportV = viewportHeight * v;
-
-	cameraBuf.du = viewportU / (float) imageSize.x;
-	cameraBuf.dv = viewportV / (float) imageSize.y;
-
-	glm::vec3 viewportTopleft = cameraBuf.position - (camera.focalLength * w) - viewportU / 2.0f - viewportV / 2.0f;
-	cameraBuf.viewportTopLeft = viewportTopleft + 0.5f * (cameraBuf.du + cameraBuf.dv);
-
-	cameraBuf.position = camera.position;
-	cameraBuf.screenRes = glm::vec2(imageSize);
+	cameraBuf = MakeCameraBuffer(imageSize);
 }
 
 void Scene::ResizeCallback(int width, int height) {
-	imageSize.x = width; imageSize.y = height;
+	windowSize.x = width; windowSize.y = height;
+	imageSize = windowSize;
+	applyGovernor();
 	glViewport(0, 0, width, height);
 	CalculateViewport();
+
+	deleteRenderTargets();
+	createRenderTargets();
+	historyValid = false;
 }
 
 void Scene::Render() {
-	glClear(GL_COLOR_BUFFER_BIT);
-
-	shader.Activate();
+	applyGovernor();
 
 	CalculateViewport();
 	updateBuffer(cameraUBO, sizeof(cameraBuf), &cameraBuf);
 	// updateBuffer(spheresUBO, sizeof(SpheresBuffer) * spheres.size(), spheres.data());
 
-	quad.Render();
+	frameTimer.Begin();
+	RenderTexture(0, imageSize.y);
+	if (temporal) Accumulate();
+	if (denoising) Denoise();
+	TextureToScreen();
+	frameTimer.End();
+
+	frameIndex++;
+}
+
+// feed finished gpu frame times to the governor and take its render size. checkerboarding
+// needs the temporal pass to fill in the skipped pixels, so it is off without it
+void Scene::applyGovernor() {
+	double ms;
+	while (frameTimer.Poll(ms)) {
+		governor.Update(ms);
+	}
+	if (!dynamicResolution) return;
+
+	float scale = governor.getScale();
+	imageSize.x = std::max(1u, (unsigned int)(windowSize.x * scale + 0.5f));
+	imageSize.y = std::max(1u, (unsigned int)(windowSize.y * scale + 0.5f));
+	checkerboarding = governor.getCheckerboard() && temporal;
+}
+
+void Scene::ToggleDynamicResolution() {
+	dynamicResolution = !dynamicResolution;
+	governor.Reset();
+	imageSize = windowSize;
+	checkerboarding = false;
 }
 
 void Scene::TextureToScreen() {
 	// glBlitFramebuffer(0, 0, imageSize.x, imageSize.y, 0, 0, imageSize.x, imageSize.y, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	ScopedGpuTimer timer("gpu/present");
 	textShader.Activate();
+	textShader.setVec2("renderSize", (float)imageSize.x, (float)imageSize.y);
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, windowSize.x, windowSize.y);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, displayTexture);
+	quad.Render();
+}
+
+// blend the frame just rendered into the history reprojected from the previous camera,
+// see temporal.frag. the result becomes the display texture
+void Scene::Accumulate() {
+	ScopedGpuTimer timer("gpu/temporal");
+	if (!historyValid) previousCameraBuf = cameraBuf;
+	updateBuffer(previousCameraUBO, sizeof(CameraBuffer), &previousCameraBuf);
+
+	temporalShader.Activate();
+	temporalShader.setInt("maxHistory", TEMPORAL_MAX_HISTORY);
+	temporalShader.setInt("resetHistory", !historyValid);
+
+	int previous = 1 - historyIndex;
+	glActiveTexture(GL_TEXTURE5);
+	glBindTexture(GL_TEXTURE_2D, historyTextures[previous]);
+	glActiveTexture(GL_TEXTURE6);
+	glBindTexture(GL_TEXTURE_2D, historyFeatureTextures[previous]);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, displayTexture);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, historyFramebuffers[historyIndex]);
 	glViewport(0, 0, imageSize.x, imageSize.y);
 	quad.Render();
+
+	displayTexture = historyTextures[historyIndex];
+	historyIndex = previous;
+	previousCameraBuf = cameraBuf;
+	historyValid = true;
+}
+
+// gpu version of Denoiser::Denoise for the viewer, two passes to demodulate and estimate
+// the variance, then one per a-trous level ping-ponging between the two denoise targets
+void Scene::Denoise() {
+	ScopedGpuTimer timer("gpu/denoise");
+	denoiseShader.Activate();
+	denoiseShader.setFloat("colourPhi", denoiser.colourPhi);
+	denoiseShader.setFloat("normalPhi", denoiser.normalPhi);
+	denoiseShader.setFloat("depthPhi", denoiser.depthPhi);
+	denoiseShader.setFloat("albedoPhi", denoiser.albedoPhi);
+
+	glActiveTexture(GL_TEXTURE0);
+	glViewport(0, 0, imageSize.x, imageSize.y);
+
+	GLuint input = displayTexture;
+	int iterations = std::max(denoiser.iterations, 1);
+	for (int i = 0; i < iterations + 2; i++) {
+		int target = i % 2;
+		glBindFramebuffer(GL_FRAMEBUFFER, denoiseFramebuffers[target]);
+		glBindTexture(GL_TEXTURE_2D, input);
+		denoiseShader.setInt("stage", std::min(i, 2));
+		denoiseShader.setInt("stepWidth", i < 2 ? 0 : 1 << (i - 2));
+		denoiseShader.setInt("remodulate", i == iterations + 1);
+		quad.Render();
+		input = denoiseTextures[target];
+	}
+
+	displayTexture = input;
+}
+
+// copy every render target back into linear floats
+void Scene::ReadBuffers(RenderBuffers& buffers) {
+	readTile(Tile(0, 0, imageSize.x, imageSize.y), buffers);
+}
+
+void Scene::readTile(const Tile& tile, RenderBuffers& buffers) {
+	ScopedTimer timer("readback");
+	buffers.Resize(tile.width, tile.height);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glReadPixels(tile.x, tile.y, tile.width, tile.height, GL_RGB, GL_FLOAT, buffers.colour.data());
+	glReadBuffer(GL_COLOR_ATTACHMENT1);
+	glReadPixels(tile.x, tile.y, tile.width, tile.height, GL_RGB, GL_FLOAT, buffers.albedo.data());
+	glReadBuffer(GL_COLOR_ATTACHMENT2);
+	glReadPixels(tile.x, tile.y, tile.width, tile.height, GL_RGB, GL_FLOAT, buffers.normal.data());
+	glReadBuffer(GL_COLOR_ATTACHMENT3);
+	glReadPixels(tile.x, tile.y, tile.width, tile.height, GL_RED, GL_FLOAT, buffers.depth.data());
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// overrides the scene camera until the next CalculateViewport
+void Scene::SetCamera(const CameraBuffer& camera) {
+	cameraBuf = camera;
+	updateBuffer(cameraUBO, sizeof(cameraBuf), &cameraBuf);
+}
+
+void Scene::RenderTile(const Tile& tile, int pass, RenderBuffers& buffers) {
+	{
+		ScopedGpuTimer timer("gpu/raytrace");
+		shader.Activate();
+		shader.setInt("frameIndex", pass);
+		shader.setInt("checkerboard", 0);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glViewport(tile.x, tile.y, tile.width, tile.height);
+		quad.Render();
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+	CollectPathStats();
+	readTile(tile, buffers);
 }
 
 void Scene::RenderTextureInit() {
@@ -366,29 +310,187 @@ void Scene::RenderTextureInit() {
 }
 
 void Scene::RenderTexture(int startY, int endY) {
+	ScopedGpuTimer timer("gpu/raytrace");
 	shader.Activate();
+	shader.setInt("frameIndex", frameIndex);
+	shader.setInt("checkerboard", checkerboarding);
 	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
 	glViewport(0, startY, imageSize.x, endY - startY);
 	quad.Render();
+	displayTexture = renderedTexture;
+}
+
+// the shader counts in 32 bits, so this is called after every band to fold
+// the counters into the 64 bit totals before they can wrap
+void Scene::CollectPathStats() {
+	if (!collectStats) return;
+	PathStatsBuffer band;
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, statsSSBO);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(PathStatsBuffer), &band);
+	stats.paths += band.pathCount;
+	stats.segments += band.segmentCount;
+	stats.rays += band.rayCount;
+	stats.nodeVisits += band.nodeVisits;
+	stats.primitiveTests += band.primitiveTests;
+
+	PathStatsBuffer cleared;
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(PathStatsBuffer), &cleared);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 }
 
 void Scene::Delete() {
-	shader.Delete();
+	shaderCache.Delete();
+	textShader.Delete();
+	denoiseShader.Delete();
+	temporalShader.Delete();
+	frameTimer.Delete();
+	deleteRenderTargets();
+	glDeleteBuffers(1, &previousCameraUBO);
+	glDeleteBuffers(1, &materialsUBO);
+	glDeleteBuffers(1, &sphereMaterialsUBO);
+	glDeleteBuffers(1, &texturesUBO);
+	glDeleteTextures(1, &blueNoiseTexture);
+	glDeleteTextures(1, &textureArray);
 	quad.Delete();
 }
 
+// one layer per TextureStore image, each resampled from the mip level closest to the layer size
+// so every layer can share the array's mip chain. a scene without images gets a single black layer
+void Scene::createTextureArray() {
+	int layers = textureStore ? textureStore->getImageCount() : 0;
+	int largest = 1;
+	for (int i = 0; i < layers; i++) {
+		largest = std::max(largest, std::max(textureStore->getWidth(i), textureStore->getHeight(i)));
+	}
+	int size = 1;
+	while (size < largest && size < TEXTURE_LAYER_MAX) size *= 2;
+	int levels = 1;
+	while ((size >> levels) > 0) levels++;
+
+	glGenTextures(1, &textureArray);
+	glActiveTexture(GL_TEXTURE7);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, textureArray);
+	glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, GL_RGB16F, size, size, std::max(layers, 1));
+
+	std::vector<float> texels((size_t)size * size * 3, 0.0f);
+	if (layers == 0) glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, size, size, 1, GL_RGB, GL_FLOAT, texels.data());
+	for (int i = 0; i < layers; i++) {
+		float lod = std::max(0.0f, log2f((float)std::max(textureStore->getWidth(i), textureStore->getHeight(i)) / size));
+		for (int y = 0; y < size; y++) {
+			for (int x = 0; x < size; x++) {
+				glm::vec3 c = textureStore->Sample(i, glm::vec2((x + 0.5f) / size, (y + 0.5f) / size), lod);
+				size_t t = ((size_t)y * size + x) * 3;
+				texels[t] = c.x;
+				texels[t + 1] = c.y;
+				texels[t + 2] = c.z;
+			}
+		}
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, size, size, 1, GL_RGB, GL_FLOAT, texels.data());
+	}
+
+	glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+// linear float colour plus the feature buffers, and the denoise and history targets,
+// all at window size so the render scale can change without reallocating
+void Scene::createRenderTargets() {
+	glGenFramebuffers(1, &framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+
+	glActiveTexture(GL_TEXTURE2);
+	albedoTexture = createTargetTexture(GL_RGBA16F, GL_RGBA);
+	glActiveTexture(GL_TEXTURE3);
+	normalTexture = createTargetTexture(GL_RGBA16F, GL_RGBA);
+	glActiveTexture(GL_TEXTURE4);
+	depthTexture = createTargetTexture(GL_R32F, GL_RED);
+	glActiveTexture(GL_TEXTURE0);
+	renderedTexture = createTargetTexture(GL_RGBA32F, GL_RGBA);
+	displayTexture = renderedTexture;
+
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, renderedTexture, 0);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, albedoTexture, 0);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, normalTexture, 0);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, depthTexture, 0);
+	glDrawBuffers(4, drawBuffers);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		std::cout << "UH OH!";
+		exit(-1);
+	}
+
+	glGenFramebuffers(2, denoiseFramebuffers);
+	for (int i = 0; i < 2; i++) {
+		glBindFramebuffer(GL_FRAMEBUFFER, denoiseFramebuffers[i]);
+		denoiseTextures[i] = createTargetTexture(GL_RGBA32F, GL_RGBA);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, denoiseTextures[i], 0);
+		glDrawBuffers(1, drawBuffers);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+			std::cout << "UH OH!";
+			exit(-1);
+		}
+	}
+
+	glGenFramebuffers(2, historyFramebuffers);
+	for (int i = 0; i < 2; i++) {
+		glBindFramebuffer(GL_FRAMEBUFFER, historyFramebuffers[i]);
+		historyTextures[i] = createTargetTexture(GL_RGBA32F, GL_RGBA);
+		historyFeatureTextures[i] = createTargetTexture(GL_RGBA32F, GL_RGBA);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, historyTextures[i], 0);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, historyFeatureTextures[i], 0);
+		glDrawBuffers(2, drawBuffers);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+			std::cout << "UH OH!";
+			exit(-1);
+		}
+	}
+
+	glBindTexture(GL_TEXTURE_2D, renderedTexture);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void Scene::deleteRenderTargets() {
+	GLuint textures[] = {
+		renderedTexture, albedoTexture, normalTexture, depthTexture,
+		denoiseTextures[0], denoiseTextures[1],
+		historyTextures[0], historyTextures[1], historyFeatureTextures[0], historyFeatureTextures[1]
+	};
+	glDeleteTextures(10, textures);
+	glDeleteFramebuffers(1, &framebuffer);
+	glDeleteFramebuffers(2, denoiseFramebuffers);
+	glDeleteFramebuffers(2, historyFramebuffers);
+}
+
+// binds the new texture to the active unit
+GLuint Scene::createTargetTexture(GLint internalFormat, GLenum format) const {
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, windowSize.x, windowSize.y, 0, format, GL_FLOAT, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	return texture;
+}
+
 void Scene::createUniformBuffer(GLuint* ubo, const char* name, int bindingPoint, size_t size, void* data) const {
 	glGenBuffers(1, ubo);
 	glBindBuffer(GL_UNIFORM_BUFFER, *ubo);
 	glBufferData(GL_UNIFORM_BUFFER, size, data, GL_DYNAMIC_DRAW);
+	bindUniformBlock(name, bindingPoint);
+	glBindBufferBase(GL_UNIFORM_BUFFER, bindingPoint, *ubo);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void Scene::bindUniformBlock(const char* name, int bindingPoint) const {
 	GLuint blockIndex = glGetUniformBlockIndex(shader.ID, name);
 	if (blockIndex == 0xffffffff) {
 		fprintf(stderr, "Invalid ubo block name '%s'", name);
 		exit(1);
 	}
 	glUniformBlockBinding(shader.ID, blockIndex, bindingPoint);
-	glBindBufferBase(GL_UNIFORM_BUFFER, bindingPoint, *ubo);
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
 }
 
 void Scene::updateBuffer(GLuint ubo, size_t size, void* data) {
@@ -2,19 +2,44 @@
 
 #include "RenderQuad.h"
 #include "Shader.h"
+#include "ShaderCache.h"
+#include "SceneFeatures.h"
+#include "Sampler.h"
+#include "Denoiser.h"
+#include "RenderBuffers.h"
+#include "GpuTimer.h"
+#include "FrameGovernor.h"
+#include "Profiler.h"
+#include "SceneData.h"
+#include "RenderBackend.h"
 #include "BuffersStructs.h"
-#include "Utils.h"
-#include "Camera.h"
 
 #include <vector>
 #include <GLFW/glfw3.h>
 
-class Scene
+// frames the viewer's temporal accumulation averages over at most
+#define TEMPORAL_MAX_HISTORY 32
+// side of the texture array's layers, the largest image rounded up to a power of two up to this
+#define TEXTURE_LAYER_MAX 2048
+
+// running totals of the shader's stats buffer, see Scene::CollectPathStats
+struct TraceStats {
+	unsigned long long paths = 0;
+	unsigned long long segments = 0;
+	unsigned long long rays = 0;
+	unsigned long long nodeVisits = 0;
+	unsigned long long primitiveTests = 0;
+};
+
+// uploads a SceneData and renders it with raytrace.frag, plus the viewer's temporal,
+// denoise and upscale passes
+class Scene : public SceneData, public RenderBackend
 {
 public:
-	Camera camera;
 	Scene() {};
-	Scene(int width, int height, int samples = 8, int depth = 8);
+	// pathStats counts paths and segments for getAveragePathLength, traceStats adds the traversal
+	// counters. both cost the shader global atomics, so the viewer leaves them off
+	Scene(const SceneData& data, int width, int height, int samples = 8, int depth = 8, int rrDepth = 3, bool pathStats = false, bool traceStats = false);
 	void Delete();
 	void CalculateViewport();
 	void ResizeCallback(int width, int height);
@@ -22,33 +47,101 @@ public:
 	void RenderTextureInit();
 	void RenderTexture(int startY, int endY);
 	void TextureToScreen();
-	void AddSphere(SpheresBuffer s, MaterialBuffer m);
-	void CalculateBVHs();
+	void Accumulate();
+	void Denoise();
+	void ToggleDenoise() { denoising = !denoising; };
+	void ToggleTemporal() { temporal = !temporal; historyValid = false; };
+	void ToggleDynamicResolution();
+	void ReadBuffers(RenderBuffers& buffers);
+	void SetCamera(const CameraBuffer& camera) override;
+	void RenderTile(const Tile& tile, int pass, RenderBuffers& buffers) override;
+	void CollectPathStats();
+	double getAveragePathLength() { return stats.paths == 0 ? 0.0 : (double)stats.segments / (double)stats.paths; };
+	const TraceStats& getTraceStats() { return stats; };
 	GLuint getFrameBuffer() { return framebuffer; };
-	void CreateBalls();
+	void UseVariant(const SceneFeatures& variant);
+	void LimitMaterials(unsigned int materialFlags);
+	// uploads the material table after materials were edited, the geometry stays as it is
+	void UpdateMaterials();
+	SceneFeatures getFeatures() { return features; };
+	const BlueNoise& getBlueNoise() { return blueNoise; };
+	const CameraBuffer& getCameraBuffer() { return cameraBuf; };
+	Denoiser& getDenoiser() { return denoiser; };
+	const FrameGovernor& getGovernor() { return governor; };
+	bool getDynamicResolution() { return dynamicResolution; };
 
 private:
 	Shader shader;
+	ShaderCache shaderCache;
+	SceneFeatures features;
 	Shader textShader;
 	RenderQuad quad;
-	GLuint framebuffer;
-	GLuint renderedTexture;
-	GLenum drawBuffers[1] = { GL_COLOR_ATTACHMENT0 };
+	GLuint framebuffer = 0;
+	GLuint renderedTexture = 0;
+	// first hit features for the denoiser, bound to texture units 2, 3 and 4
+	GLuint albedoTexture = 0;
+	GLuint normalTexture = 0;
+	GLuint depthTexture = 0;
+	GLenum drawBuffers[4] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3 };
 	GLuint texID;
 
-	glm::uvec2 imageSize;
+	Shader denoiseShader;
+	Denoiser denoiser;
+	bool denoising = false;
+	GLuint denoiseFramebuffers[2] = { 0, 0 };
+	GLuint denoiseTextures[2] = { 0, 0 };
+	// whatever TextureToScreen shows, the raw render or the last temporal/denoise target
+	GLuint displayTexture = 0;
+
+	Shader temporalShader;
+	bool temporal = true;
+	bool historyValid = false;
+	int frameIndex = 0;
+	CameraBuffer previousCameraBuf;
+	GLuint previousCameraUBO;
+	// ping-ponged, read from texture units 5 and 6 while the other pair is written
+	int historyIndex = 0;
+	GLuint historyFramebuffers[2] = { 0, 0 };
+	GLuint historyTextures[2] = { 0, 0 };
+	GLuint historyFeatureTextures[2] = { 0, 0 };
+
+	// the viewer renders at windowSize scaled by the governor into the bottom left of
+	// window sized targets, texture.frag upscales it
+	bool dynamicResolution = true;
+	bool checkerboarding = false;
+	FrameGovernor governor;
+	GpuTimer frameTimer;
+
+	glm::uvec2 imageSize; // render resolution
+	glm::uvec2 windowSize;
 	glm::vec3 cameraLookAt;
 
 	glm::vec3 vup = glm::vec3(0, 1, 0);
 
 	CameraBuffer cameraBuf;
 	GLuint cameraUBO;
-	std::vector<SpheresBuffer> spheres;
 	GLuint spheresUBO;
-	std::vector<BVHBuffer> bvhs;
+	GLuint materialsUBO;
+	GLuint sphereMaterialsUBO;
 	GLuint bvhUBO;
+	GLuint lightsUBO;
+	GLuint texturesUBO;
+	// raytrace.frag's image textures on unit 7
+	GLuint textureArray = 0;
+	GLuint statsSSBO;
+	BlueNoise blueNoise;
+	GLuint blueNoiseTexture;
+	TraceStats stats;
+	bool collectStats = false;
 
+	void applyGovernor();
+	void readTile(const Tile& tile, RenderBuffers& buffers);
+	void createTextureArray();
+	void createRenderTargets();
+	void deleteRenderTargets();
+	GLuint createTargetTexture(GLint internalFormat, GLenum format) const;
 	void createUniformBuffer(GLuint* ubo, const char* name, int bindingPoint, size_t size, void* data) const;
+	void bindUniformBlock(const char* name, int bindingPoint) const;
 	void updateBuffer(GLuint ubo, size_t size, void* data);
 };
 
@@ -0,0 +1,86 @@
+#include "SceneData.h"
+
+#include <cmath>
+
+void SceneData::AddSphere(SpheresBuffer s, MaterialBuffer m) {
+	spheres.push_back(s);
+	sphereMaterials.push_back(AddMaterial(m));
+}
+
+int SceneData::AddMaterial(const MaterialBuffer& m) {
+	// compared field by field, the padding isn't initialised
+	MaterialKey key(m.colour.x, m.colour.y, m.colour.z, m.reflective, m.refractive, m.emitter, m.albedoTexture, m.roughnessTexture, m.normalTexture);
+	auto it = materialIndices.find(key);
+	if (it != materialIndices.end()) return it->second;
+
+	int index = (int)materials.size();
+	materials.push_back(m);
+	materialIndices[key] = index;
+	return index;
+}
+
+int SceneData::AddTexture(const TextureBuffer& t) {
+	textures.push_back(t);
+	return (int)textures.size() - 1;
+}
+
+int SceneData::LoadTexture(const std::string& path, bool linear) {
+	if (!textureStore) textureStore = std::make_shared<TextureStore>();
+	TextureBuffer t;
+	t.type = TEXTURE_TYPE_IMAGE;
+	t.image = textureStore->Load(path, linear);
+	t.width = textureStore->getWidth(t.image);
+	t.height = textureStore->getHeight(t.image);
+	return AddTexture(t);
+}
+
+void SceneData::CalculateBVHs(BVHSplit split, uint32_t seed) {
+	bvhs = BVHBuilder(split, seed).Build(spheres);
+}
+
+void SceneData::CalculateClusters(BVHSplit split, uint32_t seed) {
+	BVHBuilder builder(split, seed, SPHERE_LANES);
+	clusters = builder.Build(spheres);
+	packedSpheres.Build(spheres, clusters, builder.getOrder());
+}
+
+// every emitter sphere becomes a light for next event estimation in raytrace.frag
+void SceneData::CalculateLights() {
+	lights.clear();
+	for (int i = 0; i < (int)spheres.size(); i++) {
+		const SpheresBuffer& s = spheres[i];
+		const MaterialBuffer& m = materials[sphereMaterials[i]];
+		if (m.emitter) {
+			lights.push_back(LightBuffer(s.position, fabs(s.radius), m.colour, i));
+		}
+	}
+}
+
+// the viewport raytrace.frag and CpuRenderer shoot camera rays through, for a size x pixel image
+CameraBuffer SceneData::MakeCameraBuffer(glm::uvec2 size) const {
+	CameraBuffer cameraBuf;
+	cameraBuf.position = camera.position;
+	cameraBuf.backgroundColour = backgroundColour;
+
+	float theta = glm::radians(camera.fov);
+	float h = tan(theta / 2.0f);
+	float viewportHeight = 2.0f * h * camera.focalLength;
+	float viewportWidth = viewportHeight * ((float)size.x / (float)size.y);
+
+	glm::vec3 w, u, v;
+	w = -camera.direction;
+	u = camera.rightv;
+	v = camera.upv;
+
+	glm::vec3 viewportU = viewportWidth * u;
+	glm::vec3 viewportV = viewportHeight * v;
+
+	cameraBuf.du = viewportU / (float) size.x;
+	cameraBuf.dv = viewportV / (float) size.y;
+
+	glm::vec3 viewportTopleft = cameraBuf.position - (camera.focalLength * w) - viewportU / 2.0f - viewportV / 2.0f;
+	cameraBuf.viewportTopLeft = viewportTopleft + 0.5f * (cameraBuf.du + cameraBuf.dv);
+
+	cameraBuf.screenRes = glm::vec2(size);
+	return cameraBuf;
+}
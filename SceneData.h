@@ -0,0 +1,51 @@
+#pragma once
+
+#include "BVHBuilder.h"
+#include "SphereStore.h"
+#include "TextureStore.h"
+#include "BuffersStructs.h"
+#include "Camera.h"
+
+#include <vector>
+#include <map>
+#include <tuple>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+// the GL free half of a scene: geometry, lights, bvh and camera. Scene uploads it for the
+// shader, the CPU renderer and benchmarks use it directly
+class SceneData
+{
+public:
+	Camera camera;
+	glm::vec3 backgroundColour = glm::vec3(0.1f, 0.1f, 0.1f);
+	std::vector<SpheresBuffer> spheres;
+	// every distinct material once, spheres refer to them by index
+	std::vector<MaterialBuffer> materials;
+	// the materials index of each sphere, apart from the spheres so they stay 16 bytes
+	std::vector<int> sphereMaterials;
+	std::vector<BVHBuffer> bvhs;
+	// what the materials' texture indices refer to, image ones point into textureStore
+	std::vector<TextureBuffer> textures;
+	std::shared_ptr<TextureStore> textureStore;
+	std::vector<LightBuffer> lights;
+	// the CPU tracer's tree, with SPHERE_LANES sized leaves packed into packedSpheres
+	std::vector<BVHBuffer> clusters;
+	SphereStore packedSpheres;
+
+	void AddSphere(SpheresBuffer s, MaterialBuffer m);
+	// index of m in materials, added if no material there is the same
+	int AddMaterial(const MaterialBuffer& m);
+	int AddTexture(const TextureBuffer& t);
+	// an image texture, loaded into textureStore (created on first use). returns its texture index
+	int LoadTexture(const std::string& path, bool linear = false);
+	void CalculateBVHs(BVHSplit split = BVH_SPLIT_MEDIAN, uint32_t seed = 1);
+	void CalculateClusters(BVHSplit split = BVH_SPLIT_SAH, uint32_t seed = 1);
+	void CalculateLights();
+	CameraBuffer MakeCameraBuffer(glm::uvec2 size) const;
+private:
+	typedef std::tuple<float, float, float, float, float, int, int, int, int> MaterialKey;
+	std::map<MaterialKey, int> materialIndices;
+};
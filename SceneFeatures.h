@@ -0,0 +1,65 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "BuffersStructs.h"
+
+// feature flags, each one becomes a #define in the specialised raytrace.frag
+#define FEATURE_LAMBERTIAN (1 << 0)
+#define FEATURE_SPECULAR (1 << 1)
+#define FEATURE_REFRACTIVE (1 << 2)
+#define FEATURE_EMITTER (1 << 3)
+#define FEATURE_BVH (1 << 4)
+#define FEATURE_TEXTURES (1 << 5)
+#define FEATURE_ALL (FEATURE_LAMBERTIAN | FEATURE_SPECULAR | FEATURE_REFRACTIVE | FEATURE_EMITTER | FEATURE_BVH | FEATURE_TEXTURES)
+
+// below this many spheres a flat loop beats walking the bvh
+#define BVH_MIN_SPHERES 8
+
+struct SceneFeatures {
+	unsigned int flags = 0;
+
+	SceneFeatures(unsigned int _flags = FEATURE_ALL) {
+		flags = _flags;
+	}
+
+	// material classes mirror the branches in getRayColour
+	static SceneFeatures Analyse(const std::vector<SpheresBuffer>& spheres, const std::vector<MaterialBuffer>& materials) {
+		SceneFeatures f(0);
+		for (auto& m : materials) {
+			if (m.emitter) f.flags |= FEATURE_EMITTER;
+			else if (m.refractive > 0.0f) f.flags |= FEATURE_REFRACTIVE;
+			else if (m.reflective > 0.0f) f.flags |= FEATURE_SPECULAR;
+			else f.flags |= FEATURE_LAMBERTIAN;
+			if (m.albedoTexture != TEXTURE_NONE || m.roughnessTexture != TEXTURE_NONE || m.normalTexture != TEXTURE_NONE) f.flags |= FEATURE_TEXTURES;
+		}
+		if (spheres.size() >= BVH_MIN_SPHERES) f.flags |= FEATURE_BVH;
+		return f;
+	}
+
+	bool Has(unsigned int feature) const {
+		return (flags & feature) != 0;
+	}
+
+	std::vector<std::string> Defines() const {
+		std::vector<std::string> names;
+		if (Has(FEATURE_LAMBERTIAN)) names.push_back("FEATURE_LAMBERTIAN");
+		if (Has(FEATURE_SPECULAR)) names.push_back("FEATURE_SPECULAR");
+		if (Has(FEATURE_REFRACTIVE)) names.push_back("FEATURE_REFRACTIVE");
+		if (Has(FEATURE_EMITTER)) names.push_back("FEATURE_EMITTER");
+		if (Has(FEATURE_BVH)) names.push_back("FEATURE_BVH");
+		if (Has(FEATURE_TEXTURES)) names.push_back("FEATURE_TEXTURES");
+		return names;
+	}
+
+	std::string ToString() const {
+		std::string s;
+		if (Has(FEATURE_LAMBERTIAN)) s += "lambertian ";
+		if (Has(FEATURE_SPECULAR)) s += "specular ";
+		if (Has(FEATURE_REFRACTIVE)) s += "refractive ";
+		if (Has(FEATURE_EMITTER)) s += "emitter ";
+		if (Has(FEATURE_TEXTURES)) s += "textured ";
+		s += Has(FEATURE_BVH) ? "bvh" : "flat";
+		return s;
+	}
+};
@@ -0,0 +1,302 @@
+#include "SceneLibrary.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <map>
+
+#define LIBRARY_PI 3.14159265359f
+
+std::vector<std::string> SceneLibrary::Names() {
+	return { "balls", "field100k", "deepglass", "surface" };
+}
+
+SceneData SceneLibrary::Create(const std::string& name, uint32_t seed) {
+	SceneLibrary library(seed);
+	SceneData scene;
+
+	if (name == "balls") library.balls(scene);
+	else if (name == "field100k") library.field(scene, 100000);
+	else if (name == "deepglass") library.deepGlass(scene);
+	else if (name == "surface") library.surface(scene);
+	else {
+		fprintf(stderr, "Unknown scene \"%s\"\n", name.c_str());
+		exit(1);
+	}
+
+	scene.CalculateLights();
+	return scene;
+}
+
+SceneData SceneLibrary::Load(const std::string& path, uint32_t seed) {
+	std::ifstream in(path);
+	if (!in) {
+		fprintf(stderr, "Failed to read scene %s\n", path.c_str());
+		exit(1);
+	}
+
+	SceneData scene;
+	std::string line;
+	int lineNumber = 0;
+	std::map<std::string, int> textureNames;
+	// image paths are relative to the scene file
+	std::string directory = path.substr(0, path.find_last_of("/\\") + 1);
+	auto fail = [&](const char* message) {
+		fprintf(stderr, "%s:%d: %s\n", path.c_str(), lineNumber, message);
+		exit(1);
+	};
+
+	while (std::getline(in, line)) {
+		lineNumber++;
+		std::stringstream ss(line.substr(0, line.find('#')));
+		std::string keyword;
+		if (!(ss >> keyword)) continue;
+
+		if (keyword == "background") {
+			glm::vec3 c;
+			if (!(ss >> c.x >> c.y >> c.z)) fail("expected background r g b");
+			scene.backgroundColour = c;
+		}
+		else if (keyword == "camera") {
+			glm::vec3 position, target;
+			float fov;
+			if (!(ss >> position.x >> position.y >> position.z >> target.x >> target.y >> target.z >> fov)) {
+				fail("expected camera x y z targetx targety targetz fov");
+			}
+			scene.camera.position = position;
+			scene.camera.fov = fov;
+			scene.camera.LookAt(target);
+		}
+		else if (keyword == "sphere") {
+			glm::vec3 position;
+			float radius;
+			std::string type;
+			if (!(ss >> position.x >> position.y >> position.z >> radius >> type)) {
+				fail("expected sphere x y z radius material ...");
+			}
+
+			MaterialBuffer mat;
+			glm::vec3 c;
+			float value;
+			if (type == "diffuse") {
+				if (!(ss >> c.x >> c.y >> c.z)) fail("expected diffuse r g b");
+				mat = MaterialBuffer(c);
+			}
+			else if (type == "metal") {
+				if (!(ss >> c.x >> c.y >> c.z >> value)) fail("expected metal r g b shininess");
+				mat = MaterialBuffer(c, value);
+			}
+			else if (type == "glass") {
+				if (!(ss >> value) || value <= 0.0f) fail("expected glass ior");
+				mat = MaterialBuffer(glm::vec3(1, 1, 1), 0.0f, value);
+			}
+			else if (type == "light") {
+				if (!(ss >> c.x >> c.y >> c.z)) fail("expected light r g b");
+				mat = MaterialBuffer(c, 0.0f, 0.0f, true);
+			}
+			else {
+				fail("unknown material, expected diffuse, metal, glass or light");
+			}
+
+			std::string option;
+			while (ss >> option) {
+				size_t equals = option.find('=');
+				auto it = textureNames.find(equals == std::string::npos ? "" : option.substr(equals + 1));
+				if (it == textureNames.end()) fail("expected albedo=, roughness= or normal= and a texture name");
+				std::string slot = option.substr(0, equals);
+				if (slot == "albedo") mat.albedoTexture = it->second;
+				else if (slot == "roughness") mat.roughnessTexture = it->second;
+				else if (slot == "normal") mat.normalTexture = it->second;
+				else fail("expected albedo=, roughness= or normal= and a texture name");
+			}
+			if (mat.emitter && (mat.albedoTexture != TEXTURE_NONE || mat.roughnessTexture != TEXTURE_NONE || mat.normalTexture != TEXTURE_NONE)) {
+				fail("lights can't be textured");
+			}
+			scene.AddSphere(SpheresBuffer(position, radius), mat);
+		}
+		else if (keyword == "texture") {
+			std::string name, type;
+			if (!(ss >> name >> type)) fail("expected texture name image|checker|noise ...");
+			if (textureNames.count(name)) fail("texture name already used");
+			if (type == "image") {
+				std::string file, mode;
+				if (!(ss >> file)) fail("expected texture name image path [linear]");
+				if (ss >> mode && mode != "linear") fail("expected texture name image path [linear]");
+				if (file[0] != '/' && file.find(':') == std::string::npos) file = directory + file;
+				textureNames[name] = scene.LoadTexture(file, mode == "linear");
+			}
+			else if (type == "checker" || type == "noise") {
+				TextureBuffer t;
+				t.type = type == "checker" ? TEXTURE_TYPE_CHECKER : TEXTURE_TYPE_NOISE;
+				if (!(ss >> t.colourA.x >> t.colourA.y >> t.colourA.z >> t.colourB.x >> t.colourB.y >> t.colourB.z >> t.scale) || t.scale <= 0.0f) {
+					fail("expected texture name checker|noise r g b r g b scale");
+				}
+				textureNames[name] = scene.AddTexture(t);
+			}
+			else {
+				fail("unknown texture type, expected image, checker or noise");
+			}
+		}
+		else if (keyword == "library") {
+			// a library scene as the starting point, later lines add to it or move the camera
+			std::string name;
+			uint32_t librarySeed = seed;
+			if (!(ss >> name)) fail("expected library name [seed]");
+			if (!(ss >> librarySeed) && !ss.eof()) fail("expected library name [seed]");
+			if (!scene.spheres.empty() || !scene.textures.empty()) fail("library must come before any spheres or textures");
+			std::vector<std::string> names = Names();
+			if (std::find(names.begin(), names.end(), name) == names.end()) fail("unknown library scene");
+			glm::vec3 background = scene.backgroundColour;
+			scene = Create(name, librarySeed);
+			scene.backgroundColour = background;
+		}
+		else {
+			fail("unknown keyword, expected background, camera, texture, sphere or library");
+		}
+
+		std::string extra;
+		if (ss >> extra) fail("unexpected text at the end of the line");
+	}
+
+	if (scene.spheres.empty()) {
+		fprintf(stderr, "%s: scene has no spheres\n", path.c_str());
+		exit(1);
+	}
+	scene.CalculateLights();
+	return scene;
+}
+
+SceneData SceneLibrary::Open(const std::string& nameOrPath, uint32_t seed) {
+	std::vector<std::string> names = Names();
+	if (std::find(names.begin(), names.end(), nameOrPath) != names.end()) return Create(nameOrPath, seed);
+	return Load(nameOrPath, seed);
+}
+
+// 24 bits of the generator, std's distributions differ between standard libraries
+float SceneLibrary::randomFloat() {
+	return (float)(rng() >> 8) / 16777216.0f;
+}
+
+glm::vec3 SceneLibrary::randomVec3() {
+	float x = randomFloat();
+	float y = randomFloat();
+	return glm::vec3(x, y, randomFloat());
+}
+
+// the mix the balls scene uses: mostly diffuse, some metal, a few glass
+MaterialBuffer SceneLibrary::randomMaterial() {
+	float c = randomFloat();
+	MaterialBuffer mat;
+	if (c < 0.8f) {
+		mat.colour = randomVec3() * randomVec3();
+	}
+	else if (c < 0.95f) {
+		mat.colour = randomVec3() * 0.5f + glm::vec3(0.5f, 0.5f, 0.5f);
+		mat.reflective = randomFloat() * 0.5f + 0.5f;
+	}
+	else {
+		mat.refractive = 1.5f;
+	}
+	return mat;
+}
+
+// the viewer's scene, a big glass, metal and emissive ball among random small ones
+void SceneLibrary::balls(SceneData& scene) {
+	scene.camera.position = glm::vec3(13, 2, 3);
+	scene.camera.fov = 20.0;
+	scene.camera.yaw = -173.5f;
+	scene.camera.pitch = -6.5f;
+	scene.camera.updateVectors();
+
+	scene.AddSphere(SpheresBuffer(glm::vec3(0.0f, -1000.0f, 0.0f), 1000.0f), MaterialBuffer(glm::vec3(0.5f, 0.5f, 0.5f)));
+
+	const int n = 11;
+	for (int a = -n; a < n; a++) {
+		for (int b = -n; b < n; b++) {
+			MaterialBuffer mat = randomMaterial();
+			float x = randomFloat();
+			glm::vec3 center(a + 0.9f * x, 0.2f, b + 0.9f * randomFloat());
+			scene.AddSphere(SpheresBuffer(center, 0.2f), mat);
+		}
+	}
+
+	scene.AddSphere(SpheresBuffer(glm::vec3(0, 1, 0), 1.0f), MaterialBuffer(glm::vec3(1.0f, 1.0f, 1.0f), 0.0f, 1.5f));
+	scene.AddSphere(SpheresBuffer(glm::vec3(0, 1, 0), -0.95f), MaterialBuffer(glm::vec3(1.0f, 1.0f, 1.0f), 0.0f, 1.5f));
+	scene.AddSphere(SpheresBuffer(glm::vec3(-4, 1, 0), 1.0f), MaterialBuffer(glm::vec3(0.1f, 0.3f, 0.1f), 0.0f, 0.0f, true));
+	scene.AddSphere(SpheresBuffer(glm::vec3(4, 1, 0), 1.0f), MaterialBuffer(glm::vec3(0.7f, 0.6f, 0.5f), 1.0f, 0.0f));
+}
+
+// small spheres scattered over a square on the floor, with a few lights among them
+void SceneLibrary::field(SceneData& scene, int count) {
+	float half = sqrtf((float)count) * 0.5f;
+	scene.camera.position = glm::vec3(0, half * 0.3f, half * 1.2f);
+	scene.camera.fov = 50.0f;
+	scene.camera.LookAt(glm::vec3(0, 0, 0));
+
+	scene.AddSphere(SpheresBuffer(glm::vec3(0.0f, -10000.0f, 0.0f), 10000.0f), MaterialBuffer(glm::vec3(0.5f, 0.5f, 0.5f)));
+
+	for (int i = 0; i < count; i++) {
+		float radius = 0.1f + 0.3f * randomFloat();
+		float x = (randomFloat() * 2.0f - 1.0f) * half;
+		float z = (randomFloat() * 2.0f - 1.0f) * half;
+		if (i % 5000 == 0) {
+			scene.AddSphere(SpheresBuffer(glm::vec3(x, radius, z), radius), MaterialBuffer(glm::vec3(4.0f, 3.6f, 3.0f), 0.0f, 0.0f, true));
+		}
+		else {
+			scene.AddSphere(SpheresBuffer(glm::vec3(x, radius, z), radius), randomMaterial());
+		}
+	}
+}
+
+// glass balls made of nested shells, every ray that enters one goes through many interfaces
+void SceneLibrary::deepGlass(SceneData& scene) {
+	const int shells = 8;
+	scene.camera.position = glm::vec3(0, 3, 9);
+	scene.camera.fov = 40.0f;
+	scene.camera.LookAt(glm::vec3(0, 0.8f, 0));
+
+	scene.AddSphere(SpheresBuffer(glm::vec3(0.0f, -1000.0f, 0.0f), 1000.0f), MaterialBuffer(glm::vec3(0.5f, 0.5f, 0.5f)));
+	scene.AddSphere(SpheresBuffer(glm::vec3(0, 8, 0), 2.0f), MaterialBuffer(glm::vec3(6.0f, 6.0f, 6.0f), 0.0f, 0.0f, true));
+
+	for (int a = -2; a <= 2; a++) {
+		for (int b = -2; b <= 0; b++) {
+			glm::vec3 centre(a * 2.2f, 1.0f, b * 2.2f);
+			// alternating solid and hollow spheres, each a little smaller than the last
+			for (int s = 0; s < shells; s++) {
+				float radius = 1.0f - s * 0.1f;
+				scene.AddSphere(SpheresBuffer(centre, (s & 1) ? -radius : radius), MaterialBuffer(glm::vec3(1, 1, 1), 0.0f, 1.5f));
+			}
+			scene.AddSphere(SpheresBuffer(centre, 0.1f), MaterialBuffer(randomVec3()));
+		}
+	}
+}
+
+// there is no triangle primitive, so a dense surface is tiled with small overlapping
+// spheres instead: a torus with a few thousand coincident bounds, like a fine mesh
+void SceneLibrary::surface(SceneData& scene) {
+	const int rings = 240, segments = 60;
+	const float major = 2.0f, minor = 0.7f;
+	scene.camera.position = glm::vec3(0, 4, 6);
+	scene.camera.fov = 45.0f;
+	scene.camera.LookAt(glm::vec3(0, 0.5f, 0));
+
+	scene.AddSphere(SpheresBuffer(glm::vec3(0.0f, -1000.0f, 0.0f), 1000.0f), MaterialBuffer(glm::vec3(0.5f, 0.5f, 0.5f)));
+	scene.AddSphere(SpheresBuffer(glm::vec3(-4, 6, 3), 1.0f), MaterialBuffer(glm::vec3(8.0f, 8.0f, 8.0f), 0.0f, 0.0f, true));
+
+	MaterialBuffer diffuse(glm::vec3(0.8f, 0.3f, 0.2f));
+	MaterialBuffer metal(glm::vec3(0.9f, 0.9f, 0.9f), 0.9f);
+	float radius = 1.5f * LIBRARY_PI * minor / segments;
+	for (int i = 0; i < rings; i++) {
+		float theta = 2.0f * LIBRARY_PI * i / rings;
+		for (int j = 0; j < segments; j++) {
+			float phi = 2.0f * LIBRARY_PI * j / segments;
+			glm::vec3 p((major + minor * cos(phi)) * cos(theta), minor * sin(phi) + minor + 0.2f, (major + minor * cos(phi)) * sin(theta));
+			// jitter so the grid doesn't line up with bvh splits
+			p += (randomVec3() - glm::vec3(0.5f)) * radius * 0.2f;
+			scene.AddSphere(SpheresBuffer(p, radius), (i / 20) & 1 ? metal : diffuse);
+		}
+	}
+}
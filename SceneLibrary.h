@@ -0,0 +1,34 @@
+#pragma once
+
+#include "SceneData.h"
+
+#include <vector>
+#include <string>
+#include <random>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+// fixed scenes for the viewer and benchmarks, built the same for a given seed on every run and platform
+class SceneLibrary
+{
+public:
+	static std::vector<std::string> Names();
+	// lights are calculated but not the bvh. exits on an unknown name, see Names
+	static SceneData Create(const std::string& name, uint32_t seed = 1);
+	// a scene file, see the README for the format. exits with the line on an error
+	static SceneData Load(const std::string& path, uint32_t seed = 1);
+	// a library name, or else a file
+	static SceneData Open(const std::string& nameOrPath, uint32_t seed = 1);
+private:
+	std::mt19937 rng;
+
+	SceneLibrary(uint32_t seed) : rng(seed) {};
+	float randomFloat();
+	glm::vec3 randomVec3();
+	MaterialBuffer randomMaterial();
+
+	void balls(SceneData& scene);
+	void field(SceneData& scene, int count);
+	void deepGlass(SceneData& scene);
+	void surface(SceneData& scene);
+};
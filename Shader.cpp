@@ -17,9 +17,17 @@ void Shader::SetDefine(std::string from, int to) {
 	}
 }
 
+// defines are inserted after the #version line when the shader is created
+void Shader::AddDefine(std::string name, int value) {
+	defines += "#define " + name + " " + std::to_string(value) + "\n";
+}
+
 void Shader::Create() {
+	std::string fragWithDefines = fragCode;
+	fragWithDefines.insert(fragWithDefines.find('\n') + 1, defines);
+
 	const char* vertexSource = vertexCode.c_str();
-	const char* fragSource = fragCode.c_str();
+	const char* fragSource = fragWithDefines.c_str();
 
 
 	GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
@@ -30,7 +38,7 @@ void Shader::Create() {
 	GLuint fragShader = glCreateShader(GL_FRAGMENT_SHADER);
 	glShaderSource(fragShader, 1, &fragSource, NULL);
 	glCompileShader(fragShader);
-	Shader::CompileErrors(vertexShader, FRAGMENT);
+	Shader::CompileErrors(fragShader, FRAGMENT);
 
 	ID = glCreateProgram();
 	glAttachShader(ID, vertexShader);
@@ -65,6 +73,10 @@ void Shader::setFloat(const char* name, float v) {
 	glUniform1f(glGetUniformLocation(ID, name), v);
 }
 
+void Shader::setVec2(const char* name, float x, float y) {
+	glUniform2f(glGetUniformLocation(ID, name), x, y);
+}
+
 void Shader::setInt(const char* name, int v) {
 	glUniform1i(glGetUniformLocation(ID, name), v);
 }
@@ -12,6 +12,7 @@ public:
 	Shader();
 	Shader(const char* vertexFile, const char* fragFile);
 	void SetDefine(std::string from, int to);
+	void AddDefine(std::string name, int value = 1);
 	void Create();
 	void Activate();
 	void Delete();
@@ -19,9 +20,11 @@ public:
 	static std::string LoadSourceFromPath(const char* path);
 	void setInt(const char* name, int v);
 	void setFloat(const char* name, float v);
+	void setVec2(const char* name, float x, float y);
 private:
 	std::string vertexCode;
 	std::string fragCode;
+	std::string defines;
 };
 
 enum ShaderType {
@@ -0,0 +1,27 @@
+#include "ShaderCache.h"
+
+ShaderCache::ShaderCache(Shader base) {
+	this->base = base;
+}
+
+Shader& ShaderCache::Get(const SceneFeatures& features) {
+	auto it = variants.find(features.flags);
+	if (it != variants.end()) {
+		return it->second;
+	}
+
+	Shader variant = base;
+	for (auto& name : features.Defines()) {
+		variant.AddDefine(name);
+	}
+	variant.Create();
+
+	return variants[features.flags] = variant;
+}
+
+void ShaderCache::Delete() {
+	for (auto& v : variants) {
+		v.second.Delete();
+	}
+	variants.clear();
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "Shader.h"
+#include "SceneFeatures.h"
+
+#include <unordered_map>
+
+// compiles one raytrace.frag variant per feature set and keeps it around,
+// so switching scenes (or benchmarking variants) only pays for each compile once
+class ShaderCache
+{
+public:
+	ShaderCache() {};
+	ShaderCache(Shader base);
+	Shader& Get(const SceneFeatures& features);
+	size_t Size() const { return variants.size(); };
+	void Delete();
+private:
+	Shader base;
+	std::unordered_map<unsigned int, Shader> variants;
+};
@@ -0,0 +1,177 @@
+#include "SphereStore.h"
+
+#include <cmath>
+#include <cfloat>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static inline int firstLane(unsigned int mask) {
+#ifdef _MSC_VER
+	unsigned long lane;
+	_BitScanForward(&lane, mask);
+	return (int)lane;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+void SphereStore::Clear() {
+	x.clear();
+	y.clear();
+	z.clear();
+	radius.clear();
+	sphereIndex.clear();
+}
+
+int SphereStore::AddCluster(const std::vector<SpheresBuffer>& spheres, const int* indices, int count) {
+	int first = getSize();
+	int padded = (count + SPHERE_LANES - 1) / SPHERE_LANES * SPHERE_LANES;
+	for (int i = 0; i < padded; i++) {
+		int index = indices[i < count ? i : count - 1];
+		const SpheresBuffer& s = spheres[index];
+		x.push_back(s.position.x);
+		y.push_back(s.position.y);
+		z.push_back(s.position.z);
+		// only the size of the radius matters to the quadratic
+		radius.push_back(fabsf(s.radius));
+		sphereIndex.push_back(index);
+	}
+	return first;
+}
+
+void SphereStore::Build(const std::vector<SpheresBuffer>& spheres, std::vector<BVHBuffer>& clusters, const std::vector<int>& order) {
+	Clear();
+	for (BVHBuffer& node : clusters) {
+		if (node.type != BVH_TYPE_CLUSTER) continue;
+		int count = node.right_index;
+		node.left_index = AddCluster(spheres, &order[node.left_index], count);
+		node.right_index = (count + SPHERE_LANES - 1) / SPHERE_LANES * SPHERE_LANES;
+	}
+}
+
+// the same quadratic as Tracer::hitSphere, near root first, with c as (|oc| - r)(|oc| + r)
+int SphereStore::Hit(int first, int count, const Ray& r, float tmin, float& tmax) const {
+	float a = glm::dot(r.direction, r.direction);
+	int closest = -1;
+	int end = first + count;
+
+#if defined(__AVX512F__)
+	__m512 ox = _mm512_set1_ps(r.origin.x), oy = _mm512_set1_ps(r.origin.y), oz = _mm512_set1_ps(r.origin.z);
+	__m512 dx = _mm512_set1_ps(r.direction.x), dy = _mm512_set1_ps(r.direction.y), dz = _mm512_set1_ps(r.direction.z);
+	__m512 va = _mm512_set1_ps(a), vtmin = _mm512_set1_ps(tmin), inf = _mm512_set1_ps(INFINITY);
+	for (int i = first; i < end; i += 16) {
+		__m512 ocx = _mm512_sub_ps(ox, _mm512_loadu_ps(&x[i]));
+		__m512 ocy = _mm512_sub_ps(oy, _mm512_loadu_ps(&y[i]));
+		__m512 ocz = _mm512_sub_ps(oz, _mm512_loadu_ps(&z[i]));
+		__m512 rad = _mm512_loadu_ps(&radius[i]);
+		__m512 halfb = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(ocx, dx), _mm512_mul_ps(ocy, dy)), _mm512_mul_ps(ocz, dz));
+		__m512 len = _mm512_sqrt_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(ocx, ocx), _mm512_mul_ps(ocy, ocy)), _mm512_mul_ps(ocz, ocz)));
+		__m512 c = _mm512_mul_ps(_mm512_sub_ps(len, rad), _mm512_add_ps(len, rad));
+		__m512 disc = _mm512_sub_ps(_mm512_mul_ps(halfb, halfb), _mm512_mul_ps(va, c));
+		__mmask16 real = _mm512_cmp_ps_mask(disc, _mm512_setzero_ps(), _CMP_GE_OQ);
+		if (!real) continue;
+
+		__m512 sqrtd = _mm512_sqrt_ps(_mm512_max_ps(disc, _mm512_setzero_ps()));
+		__m512 nhalfb = _mm512_sub_ps(_mm512_setzero_ps(), halfb);
+		__m512 vtmax = _mm512_set1_ps(tmax);
+		__m512 t0 = _mm512_div_ps(_mm512_sub_ps(nhalfb, sqrtd), va);
+		__m512 t1 = _mm512_div_ps(_mm512_add_ps(nhalfb, sqrtd), va);
+		__mmask16 near0 = _mm512_cmp_ps_mask(t0, vtmin, _CMP_GT_OQ) & _mm512_cmp_ps_mask(t0, vtmax, _CMP_LT_OQ);
+		__m512 t = _mm512_mask_blend_ps(near0, t1, t0);
+		__mmask16 hit = real & _mm512_cmp_ps_mask(t, vtmin, _CMP_GT_OQ) & _mm512_cmp_ps_mask(t, vtmax, _CMP_LT_OQ);
+		if (!hit) continue;
+
+		t = _mm512_mask_blend_ps(hit, inf, t);
+		float best = _mm512_reduce_min_ps(t);
+		closest = i + firstLane(_mm512_cmp_ps_mask(t, _mm512_set1_ps(best), _CMP_EQ_OQ));
+		tmax = best;
+	}
+#elif defined(__AVX2__)
+	__m256 ox = _mm256_set1_ps(r.origin.x), oy = _mm256_set1_ps(r.origin.y), oz = _mm256_set1_ps(r.origin.z);
+	__m256 dx = _mm256_set1_ps(r.direction.x), dy = _mm256_set1_ps(r.direction.y), dz = _mm256_set1_ps(r.direction.z);
+	__m256 va = _mm256_set1_ps(a), vtmin = _mm256_set1_ps(tmin), inf = _mm256_set1_ps(INFINITY);
+	__m256 zero = _mm256_setzero_ps();
+	for (int i = first; i < end; i += 8) {
+		__m256 ocx = _mm256_sub_ps(ox, _mm256_loadu_ps(&x[i]));
+		__m256 ocy = _mm256_sub_ps(oy, _mm256_loadu_ps(&y[i]));
+		__m256 ocz = _mm256_sub_ps(oz, _mm256_loadu_ps(&z[i]));
+		__m256 rad = _mm256_loadu_ps(&radius[i]);
+		__m256 halfb = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, dx), _mm256_mul_ps(ocy, dy)), _mm256_mul_ps(ocz, dz));
+		__m256 len = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, ocx), _mm256_mul_ps(ocy, ocy)), _mm256_mul_ps(ocz, ocz)));
+		__m256 c = _mm256_mul_ps(_mm256_sub_ps(len, rad), _mm256_add_ps(len, rad));
+		__m256 disc = _mm256_sub_ps(_mm256_mul_ps(halfb, halfb), _mm256_mul_ps(va, c));
+		__m256 real = _mm256_cmp_ps(disc, zero, _CMP_GE_OQ);
+		if (!_mm256_movemask_ps(real)) continue;
+
+		__m256 sqrtd = _mm256_sqrt_ps(_mm256_max_ps(disc, zero));
+		__m256 nhalfb = _mm256_sub_ps(zero, halfb);
+		__m256 vtmax = _mm256_set1_ps(tmax);
+		__m256 t0 = _mm256_div_ps(_mm256_sub_ps(nhalfb, sqrtd), va);
+		__m256 t1 = _mm256_div_ps(_mm256_add_ps(nhalfb, sqrtd), va);
+		__m256 near0 = _mm256_and_ps(_mm256_cmp_ps(t0, vtmin, _CMP_GT_OQ), _mm256_cmp_ps(t0, vtmax, _CMP_LT_OQ));
+		__m256 t = _mm256_blendv_ps(t1, t0, near0);
+		__m256 hit = _mm256_and_ps(real, _mm256_and_ps(_mm256_cmp_ps(t, vtmin, _CMP_GT_OQ), _mm256_cmp_ps(t, vtmax, _CMP_LT_OQ)));
+		if (!_mm256_movemask_ps(hit)) continue;
+
+		// horizontal min of the hit lanes
+		t = _mm256_blendv_ps(inf, t, hit);
+		__m256 m = _mm256_min_ps(t, _mm256_permute2f128_ps(t, t, 1));
+		m = _mm256_min_ps(m, _mm256_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+		m = _mm256_min_ps(m, _mm256_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+		closest = i + firstLane(_mm256_movemask_ps(_mm256_cmp_ps(t, m, _CMP_EQ_OQ)));
+		tmax = _mm256_cvtss_f32(m);
+	}
+#else
+	for (int i = first; i < end; i++) {
+		float ocx = r.origin.x - x[i], ocy = r.origin.y - y[i], ocz = r.origin.z - z[i];
+		float halfb = ocx * r.direction.x + ocy * r.direction.y + ocz * r.direction.z;
+		float len = sqrtf(ocx * ocx + ocy * ocy + ocz * ocz);
+		float c = (len - radius[i]) * (len + radius[i]);
+		float disc = halfb * halfb - a * c;
+		if (disc < 0) continue;
+
+		float sqrtd = sqrtf(disc);
+		float t = (-halfb - sqrtd) / a;
+		if (t <= tmin || tmax <= t) {
+			t = (-halfb + sqrtd) / a;
+			if (t <= tmin || tmax <= t) continue;
+		}
+		closest = i;
+		tmax = t;
+	}
+#endif
+	return closest;
+}
+
+bool SphereStore::Occluded(int first, int count, const Ray& r, float tmin, float tmax) const {
+#if defined(__AVX2__) || defined(__AVX512F__)
+	// a whole pass costs the same with or without the closest lane, so only stop between passes
+	for (int i = first; i < first + count; i += SPHERE_LANES) {
+		if (Hit(i, SPHERE_LANES, r, tmin, tmax) >= 0) return true;
+	}
+	return false;
+#else
+	float a = glm::dot(r.direction, r.direction);
+	int end = first + count;
+	for (int i = first; i < end; i++) {
+		float ocx = r.origin.x - x[i], ocy = r.origin.y - y[i], ocz = r.origin.z - z[i];
+		float halfb = ocx * r.direction.x + ocy * r.direction.y + ocz * r.direction.z;
+		float len = sqrtf(ocx * ocx + ocy * ocy + ocz * ocz);
+		float c = (len - radius[i]) * (len + radius[i]);
+		float disc = halfb * halfb - a * c;
+		if (disc < 0) continue;
+
+		float sqrtd = sqrtf(disc);
+		float t = (-halfb - sqrtd) / a;
+		if (t > tmin && t < tmax) return true;
+		t = (-halfb + sqrtd) / a;
+		if (t > tmin && t < tmax) return true;
+	}
+	return false;
+#endif
+}
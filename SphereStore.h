@@ -0,0 +1,40 @@
+#pragma once
+
+#include "BuffersStructs.h"
+#include "Tracer.h"
+
+#include <vector>
+#include <cstddef>
+
+// spheres one kernel call tests at once, clusters are padded to a multiple of it
+#ifdef __AVX512F__
+#define SPHERE_LANES 16
+#else
+#define SPHERE_LANES 8
+#endif
+
+// the CPU tracer's copy of the sphere geometry, one array per field, so bvh leaves of up to
+// SPHERE_LANES spheres are tested against a ray in a single AVX2/AVX-512 pass and materials stay
+// out of the cache until the closest hit is known. clusters are padded by repeating their last
+// sphere, which can only ever give the same hit again
+class SphereStore
+{
+public:
+	std::vector<float> x, y, z, radius;
+	std::vector<int> sphereIndex; // into the SpheresBuffer list, for the normal and material
+
+	void Clear();
+	// copies the spheres at indices into the next slots, returns the first
+	int AddCluster(const std::vector<SpheresBuffer>& spheres, const int* indices, int count);
+	// packs every BVH_TYPE_CLUSTER leaf of a BVHBuilder tree built with a leaf size, and points
+	// the leaf at its slots
+	void Build(const std::vector<SpheresBuffer>& spheres, std::vector<BVHBuffer>& clusters, const std::vector<int>& order);
+
+	// closest sphere of slots [first, first + count) hit in (tmin, tmax), which lowers tmax to its
+	// distance. -1 if none
+	int Hit(int first, int count, const Ray& r, float tmin, float& tmax) const;
+	bool Occluded(int first, int count, const Ray& r, float tmin, float tmax) const;
+
+	int getSize() const { return (int)x.size(); };
+	size_t getBytes() const { return x.size() * (4 * sizeof(float) + sizeof(int)); };
+};
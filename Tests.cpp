@@ -0,0 +1,323 @@
+// checks of the CPU side against simpler versions of the same thing, run by ctest.
+//
+// Tests [tracer|splits|sampler|checkpoint]
+//
+// runs every test without an argument. exits with 1 if any check fails
+
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "SceneLibrary.h"
+#include "BVHBuilder.h"
+#include "Tracer.h"
+#include "CpuRenderer.h"
+#include "FrameRenderer.h"
+#include "Checkpoint.h"
+#include "Sampler.h"
+
+#define TESTS_SEED 1
+// ray sphere tests per scene for the brute force comparison, fewer rays on bigger scenes
+#define TESTS_BRUTE_FORCE_TESTS 100000000
+#define TESTS_MAX_RAYS 20000
+// ground spheres are thousands across, and float can't tell whether a ray from that far away
+// hits a small sphere. they're left out of the bounds ray origins are picked in
+#define TESTS_MAX_ORIGIN_RADIUS 100.0f
+#define TESTS_CHECKPOINT_PATH "Tests_checkpoint.bin"
+
+static int failures = 0;
+
+static void check(bool ok, const char* test, const std::string& what) {
+	if (ok) return;
+	failures++;
+	// the first few are enough to go on
+	if (failures <= 10) fprintf(stderr, "%s: %s\n", test, what.c_str());
+}
+
+// random rays starting anywhere in the scene's bounds, so some start inside spheres
+static std::vector<Ray> randomRays(const SceneData& scene, int count, uint32_t seed) {
+	glm::vec3 lo(INFINITY), hi(-INFINITY);
+	for (const auto& s : scene.spheres) {
+		if (fabsf(s.radius) > TESTS_MAX_ORIGIN_RADIUS) continue;
+		lo = glm::min(lo, s.position - glm::vec3(fabsf(s.radius)));
+		hi = glm::max(hi, s.position + glm::vec3(fabsf(s.radius)));
+	}
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	std::vector<Ray> rays(count);
+	for (auto& r : rays) {
+		r.origin = lo + (hi - lo) * glm::vec3(unit(rng), unit(rng), unit(rng));
+		r.direction = Sampler::UniformSphere(glm::vec2(unit(rng), unit(rng)));
+	}
+	return rays;
+}
+
+// every sphere, in the same float arithmetic as Tracer::hitSphere
+static int bruteForceHit(const SceneData& scene, const Ray& r, float tmin, float tmax, float& closest) {
+	int hit = -1;
+	closest = tmax;
+	for (int i = 0; i < (int)scene.spheres.size(); i++) {
+		const SpheresBuffer& s = scene.spheres[i];
+		glm::vec3 oc = r.origin - s.position;
+		float a = glm::dot(r.direction, r.direction);
+		float halfb = glm::dot(oc, r.direction);
+		float len = glm::length(oc);
+		float radius = fabsf(s.radius);
+		float c = (len - radius) * (len + radius);
+		float discriminant = halfb * halfb - a * c;
+		if (discriminant < 0) continue;
+
+		float sqrtd = sqrtf(discriminant);
+		float t = (-halfb - sqrtd) / a;
+		if (t <= tmin || closest <= t) t = (-halfb + sqrtd) / a;
+		if (t <= tmin || closest <= t) continue;
+		closest = t;
+		hit = i;
+	}
+	return hit;
+}
+
+// spheres that touch or overlap can be hit at the same distance, either is right then
+static bool sameHit(bool hitA, const HitRecord& a, bool hitB, const HitRecord& b) {
+	if (hitA != hitB) return false;
+	if (!hitA || a.sphereIndex == b.sphereIndex) return true;
+	return fabsf(a.t - b.t) <= 1e-4f * std::max(1.0f, a.t);
+}
+
+static std::string describe(const std::string& scene, int ray, bool hit, const HitRecord& rec) {
+	char text[256];
+	if (hit) snprintf(text, sizeof(text), "%s ray %d hit sphere %d at %g", scene.c_str(), ray, rec.sphereIndex, rec.t);
+	else snprintf(text, sizeof(text), "%s ray %d missed", scene.c_str(), ray);
+	return text;
+}
+
+// the median tree's closest hits and shadow rays against testing every sphere
+static void testTracer() {
+	for (const auto& name : SceneLibrary::Names()) {
+		SceneData scene = SceneLibrary::Create(name, TESTS_SEED);
+		scene.CalculateBVHs(BVH_SPLIT_MEDIAN);
+		Tracer tracer(&scene.spheres, &scene.bvhs);
+
+		int count = (int)std::min<size_t>(TESTS_MAX_RAYS, TESTS_BRUTE_FORCE_TESTS / scene.spheres.size());
+		std::vector<Ray> rays = randomRays(scene, count, TESTS_SEED);
+		for (int i = 0; i < count; i++) {
+			HitRecord expected, rec;
+			float t;
+			expected.sphereIndex = bruteForceHit(scene, rays[i], 0.001f, INFINITY, t);
+			expected.t = t;
+			bool expectedHit = expected.sphereIndex >= 0;
+			bool hit = tracer.Hit(rays[i], 0.001f, INFINITY, rec);
+			check(sameHit(hit, rec, expectedHit, expected), "tracer", describe(name, i, hit, rec) + ", expected " + describe(name, i, expectedHit, expected));
+
+			// shadow rays to half way to the hit, and just past it
+			if (expectedHit) {
+				check(!tracer.Occluded(rays[i], 0.001f, t * 0.5f), "tracer", describe(name, i, true, expected) + " but is occluded half way");
+				check(tracer.Occluded(rays[i], 0.001f, t * 1.01f), "tracer", describe(name, i, true, expected) + " but isn't occluded past it");
+			}
+		}
+		printf("tracer: %s, %d rays\n", name.c_str(), count);
+	}
+}
+
+// every tree the renderers use finds the same hits as the median one
+static void testSplits() {
+	for (const auto& name : SceneLibrary::Names()) {
+		SceneData scene = SceneLibrary::Create(name, TESTS_SEED);
+		scene.CalculateBVHs(BVH_SPLIT_MEDIAN);
+		std::vector<BVHBuffer> sah = BVHBuilder(BVH_SPLIT_SAH, TESTS_SEED).Build(scene.spheres);
+		scene.CalculateClusters(BVH_SPLIT_SAH, TESTS_SEED);
+
+		Tracer median(&scene.spheres, &scene.bvhs);
+		Tracer others[] = { Tracer(&scene.spheres, &sah), Tracer(&scene.spheres, &scene.clusters, &scene.packedSpheres) };
+		const char* otherNames[] = { "sah", "clustered sah" };
+
+		std::vector<Ray> rays = randomRays(scene, TESTS_MAX_RAYS, TESTS_SEED + 1);
+		for (int i = 0; i < (int)rays.size(); i++) {
+			HitRecord expected;
+			bool expectedHit = median.Hit(rays[i], 0.001f, INFINITY, expected);
+			for (int j = 0; j < 2; j++) {
+				HitRecord rec;
+				bool hit = others[j].Hit(rays[i], 0.001f, INFINITY, rec);
+				check(sameHit(hit, rec, expectedHit, expected), "splits", std::string(otherNames[j]) + " " + describe(name, i, hit, rec) + ", median " + describe(name, i, expectedHit, expected));
+				if (expectedHit) {
+					check(others[j].Occluded(rays[i], 0.001f, expected.t * 1.01f), "splits", std::string(otherNames[j]) + " " + describe(name, i, true, expected) + " but isn't occluded past it");
+				}
+			}
+		}
+		printf("splits: %s, %d rays\n", name.c_str(), (int)rays.size());
+	}
+}
+
+// the first 2^m samples of a pixel are an owen scrambled sobol (0, m, 2) net, one point in every
+// elementary interval, moved round the torus by the pixel's blue noise. the move is unknown here,
+// but it keeps every box twice an interval's size holding at least one point, which random
+// points don't manage
+static void testSampler() {
+	BlueNoise noise(BLUE_NOISE_SIZE, TESTS_SEED);
+	const int m = 8, count = 1 << m;
+	const int pixels[][2] = { { 0, 0 }, { 17, 5 }, { 63, 40 } };
+	const int dimensions[] = { SAMPLER_DIM_PIXEL, SAMPLER_DIM_BSDF, SAMPLER_DIM_BSDF + SAMPLER_DIMS_PER_BOUNCE * 3 };
+
+	for (const auto& pixel : pixels) {
+		for (int dimension : dimensions) {
+			Sampler sampler(&noise, pixel[0], pixel[1], 0);
+			std::vector<glm::vec2> points(count);
+			for (int i = 0; i < count; i++) {
+				sampler.SetSampleIndex(i);
+				points[i] = sampler.Get2D(dimension);
+				check(points[i].x >= 0.0f && points[i].x < 1.0f && points[i].y >= 0.0f && points[i].y < 1.0f, "sampler", "sample out of [0, 1)");
+			}
+
+			// intervals of 1/2^a by 1/2^(m - a), boxes of twice that at every half interval step
+			for (int a = 0; a <= m; a++) {
+				int columns = 1 << a, rows = 1 << (m - a);
+				int empty = 0;
+				for (int bx = 0; bx < columns * 2; bx++) {
+					for (int by = 0; by < rows * 2; by++) {
+						float x0 = bx * 0.5f / columns, y0 = by * 0.5f / rows;
+						bool found = false;
+						for (const auto& p : points) {
+							float dx = p.x - x0, dy = p.y - y0;
+							dx -= floorf(dx);
+							dy -= floorf(dy);
+							if (dx < 2.0f / columns && dy < 2.0f / rows) {
+								found = true;
+								break;
+							}
+						}
+						if (!found) empty++;
+					}
+				}
+				char text[256];
+				snprintf(text, sizeof(text), "pixel %d %d dimension %d: %d empty boxes of %d by %d intervals", pixel[0], pixel[1], dimension, empty, columns, rows);
+				check(empty == 0, "sampler", text);
+			}
+		}
+	}
+	printf("sampler: %d pixels, %d dimensions, %d samples\n", (int)(sizeof(pixels) / sizeof(pixels[0])), (int)(sizeof(dimensions) / sizeof(dimensions[0])), count);
+}
+
+// copies the checkpoint file as it was after stopAfter tiles, from when the next tile starts
+class SnapshotBackend : public RenderBackend
+{
+public:
+	RenderBackend* backend;
+	int stopAfter;
+	int tiles = 0;
+	std::vector<char> snapshot;
+
+	SnapshotBackend(RenderBackend* backend, int stopAfter) : backend(backend), stopAfter(stopAfter) {};
+	void SetCamera(const CameraBuffer& camera) override { backend->SetCamera(camera); };
+	void RenderTile(const Tile& tile, int pass, RenderBuffers& buffers) override {
+		if (tiles++ == stopAfter) {
+			FILE* file = fopen(TESTS_CHECKPOINT_PATH, "rb");
+			if (file) {
+				fseek(file, 0, SEEK_END);
+				snapshot.resize(ftell(file));
+				fseek(file, 0, SEEK_SET);
+				if (fread(snapshot.data(), 1, snapshot.size(), file) != snapshot.size()) snapshot.clear();
+				fclose(file);
+			}
+		}
+		backend->RenderTile(tile, pass, buffers);
+	}
+};
+
+static bool sameBuffers(const RenderBuffers& a, const RenderBuffers& b) {
+	return a.width == b.width && a.height == b.height
+		&& a.colour.size() == b.colour.size() && memcmp(a.colour.data(), b.colour.data(), a.colour.size() * sizeof(float)) == 0
+		&& a.albedo.size() == b.albedo.size() && memcmp(a.albedo.data(), b.albedo.data(), a.albedo.size() * sizeof(float)) == 0
+		&& a.normal.size() == b.normal.size() && memcmp(a.normal.data(), b.normal.data(), a.normal.size() * sizeof(float)) == 0
+		&& a.depth.size() == b.depth.size() && memcmp(a.depth.data(), b.depth.data(), a.depth.size() * sizeof(float)) == 0;
+}
+
+// renders a frame straight through, saving a checkpoint after every tile and adaptive round, then
+// resumes a new renderer from the one there was when tile stopAfter started. the two frames have
+// to be the same to the bit
+static Checkpoint resumeFrame(bool adaptive, int stopAfter) {
+	const int width = 64, height = 36, samples = 8, passSamples = 2, tiles = 4, depth = 4;
+	SceneData scene = SceneLibrary::Create("balls", TESTS_SEED);
+	scene.CalculateClusters(BVH_SPLIT_SAH, TESTS_SEED);
+	BlueNoise noise(BLUE_NOISE_SIZE, TESTS_SEED);
+	CameraBuffer camera = scene.MakeCameraBuffer(glm::uvec2(width, height));
+
+	CpuRenderer renderer(scene, &noise, passSamples, depth);
+	SnapshotBackend snapshots(&renderer, stopAfter);
+	FrameRenderer straight(&snapshots, width, height, samples, passSamples, tiles);
+	straight.adaptive = adaptive;
+	straight.checkpointPath = TESTS_CHECKPOINT_PATH;
+	straight.checkpointInterval = 0.0;
+	RenderBuffers expected;
+	straight.Render(camera, expected, 0);
+	check(!snapshots.snapshot.empty(), "checkpoint", "no checkpoint was saved");
+
+	FILE* file = fopen(TESTS_CHECKPOINT_PATH, "wb");
+	fwrite(snapshots.snapshot.data(), 1, snapshots.snapshot.size(), file);
+	fclose(file);
+	Checkpoint resume;
+	bool loaded = resume.Load(TESTS_CHECKPOINT_PATH);
+	std::remove(TESTS_CHECKPOINT_PATH);
+	check(loaded, "checkpoint", "the checkpoint didn't load");
+	if (!loaded) return resume;
+
+	// a new renderer, nothing carried over but the file
+	CpuRenderer resumedRenderer(scene, &noise, passSamples, depth);
+	FrameRenderer resumed(&resumedRenderer, width, height, samples, passSamples, tiles);
+	resumed.adaptive = adaptive;
+	RenderBuffers result;
+	resumed.Render(camera, result, 0, &resume);
+	check(sameBuffers(result, expected), "checkpoint", "the resumed frame differs from the one rendered straight through");
+	check(resumed.getSampleCounts() == straight.getSampleCounts(), "checkpoint", "the resumed sample counts differ");
+	return resume;
+}
+
+static void testCheckpoint() {
+	// pass 1, before its third tile
+	Checkpoint resume = resumeFrame(false, 4 + 2);
+	check(resume.pass == 1 && resume.tile == 2, "checkpoint", "the checkpoint isn't at pass 1, tile 2");
+	printf("checkpoint: resumed at pass %d, tile %d\n", (int)resume.pass, (int)resume.tile);
+
+	// eight tiles of uniform passes, then rounds of at most two of the four blocks, so the twelfth
+	// tile is in the second round or later
+	resume = resumeFrame(true, 2 * 4 + 3);
+	int maxSamples = 0;
+	for (auto count : resume.sampleCounts) maxSamples = std::max(maxSamples, (int)count);
+	check(resume.pass == ADAPTIVE_MIN_PASSES && resume.tile == 0, "checkpoint", "the adaptive checkpoint isn't at the end of the uniform passes");
+	check(maxSamples > ADAPTIVE_MIN_PASSES * 2, "checkpoint", "the adaptive checkpoint is from before the first round");
+	printf("checkpoint: resumed adaptive rounds with up to %d samples\n", maxSamples);
+}
+
+int main(int argc, char** argv) {
+	struct Test {
+		const char* name;
+		void (*run)();
+	};
+	const Test tests[] = {
+		{ "tracer", testTracer },
+		{ "splits", testSplits },
+		{ "sampler", testSampler },
+		{ "checkpoint", testCheckpoint },
+	};
+
+	bool found = false;
+	for (const auto& test : tests) {
+		if (argc > 1 && strcmp(argv[1], test.name) != 0) continue;
+		found = true;
+		test.run();
+	}
+	if (!found) {
+		fprintf(stderr, "Unknown test %s\n", argv[1]);
+		return 1;
+	}
+
+	if (failures > 0) {
+		printf("%d checks failed\n", failures);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,319 @@
+#include "TextureStore.h"
+#include "Sampler.h"
+
+#include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#define TILE_FLOATS (TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE * 3)
+
+static bool seekPack(FILE* file, size_t offset) {
+#ifdef _WIN32
+	return _fseeki64(file, (long long)offset, SEEK_SET) == 0;
+#else
+	return fseeko(file, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+static float srgbToLinear(float c) {
+	return c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+}
+
+// the next header field of a ppm or pfm, skipping comments
+static std::string readToken(std::ifstream& in) {
+	std::string token;
+	while (in >> token) {
+		if (token[0] != '#') return token;
+		std::getline(in, token);
+	}
+	return "";
+}
+
+// rows bottom up, 3 floats a texel
+static void readImage(const std::string& path, bool linear, int& width, int& height, std::vector<float>& rgb) {
+	std::ifstream in(path, std::ios::in | std::ios::binary);
+	auto fail = [&](const char* message) {
+		fprintf(stderr, "Failed to read texture %s: %s\n", path.c_str(), message);
+		exit(1);
+	};
+	if (!in) fail("can't open it");
+
+	std::string magic = readToken(in);
+	if (magic != "P6" && magic != "PF") fail("only binary ppm (P6) and colour pfm (PF) are supported");
+	width = atoi(readToken(in).c_str());
+	height = atoi(readToken(in).c_str());
+	float scale = (float)atof(readToken(in).c_str());
+	in.get(); // the single whitespace before the data
+	if (width <= 0 || height <= 0 || scale == 0.0f) fail("bad header");
+
+	size_t count = (size_t)width * height * 3;
+	rgb.resize(count);
+	if (magic == "P6") {
+		if (scale > 255.0f) fail("16 bit ppms aren't supported");
+		std::vector<unsigned char> bytes(count);
+		if (!in.read((char*)bytes.data(), count)) fail("file is truncated");
+		// ppm rows go top down
+		for (int y = 0; y < height; y++) {
+			const unsigned char* row = &bytes[(size_t)(height - 1 - y) * width * 3];
+			for (int i = 0; i < width * 3; i++) {
+				float c = row[i] / scale;
+				rgb[(size_t)y * width * 3 + i] = linear ? c : srgbToLinear(c);
+			}
+		}
+	}
+	else {
+		if (!in.read((char*)rgb.data(), count * sizeof(float))) fail("file is truncated");
+		// a positive scale is big endian
+		if (scale > 0.0f) {
+			for (float& f : rgb) {
+				uint32_t u;
+				memcpy(&u, &f, 4);
+				u = (u >> 24) | ((u >> 8) & 0xff00) | ((u << 8) & 0xff0000) | (u << 24);
+				memcpy(&f, &u, 4);
+			}
+		}
+	}
+}
+
+TextureStore::TextureStore(size_t cacheTiles) {
+	shardCapacity = std::max((size_t)1, cacheTiles / TEXTURE_CACHE_SHARDS);
+	pack = std::tmpfile();
+}
+
+TextureStore::~TextureStore() {
+	if (pack) fclose(pack);
+}
+
+int TextureStore::Load(const std::string& path, bool linear) {
+	int width, height;
+	std::vector<float> rgb;
+	readImage(path, linear, width, height, rgb);
+
+	Image image;
+	addLevel(image, width, height, rgb);
+	// 2x2 box filter down to a single texel, an odd last row or column is dropped
+	while (width > 1 || height > 1) {
+		int w = std::max(1, width / 2), h = std::max(1, height / 2);
+		std::vector<float> next((size_t)w * h * 3);
+		for (int y = 0; y < h; y++) {
+			for (int x = 0; x < w; x++) {
+				int x0 = std::min(x * 2, width - 1), x1 = std::min(x * 2 + 1, width - 1);
+				int y0 = std::min(y * 2, height - 1), y1 = std::min(y * 2 + 1, height - 1);
+				for (int c = 0; c < 3; c++) {
+					next[((size_t)y * w + x) * 3 + c] = 0.25f * (rgb[((size_t)y0 * width + x0) * 3 + c] + rgb[((size_t)y0 * width + x1) * 3 + c]
+						+ rgb[((size_t)y1 * width + x0) * 3 + c] + rgb[((size_t)y1 * width + x1) * 3 + c]);
+				}
+			}
+		}
+		rgb.swap(next);
+		width = w;
+		height = h;
+		addLevel(image, width, height, rgb);
+	}
+
+	images.push_back(image);
+	return (int)images.size() - 1;
+}
+
+// cuts a level into tiles, the edge ones padded by clamping
+void TextureStore::addLevel(Image& image, int width, int height, const std::vector<float>& rgb) {
+	Level level;
+	level.width = width;
+	level.height = height;
+	level.tilesX = (width + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+	level.tilesY = (height + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+	level.firstTile = packTiles;
+
+	std::vector<float> texels(TILE_FLOATS);
+	for (int ty = 0; ty < level.tilesY; ty++) {
+		for (int tx = 0; tx < level.tilesX; tx++) {
+			for (int y = 0; y < TEXTURE_TILE_SIZE; y++) {
+				int sy = std::min(ty * TEXTURE_TILE_SIZE + y, height - 1);
+				for (int x = 0; x < TEXTURE_TILE_SIZE; x++) {
+					int sx = std::min(tx * TEXTURE_TILE_SIZE + x, width - 1);
+					memcpy(&texels[(y * TEXTURE_TILE_SIZE + x) * 3], &rgb[((size_t)sy * width + sx) * 3], 3 * sizeof(float));
+				}
+			}
+
+			if (pack) {
+				if (!seekPack(pack, packTiles * TILE_FLOATS * sizeof(float)) || fwrite(texels.data(), sizeof(float), TILE_FLOATS, pack) != TILE_FLOATS) {
+					fprintf(stderr, "Failed to write the texture pack file\n");
+					exit(1);
+				}
+			}
+			else {
+				resident.insert(resident.end(), texels.begin(), texels.end());
+			}
+			packTiles++;
+		}
+	}
+	image.levels.push_back(level);
+}
+
+const float* TextureStore::cachedTile(Shard& shard, size_t index) const {
+	auto it = shard.cache.find(index);
+	if (it != shard.cache.end()) {
+		shard.lru.splice(shard.lru.begin(), shard.lru, it->second.use);
+		return it->second.texels.data();
+	}
+
+	shard.misses++;
+	std::vector<float> texels;
+	if (shard.cache.size() >= shardCapacity) {
+		// reuse the evicted tile's memory
+		auto evicted = shard.cache.find(shard.lru.back());
+		texels.swap(evicted->second.texels);
+		shard.cache.erase(evicted);
+		shard.lru.pop_back();
+	}
+	texels.resize(TILE_FLOATS);
+	{
+		std::lock_guard<std::mutex> lock(packMutex);
+		if (!seekPack(pack, index * TILE_FLOATS * sizeof(float)) || fread(texels.data(), sizeof(float), TILE_FLOATS, pack) != TILE_FLOATS) {
+			fprintf(stderr, "Failed to read the texture pack file\n");
+			exit(1);
+		}
+	}
+
+	shard.lru.push_front(index);
+	CachedTile& cached = shard.cache[index];
+	cached.texels.swap(texels);
+	cached.use = shard.lru.begin();
+	return cached.texels.data();
+}
+
+glm::vec3 TextureStore::texel(const Level& level, int x, int y) const {
+	size_t index = level.firstTile + (size_t)(y / TEXTURE_TILE_SIZE) * level.tilesX + x / TEXTURE_TILE_SIZE;
+	size_t offset = ((y % TEXTURE_TILE_SIZE) * TEXTURE_TILE_SIZE + x % TEXTURE_TILE_SIZE) * 3;
+	if (!pack) {
+		const float* t = &resident[index * TILE_FLOATS + offset];
+		return glm::vec3(t[0], t[1], t[2]);
+	}
+
+	Shard& shard = shardOf(index);
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	const float* t = cachedTile(shard, index) + offset;
+	return glm::vec3(t[0], t[1], t[2]);
+}
+
+glm::vec3 TextureStore::bilinear(const Level& level, glm::vec2 uv) const {
+	float fx = (uv.x - floorf(uv.x)) * level.width - 0.5f;
+	float fy = (uv.y - floorf(uv.y)) * level.height - 0.5f;
+	int x0 = (int)floorf(fx), y0 = (int)floorf(fy);
+	fx -= x0;
+	fy -= y0;
+
+	glm::vec3 sum(0, 0, 0);
+	for (int j = 0; j < 2; j++) {
+		int y = (y0 + j + level.height) % level.height;
+		for (int i = 0; i < 2; i++) {
+			int x = (x0 + i + level.width) % level.width;
+			float w = (i ? fx : 1.0f - fx) * (j ? fy : 1.0f - fy);
+			sum += w * texel(level, x, y);
+		}
+	}
+	return sum;
+}
+
+glm::vec3 TextureStore::Sample(int image, glm::vec2 uv, float lod) const {
+	const std::vector<Level>& levels = images[image].levels;
+	lod = std::min(std::max(lod, 0.0f), (float)(levels.size() - 1));
+	int l0 = (int)lod;
+	int l1 = std::min(l0 + 1, (int)levels.size() - 1);
+	float f = lod - l0;
+
+	glm::vec3 c = bilinear(levels[l0], uv);
+	if (f > 0.0f) c = c * (1.0f - f) + bilinear(levels[l1], uv) * f;
+	return c;
+}
+
+void TextureStore::ReadLevel(int image, int level, std::vector<float>& rgb) const {
+	const Level& l = images[image].levels[level];
+	rgb.resize((size_t)l.width * l.height * 3);
+
+	for (int ty = 0; ty < l.tilesY; ty++) {
+		for (int tx = 0; tx < l.tilesX; tx++) {
+			size_t index = l.firstTile + (size_t)ty * l.tilesX + tx;
+			std::unique_lock<std::mutex> lock;
+			const float* t;
+			if (pack) {
+				Shard& shard = shardOf(index);
+				lock = std::unique_lock<std::mutex>(shard.mutex);
+				t = cachedTile(shard, index);
+			}
+			else {
+				t = &resident[index * TILE_FLOATS];
+			}
+			for (int y = ty * TEXTURE_TILE_SIZE; y < std::min((ty + 1) * TEXTURE_TILE_SIZE, l.height); y++) {
+				int x = tx * TEXTURE_TILE_SIZE;
+				int count = std::min(TEXTURE_TILE_SIZE, l.width - x);
+				memcpy(&rgb[((size_t)y * l.width + x) * 3], &t[(y % TEXTURE_TILE_SIZE) * TEXTURE_TILE_SIZE * 3], count * 3 * sizeof(float));
+			}
+		}
+	}
+}
+
+size_t TextureStore::getResidentTiles() const {
+	if (!pack) return packTiles;
+	size_t tiles = 0;
+	for (Shard& shard : shards) {
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		tiles += shard.cache.size();
+	}
+	return tiles;
+}
+
+unsigned long long TextureStore::getMisses() const {
+	unsigned long long misses = 0;
+	for (Shard& shard : shards) {
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		misses += shard.misses;
+	}
+	return misses;
+}
+
+// same lattice hash and smoothing as raytrace.frag's noise
+static float latticeValue(int x, int y, int z) {
+	uint32_t h = Sampler::Hash((uint32_t)x * 73856093u ^ (uint32_t)y * 19349663u ^ (uint32_t)z * 83492791u);
+	return (h >> 8) / 16777216.0f;
+}
+
+static float valueNoise(glm::vec3 p) {
+	glm::vec3 i = glm::floor(p);
+	glm::vec3 f = p - i;
+	f = f * f * (glm::vec3(3, 3, 3) - 2.0f * f);
+	int x = (int)i.x, y = (int)i.y, z = (int)i.z;
+
+	float c[2][2];
+	for (int dz = 0; dz < 2; dz++) {
+		for (int dy = 0; dy < 2; dy++) {
+			float a = latticeValue(x, y + dy, z + dz);
+			float b = latticeValue(x + 1, y + dy, z + dz);
+			c[dz][dy] = a + (b - a) * f.x;
+		}
+	}
+	float front = c[0][0] + (c[0][1] - c[0][0]) * f.y;
+	float back = c[1][0] + (c[1][1] - c[1][0]) * f.y;
+	return front + (back - front) * f.z;
+}
+
+glm::vec3 TextureStore::Procedural(const TextureBuffer& texture, glm::vec2 uv, glm::vec3 local) {
+	if (texture.type == TEXTURE_TYPE_CHECKER) {
+		// u goes round the equator, twice as far as v goes pole to pole
+		int cell = (int)floorf(uv.x * texture.scale * 2.0f) + (int)floorf(uv.y * texture.scale);
+		return (cell & 1) ? texture.colourB : texture.colourA;
+	}
+
+	glm::vec3 p = local * texture.scale;
+	float sum = 0.0f, total = 0.0f, amplitude = 0.5f;
+	for (int i = 0; i < TEXTURE_NOISE_OCTAVES; i++) {
+		sum += amplitude * valueNoise(p);
+		total += amplitude;
+		p *= 2.0f;
+		amplitude *= 0.5f;
+	}
+	float n = sum / total;
+	return texture.colourB + (texture.colourA - texture.colourB) * n;
+}
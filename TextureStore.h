@@ -0,0 +1,92 @@
+#pragma once
+
+#include "BuffersStructs.h"
+
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <cstdio>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+// texels per side of a tile, the unit the store pages in and out
+#define TEXTURE_TILE_SIZE 32
+// decoded tiles kept in memory, 12KB each so about 200MB
+#define TEXTURE_CACHE_TILES 16384
+// the cache is split by tile index into this many LRUs with their own locks, so render threads
+// sampling different tiles don't wait on each other
+#define TEXTURE_CACHE_SHARDS 64
+// octaves summed by TEXTURE_TYPE_NOISE
+#define TEXTURE_NOISE_OCTAVES 4
+
+// the CPU side of the image textures: every image is loaded once, mip mapped with a box filter
+// and written out tile by tile to a temporary pack file, mip after mip. lookups page tiles back in
+// through an LRU cache, so a texture set can be much bigger than what stays resident. without a
+// pack file every tile stays in memory and lookups don't lock at all.
+// uv (0, 0) is the bottom left of an image like in GL, and uvs wrap
+class TextureStore
+{
+public:
+	// cacheTiles is split evenly between the shards, at least one each
+	TextureStore(size_t cacheTiles = TEXTURE_CACHE_TILES);
+	~TextureStore();
+	TextureStore(const TextureStore&) = delete;
+	TextureStore& operator=(const TextureStore&) = delete;
+
+	// a binary ppm, decoded from sRGB unless linear, or a pfm. returns the image index, exits
+	// on a file it can't read
+	int Load(const std::string& path, bool linear = false);
+	// trilinear, lod in mip levels of this image
+	glm::vec3 Sample(int image, glm::vec2 uv, float lod) const;
+	// one whole mip level, bottom row first, for the GPU's texture array
+	void ReadLevel(int image, int level, std::vector<float>& rgb) const;
+
+	int getImageCount() const { return (int)images.size(); };
+	int getWidth(int image, int level = 0) const { return images[image].levels[level].width; };
+	int getHeight(int image, int level = 0) const { return images[image].levels[level].height; };
+	int getLevelCount(int image) const { return (int)images[image].levels.size(); };
+	size_t getResidentTiles() const;
+	unsigned long long getMisses() const;
+
+	// checker and noise patterns, over the uv and the hit point relative to the sphere's centre
+	static glm::vec3 Procedural(const TextureBuffer& texture, glm::vec2 uv, glm::vec3 local);
+private:
+	struct Level {
+		int width, height;
+		int tilesX, tilesY;
+		size_t firstTile; // in the pack
+	};
+	struct Image {
+		std::vector<Level> levels;
+	};
+	struct CachedTile {
+		std::vector<float> texels;
+		std::list<size_t>::iterator use;
+	};
+	struct Shard {
+		std::mutex mutex;
+		std::list<size_t> lru; // most recently used first
+		std::unordered_map<size_t, CachedTile> cache;
+		unsigned long long misses = 0;
+	};
+
+	std::vector<Image> images;
+	FILE* pack = nullptr;
+	size_t packTiles = 0;
+	// every tile, when there's no temporary file to page to
+	std::vector<float> resident;
+
+	size_t shardCapacity;
+	mutable Shard shards[TEXTURE_CACHE_SHARDS];
+	// the pack's file position is shared by every shard's reads
+	mutable std::mutex packMutex;
+
+	void addLevel(Image& image, int width, int height, const std::vector<float>& rgb);
+	Shard& shardOf(size_t tile) const { return shards[tile % TEXTURE_CACHE_SHARDS]; };
+	// the caller holds the shard's mutex, the pointer is good until it lets go
+	const float* cachedTile(Shard& shard, size_t index) const;
+	glm::vec3 texel(const Level& level, int x, int y) const;
+	glm::vec3 bilinear(const Level& level, glm::vec2 uv) const;
+};
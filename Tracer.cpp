@@ -0,0 +1,132 @@
+#include "Tracer.h"
+#include "SphereStore.h"
+
+#include <algorithm>
+#include <cmath>
+
+#define TRACER_PI 3.14159265359f
+
+Tracer::Tracer(const std::vector<SpheresBuffer>* spheres, const std::vector<BVHBuffer>* bvhs, const SphereStore* store) {
+	this->spheres = spheres;
+	this->bvhs = bvhs;
+	this->store = store;
+}
+
+// closest hit, the normal is only worked out once for the final sphere
+bool Tracer::Hit(const Ray& r, float tmin, float tmax, HitRecord& rec) const {
+	int nodeIndexStack[TRACER_STACK_SIZE];
+	int stackPtr = 0;
+	nodeIndexStack[stackPtr++] = 0;
+
+	glm::vec3 invD = 1.0f / r.direction;
+	float closestSoFar = tmax;
+	int closestSphere = -1;
+
+	while (stackPtr > 0) {
+		const BVHBuffer& node = (*bvhs)[nodeIndexStack[--stackPtr]];
+
+		if (!hitAABB(node, r, invD, tmin, closestSoFar)) continue;
+
+		if (node.type == BVH_TYPE_SPHERE) {
+			float t;
+			if (hitSphere(node.left_index, r, tmin, closestSoFar, t)) {
+				closestSoFar = t;
+				closestSphere = node.left_index;
+			}
+		}
+		else if (node.type == BVH_TYPE_CLUSTER) {
+			int slot = store->Hit(node.left_index, node.right_index, r, tmin, closestSoFar);
+			if (slot >= 0) closestSphere = store->sphereIndex[slot];
+		}
+		else {
+			nodeIndexStack[stackPtr++] = node.left_index;
+			nodeIndexStack[stackPtr++] = node.right_index;
+		}
+	}
+
+	if (closestSphere < 0) return false;
+
+	const SpheresBuffer& sphere = (*spheres)[closestSphere];
+	rec.t = closestSoFar;
+	rec.p = r.pointAt(rec.t);
+	rec.sphereIndex = closestSphere;
+	glm::vec3 normal = (rec.p - sphere.position) / sphere.radius;
+	rec.frontFace = glm::dot(r.direction, normal) < 0;
+	rec.normal = rec.frontFace ? normal : -normal;
+	return true;
+}
+
+glm::vec2 Tracer::SphereUV(glm::vec3 d) {
+	float u = (atan2f(-d.z, d.x) + TRACER_PI) / (2.0f * TRACER_PI);
+	float v = acosf(std::min(std::max(-d.y, -1.0f), 1.0f)) / TRACER_PI;
+	return glm::vec2(u, v);
+}
+
+// any hit, returns on the first sphere found between tmin and tmax
+bool Tracer::Occluded(const Ray& r, float tmin, float tmax) const {
+	int nodeIndexStack[TRACER_STACK_SIZE];
+	int stackPtr = 0;
+	nodeIndexStack[stackPtr++] = 0;
+
+	glm::vec3 invD = 1.0f / r.direction;
+
+	while (stackPtr > 0) {
+		const BVHBuffer& node = (*bvhs)[nodeIndexStack[--stackPtr]];
+
+		if (!hitAABB(node, r, invD, tmin, tmax)) continue;
+
+		if (node.type == BVH_TYPE_SPHERE) {
+			float t;
+			if (hitSphere(node.left_index, r, tmin, tmax, t)) {
+				return true;
+			}
+		}
+		else if (node.type == BVH_TYPE_CLUSTER) {
+			if (store->Occluded(node.left_index, node.right_index, r, tmin, tmax)) return true;
+		}
+		else {
+			nodeIndexStack[stackPtr++] = node.left_index;
+			nodeIndexStack[stackPtr++] = node.right_index;
+		}
+	}
+
+	return false;
+}
+
+bool Tracer::hitSphere(int sphereIndex, const Ray& r, float tmin, float tmax, float& t) const {
+	const SpheresBuffer& sphere = (*spheres)[sphereIndex];
+
+	glm::vec3 oc = r.origin - sphere.position;
+	float a = glm::dot(r.direction, r.direction);
+	float halfb = glm::dot(oc, r.direction);
+	// |oc|^2 - r^2 cancels to nothing near the surface of a big sphere, the factored form keeps the digits
+	float len = glm::length(oc);
+	float radius = fabsf(sphere.radius);
+	float c = (len - radius) * (len + radius);
+	float discriminent = halfb * halfb - a * c;
+
+	if (discriminent < 0) return false;
+
+	float sqrtd = sqrtf(discriminent);
+
+	t = (-halfb - sqrtd) / a;
+	if (t <= tmin || tmax <= t) {
+		t = (-halfb + sqrtd) / a;
+		if (t <= tmin || tmax <= t) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool Tracer::hitAABB(const BVHBuffer& node, const Ray& r, const glm::vec3& invD, float tmin, float tmax) const {
+	for (int axis = 0; axis < 3; axis++) {
+		float t0 = (node.AABBmin[axis] - r.origin[axis]) * invD[axis];
+		float t1 = (node.AABBmax[axis] - r.origin[axis]) * invD[axis];
+		if (invD[axis] < 0.0f) std::swap(t0, t1);
+		tmin = t0 > tmin ? t0 : tmin;
+		tmax = t1 < tmax ? t1 : tmax;
+		if (tmax <= tmin) return false;
+	}
+	return true;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "BuffersStructs.h"
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#define TRACER_STACK_SIZE 64
+
+class SphereStore;
+
+struct Ray {
+	glm::vec3 origin;
+	glm::vec3 direction;
+
+	Ray() {};
+	Ray(glm::vec3 _origin, glm::vec3 _direction) {
+		origin = _origin;
+		direction = _direction;
+	}
+
+	glm::vec3 pointAt(float t) const {
+		return origin + direction * t;
+	}
+};
+
+// the material isn't part of the hit, look it up through sphereIndex once the closest one is known
+struct HitRecord {
+	glm::vec3 normal;
+	glm::vec3 p;
+	float t;
+	bool frontFace;
+	int sphereIndex;
+};
+
+// CPU side of the ray queries in raytrace.frag, walking the same flattened bvh. a tree with
+// BVH_TYPE_CLUSTER leaves needs the SphereStore they were packed into
+class Tracer
+{
+public:
+	Tracer() {};
+	Tracer(const std::vector<SpheresBuffer>* spheres, const std::vector<BVHBuffer>* bvhs, const SphereStore* store = nullptr);
+	bool Hit(const Ray& r, float tmin, float tmax, HitRecord& rec) const;
+	bool Occluded(const Ray& r, float tmin, float tmax) const;
+	// texture coordinates of a point on a unit sphere: u once round y from -x, v from the bottom
+	// pole to the top, the same as raytrace.frag's sphereUV
+	static glm::vec2 SphereUV(glm::vec3 d);
+private:
+	const std::vector<SpheresBuffer>* spheres = nullptr;
+	const std::vector<BVHBuffer>* bvhs = nullptr;
+	const SphereStore* store = nullptr;
+
+	bool hitSphere(int sphereIndex, const Ray& r, float tmin, float tmax, float& t) const;
+	bool hitAABB(const BVHBuffer& node, const Ray& r, const glm::vec3& invD, float tmin, float tmax) const;
+};
@@ -2,27 +2,13 @@
 
 #include <string>
 #include <iostream>
+#include <fstream>
 #include <glm/glm.hpp>
-#include <GLFW/glfw3.h>
 
 enum Direction {
 	UP, DOWN, FOWARD, BACKWARD, LEFT, RIGHT
 };
 
-static void checkGlErrors(std::string desc)
-{
-	GLenum e = glGetError();
-	if (e != GL_NO_ERROR) {
-		fprintf(stderr, "OpenGL error in \"%s\": (%d)\n", desc.c_str(), e);
-		exit(20);
-	}
-}
-
-static void glErrorCallback(int code, const char* desc) {
-	std::cout << "OpenGL error: " << desc << "\n(Code " << code << ")\n";
-	exit(20);
-}
-
 static void printVec3(glm::vec3 v) {
 	std::cout << "(" << v.x << ", " << v.y << ", " << v.z << ")\n";
 }
@@ -54,4 +40,31 @@ static int randomInt(int start, int end) {
 
 static glm::vec3 randomVec3() {
 	return glm::vec3(randomFloat(), randomFloat(), randomFloat());
-}
\ No newline at end of file
+}
+
+// pixels are 8 bit rgb with rows bottom to top, as read back from opengl
+static void writePPM(const char* path, int width, int height, const unsigned char* pixels) {
+	std::fstream output_image(path, std::ios::out | std::ios::trunc);
+	output_image << "P3\n"
+		<< width << " " << height << "\n"
+		<< "255\n";
+
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			int pos = (x + (height - y - 1) * width) * 3;
+			output_image << (unsigned int)pixels[pos] << " " << (unsigned int)pixels[pos + 1] << " " << (unsigned int)pixels[pos + 2] << " ";
+		}
+		output_image << "\n";
+	}
+
+	output_image.close();
+}
+// linear float rgb, rows bottom to top which is also pfm's order. the negative scale marks little endian
+static void writePFM(const char* path, int width, int height, const float* pixels) {
+	std::fstream output_image(path, std::ios::out | std::ios::trunc | std::ios::binary);
+	output_image << "PF\n"
+		<< width << " " << height << "\n"
+		<< "-1.0\n";
+	output_image.write((const char*)pixels, (std::streamsize)width * height * 3 * sizeof(float));
+	output_image.close();
+}
@@ -0,0 +1,123 @@
+#version 460 core
+
+// the a-trous filter in Denoiser.cpp, one stage per draw with ping-ponged targets.
+// rgb holds the demodulated colour and a holds its luminance variance between passes
+
+in vec2 UV;
+
+layout(location = 0) out vec4 FragColor;
+
+struct Camera {
+    vec3 position;
+    vec3 viewportTopLeft;
+    vec3 du; // viewport vectors
+    vec3 dv;
+    vec3 backgroundColour;
+    vec2 screenRes;
+};
+
+// only for the render size, the targets can be bigger when the viewer renders at a lower scale
+layout (std140, binding = 0) uniform cameraBuffer {
+    Camera camera;
+};
+
+layout(binding = 0) uniform sampler2D colourTexture;
+layout(binding = 2) uniform sampler2D albedoTexture;
+layout(binding = 3) uniform sampler2D normalTexture;
+layout(binding = 4) uniform sampler2D depthTexture;
+
+#define STAGE_RESIDUAL 0
+#define STAGE_VARIANCE 1
+#define STAGE_FILTER 2
+
+// the first two stages demodulate and estimate the noise variance, then every filter
+// stage is one a-trous level at stepWidth
+uniform int stage;
+uniform int stepWidth;
+// set on the last pass to multiply the albedo back in
+uniform int remodulate;
+
+uniform float colourPhi;
+uniform float normalPhi;
+uniform float depthPhi;
+uniform float albedoPhi;
+
+#define ALBEDO_EPSILON 0.01
+#define VARIANCE_RADIUS 3
+
+const float kernel[5] = float[5](1.0 / 16.0, 1.0 / 4.0, 3.0 / 8.0, 1.0 / 4.0, 1.0 / 16.0);
+
+float luminance(vec3 c) {
+    return dot(c, vec3(0.2126, 0.7152, 0.0722));
+}
+
+vec3 demodulated(ivec2 p) {
+    return texelFetch(colourTexture, p, 0).rgb / max(texelFetch(albedoTexture, p, 0).rgb, vec3(ALBEDO_EPSILON));
+}
+
+void main() {
+    ivec2 size = ivec2(camera.screenRes);
+    ivec2 p = ivec2(gl_FragCoord.xy);
+
+    if (stage == STAGE_RESIDUAL) {
+        // squared difference from the 3x3 mean, scaled by 9/8 so it estimates the pixel variance for independent noise
+        vec3 colour = demodulated(p);
+        float mean = 0.0;
+        for (int j = -1; j <= 1; j++) {
+            for (int i = -1; i <= 1; i++) {
+                mean += luminance(demodulated(clamp(p + ivec2(i, j), ivec2(0), size - 1)));
+            }
+        }
+        float d = luminance(colour) - mean / 9.0;
+        FragColor = vec4(colour, d * d * (9.0 / 8.0));
+        return;
+    }
+
+    if (stage == STAGE_VARIANCE) {
+        float sum = 0.0, count = 0.0;
+        for (int j = -VARIANCE_RADIUS; j <= VARIANCE_RADIUS; j++) {
+            for (int i = -VARIANCE_RADIUS; i <= VARIANCE_RADIUS; i++) {
+                ivec2 q = p + ivec2(i, j);
+                if (any(lessThan(q, ivec2(0))) || any(greaterThanEqual(q, size))) continue;
+                sum += texelFetch(colourTexture, q, 0).a;
+                count += 1.0;
+            }
+        }
+        FragColor = vec4(texelFetch(colourTexture, p, 0).rgb, sum / count);
+        return;
+    }
+
+    vec4 centre = texelFetch(colourTexture, p, 0);
+    float lp = luminance(centre.rgb);
+    float invSigma = 1.0 / (colourPhi * sqrt(centre.a) + 1e-4);
+    vec3 pAlbedo = texelFetch(albedoTexture, p, 0).rgb;
+    vec3 pNormal = texelFetch(normalTexture, p, 0).rgb;
+    float pDepth = texelFetch(depthTexture, p, 0).r;
+
+    vec3 sumColour = vec3(0.0);
+    float sumVariance = 0.0;
+    float sumWeight = 0.0;
+    for (int j = -2; j <= 2; j++) {
+        for (int i = -2; i <= 2; i++) {
+            ivec2 q = clamp(p + ivec2(i, j) * stepWidth, ivec2(0), size - 1);
+            vec4 c = texelFetch(colourTexture, q, 0);
+            vec3 da = pAlbedo - texelFetch(albedoTexture, q, 0).rgb;
+            float nDot = dot(pNormal, texelFetch(normalTexture, q, 0).rgb);
+            float dz = abs(pDepth - texelFetch(depthTexture, q, 0).r);
+
+            float e = abs(lp - luminance(c.rgb)) * invSigma
+                + dot(da, da) / albedoPhi
+                + (1.0 - nDot) * normalPhi
+                + dz / (depthPhi * pDepth * stepWidth + 1e-4);
+            float w = kernel[i + 2] * kernel[j + 2] * exp(-e);
+
+            sumColour += c.rgb * w;
+            sumVariance += c.a * w * w;
+            sumWeight += w;
+        }
+    }
+
+    vec3 colour = sumColour / sumWeight;
+    if (remodulate != 0) colour *= max(pAlbedo, vec3(ALBEDO_EPSILON));
+    FragColor = vec4(colour, sumVariance / (sumWeight * sumWeight));
+}
@@ -1,20 +1,41 @@
 #version 460 core
 
-layout(location = 0) out vec3 FragColor;
+// linear colour, then first hit features for the denoiser
+layout(location = 0) out vec4 FragColor;
+layout(location = 1) out vec4 FragAlbedo;
+layout(location = 2) out vec4 FragNormal;
+layout(location = 3) out float FragDepth;
 
 #define INFINITY 2147483646
 #define VERYSMALL 0.00000001
+#define PI 3.14159265359
 
 #define BVH_TYPE_BVH 0
 #define BVH_TYPE_SPHERE 1
 
+#define TEXTURE_NONE -1
+#define TEXTURE_TYPE_IMAGE 0
+#define TEXTURE_TYPE_CHECKER 1
+#define TEXTURE_TYPE_NOISE 2
+#define TEXTURE_NOISE_OCTAVES 4
+
+#define SKY_DEPTH 10000.0
+
 // Stuff sent from the CPU: -------------------------------------------------------------------
 
 #define SPHERE_COUNT 1//{SPHERE_COUNT}
+#define MATERIAL_COUNT 1//{MATERIAL_COUNT}
 #define BVH_COUNT 1//{BVH_COUNT}
+#define LIGHT_COUNT 1//{LIGHT_COUNT}
+#define TEXTURE_COUNT 1//{TEXTURE_COUNT}
 
 #define SAMPLES 1//{SAMPLES}
 #define MAX_BOUNCES 1//{MAX_BOUNCES}
+#define RR_MIN_DEPTH 1//{RR_MIN_DEPTH}
+
+// Scene features (FEATURE_LAMBERTIAN, FEATURE_SPECULAR, FEATURE_REFRACTIVE, FEATURE_EMITTER, FEATURE_BVH,
+// FEATURE_TEXTURES)
+// are defined straight after the #version line by ShaderCache, one set per variant
 
 struct Camera {
     vec3 position;
@@ -30,6 +51,19 @@ struct Material {
     float reflective;
     float refractive;
     bool emitter;
+    int albedoTexture; // textures[] or TEXTURE_NONE
+    int roughnessTexture;
+    int normalTexture;
+};
+
+struct Texture {
+    vec3 colourA;
+    float scale;
+    vec3 colourB;
+    int type;
+    int image; // layer of textureArray
+    int width;
+    int height;
 };
 
 struct BVHnode {
@@ -41,11 +75,17 @@ struct BVHnode {
 };
 
 struct Sphere {
-    Material material;
     vec3 position;
     float radius;
 };
 
+struct Light {
+    vec3 position;
+    float radius;
+    vec3 emission;
+    int sphereIndex;
+};
+
 layout (std140) uniform cameraBuffer {
     Camera camera;
 };
@@ -54,13 +94,77 @@ layout (std140) uniform spheresBuffer {
     Sphere spheres[SPHERE_COUNT];
 };
 
+// deduplicated, only read once per bounce for the closest hit
+layout (std140) uniform materialsBuffer {
+    Material materials[MATERIAL_COUNT];
+};
+
+// each sphere's index into materials, four to an ivec4 as std140 pads an int array to 16 bytes
+layout (std140) uniform sphereMaterialsBuffer {
+    ivec4 sphereMaterials[(SPHERE_COUNT + 3) / 4];
+};
+
 layout (std140) uniform bvhsBuffer {
     BVHnode bvhs[BVH_COUNT];
 };
 
-// Random float generation --------------------------------------------------------------------
-// https://stackoverflow.com/a/17479300
+layout (std140) uniform lightsBuffer {
+    Light lights[LIGHT_COUNT];
+};
+
+// declared without FEATURE_TEXTURES too so every variant has the same blocks, a scene without
+// textures gets a single unused one
+layout (std140) uniform texturesBuffer {
+    Texture textures[TEXTURE_COUNT];
+};
+
+// every image texture resampled to one size, see Scene::createTextureArray
+layout (binding = 7) uniform sampler2DArray textureArray;
+
+// summed per fragment, read back and cleared by Scene::CollectPathStats. path and segment counts
+// are only compiled in with PATH_STATS (Scene's pathStats), the rest with TRACE_STATS
+layout (std430, binding = 0) buffer statsBuffer {
+    uint pathCount;
+    uint segmentCount;
+    uint rayCount;
+    uint nodeVisits;
+    uint primitiveTests;
+};
+
+// traversal counters, only compiled in when the scene asks for them (Scene's traceStats)
+#ifdef TRACE_STATS
+#define STAT(x) x
+#else
+#define STAT(x)
+#endif
+uint statRays = 0u;
+uint statNodeVisits = 0u;
+uint statPrimitiveTests = 0u;
+
+// Sampling -----------------------------------------------------------------------------------
+// owen scrambled sobol points, shifted per pixel by a blue noise tile (see Sampler.cpp)
+
+#define BLUE_NOISE_SIZE 64
+
+// sample dimensions, bounce n uses n * DIMS_PER_BOUNCE + DIM_BSDF etc.
+#define DIM_PIXEL 0
+#define DIMS_PER_BOUNCE 4
+#define DIM_BSDF 1
+#define DIM_CHOICE 2
+#define DIM_LIGHT 3
+#define DIM_RR 4
+
+layout (binding = 1) uniform sampler2D blueNoise;
+
+// frames the viewer accumulates carry on along the sequence instead of repeating its first samples
+uniform int frameIndex;
+// trace only the pixels where (x + y + frameIndex) is even, the rest just get their first hit features
+uniform int checkerboard;
 
+ivec2 pixel = ivec2(gl_FragCoord.xy);
+uint sampleIndex = 0u;
+
+// https://stackoverflow.com/a/17479300
 uint hash (uint x) {
     x += (x << 10u);
     x ^= (x >> 6u);
@@ -70,34 +174,51 @@ uint hash (uint x) {
     return x;
 }
 
-// create a seed based on pixel coordinate
-// TODO: also change each render
-float seed = gl_FragCoord.x + (gl_FragCoord.y * camera.screenRes.x);
-// float seed = 0.01;
+// second sobol dimension, the first is just bitfieldReverse
+uint sobol1(uint i) {
+    uint r = 0u;
+    for (uint v = 1u << 31; i != 0u; i >>= 1, v ^= v >> 1) {
+        if ((i & 1u) != 0u) r ^= v;
+    }
+    return r;
+}
 
-float floatConstruct( uint m ) {
-    const uint ieeeMantissa = 0x007FFFFFu; // binary32 mantissa bitmask
-    const uint ieeeOne      = 0x3F800000u; // 1.0 in IEEE binary32
+// https://psychopath.io/post/2021_01_30_building_a_better_lk_hash
+uint laineKarras(uint x, uint seed) {
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
 
-    m &= ieeeMantissa;                     // Keep only mantissa bits (fractional part)
-    m |= ieeeOne;                          // Add fractional part to 1.0
+uint owenScramble(uint x, uint seed) {
+    return bitfieldReverse(laineKarras(bitfieldReverse(x), seed));
+}
 
-    float  f = uintBitsToFloat( m );       // Range [1:2]
-    return f - 1.0;                        // Range [0:1]
+float toUnitFloat(uint x) {
+    return float(x >> 8) * (1.0 / 16777216.0);
 }
 
-float random() {
-    float v = floatConstruct(hash(floatBitsToUint(seed)));
-    seed = v;
-    return v;
+float blueNoiseShift(uint seed) {
+    ivec2 offset = ivec2(seed & 63u, (seed >> 8) & 63u);
+    return texelFetch(blueNoise, (pixel + offset) & (BLUE_NOISE_SIZE - 1), 0).r;
 }
 
-float randomRange(float a, float b) {
-    return a + random() * (b - a);
+vec2 sample2D(int dimension) {
+    uint seed = hash(uint(dimension) * 0x9E3779B9u + 1u);
+    uint seed2 = hash(seed);
+
+    // shuffling the index per dimension keeps dimensions from being correlated
+    uint index = owenScramble(sampleIndex, hash(seed2));
+
+    vec2 u = vec2(toUnitFloat(owenScramble(bitfieldReverse(index), seed)), toUnitFloat(owenScramble(sobol1(index), seed2)));
+    return fract(u + vec2(blueNoiseShift(seed), blueNoiseShift(seed2)));
 }
 
-vec3 randomVec3(float a, float b) {
-    return vec3(randomRange(a, b), randomRange(a, b), randomRange(a, b));
+float sample1D(int dimension) {
+    return sample2D(dimension).x;
 }
 
 // Ray tracing --------------------------------------------------------------------------------
@@ -109,7 +230,7 @@ struct HitRecord {
     vec3 p;
     float t;
     bool front_face;
-    Material material;
+    int sphereIndex;
 };
 
 struct Ray {
@@ -130,26 +251,20 @@ float magnitudeSquared(vec3 v) {
     return v.x * v.x + v.y * v.y + v.z * v.z;
 }
 
-vec3 randomUnitSphere() {
-    while (true) {
-        vec3 p = randomVec3(-1.0, 1.0);
-        if (magnitudeSquared(p) < 1) {
-            return p;
-        }
-    }
+vec3 uniformSphere(vec2 u) {
+    float z = 1.0 - 2.0 * u.x;
+    float r = sqrt(max(0.0, 1.0 - z * z));
+    float phi = 2.0 * PI * u.y;
+    return vec3(r * cos(phi), r * sin(phi), z);
 }
 
-vec3 randomUnitVec3() {
-    return normalize(randomUnitSphere());
-}
+vec3 cosineHemisphere(vec3 normal, vec2 u) {
+    float r = sqrt(u.x);
+    float phi = 2.0 * PI * u.y;
 
-vec3 randomHemisphereVec3(vec3 normal) {
-    vec3 onSphere = randomUnitVec3();
-    if (dot(onSphere, normal) > 0.0) {
-        return onSphere;
-    } else {
-        return -onSphere;
-    }
+    vec3 t = normalize(cross(abs(normal.x) > 0.9 ? vec3(0, 1, 0) : vec3(1, 0, 0), normal));
+    vec3 b = cross(normal, t);
+    return t * (r * cos(phi)) + b * (r * sin(phi)) + normal * sqrt(max(0.0, 1.0 - u.x));
 }
 
 bool nearZero(vec3 v) {
@@ -169,13 +284,21 @@ float reflectance(float cosine, float refIndex) {
     return r0 + (1 - r0) * pow((1 - cosine), 5);
 }
 
+int sphereMaterial(int sphereIndex) {
+    return sphereMaterials[sphereIndex >> 2][sphereIndex & 3];
+}
+
 bool hitSphere(int sphereIndex, Ray r, float tmin, float tmax, inout HitRecord rec) {
+    STAT(statPrimitiveTests++);
     Sphere sphere = spheres[sphereIndex];
 
     vec3 oc = r.origin - sphere.position;
     float a = magnitudeSquared(r.direction);
     float halfb = dot(oc, r.direction);
-    float c = magnitudeSquared(oc) - sphere.radius * sphere.radius;
+    // factored so it keeps its digits near the surface of a big sphere
+    float len = length(oc);
+    float radius = abs(sphere.radius);
+    float c = (len - radius) * (len + radius);
     float discriminent = halfb * halfb - a * c;
     
     if (discriminent < 0) return false;
@@ -194,7 +317,7 @@ bool hitSphere(int sphereIndex, Ray r, float tmin, float tmax, inout HitRecord r
     rec.p = pointAt(r, rec.t);
     vec3 normal = (rec.p - sphere.position) / sphere.radius;
     setHitRecordNormal(rec, r, normal);
-    rec.material = sphere.material;
+    rec.sphereIndex = sphereIndex;
 
     return true;
 };
@@ -283,6 +406,7 @@ bool hitWorldFast(Ray r, float tmin, float tmax, inout HitRecord rec) {
     while (stackPtr > 0) {
 		int nodeIndex = nodeIndexStack[--stackPtr];
 		BVHnode node = bvhs[nodeIndex];
+		STAT(statNodeVisits++);
 
 		if (hitAABB(nodeIndex, r, tmin, closestSoFar)) {
 			if (node.type == BVH_TYPE_SPHERE) {
@@ -302,66 +426,347 @@ bool hitWorldFast(Ray r, float tmin, float tmax, inout HitRecord rec) {
     return hitSomething;
 }
 
-vec3 getRayColour(in Ray ray) {
-    vec3 colour = vec3(1, 1, 1);
+// yes/no sphere test for shadow rays, skips building the hit record
+bool hitSphereAny(int sphereIndex, Ray r, float tmin, float tmax) {
+    STAT(statPrimitiveTests++);
+    vec3 position = spheres[sphereIndex].position;
+    float radius = spheres[sphereIndex].radius;
+
+    vec3 oc = r.origin - position;
+    float a = magnitudeSquared(r.direction);
+    float halfb = dot(oc, r.direction);
+    float len = length(oc);
+    float c = (len - abs(radius)) * (len + abs(radius));
+    float discriminent = halfb * halfb - a * c;
+
+    if (discriminent < 0) return false;
+
+    float sqrtd = sqrt(discriminent);
+    float root = (-halfb - sqrtd) / a;
+    if (root <= tmin || tmax <= root) {
+        root = (-halfb + sqrtd) / a;
+        return tmin < root && root < tmax;
+    }
+    return true;
+}
+
+// any-hit traversal, returns as soon as anything blocks the ray
+bool occludedWorldFast(Ray r, float tmin, float tmax) {
+    int stackPtr = 0;
+    nodeIndexStack[stackPtr++] = 0;
+
+    while (stackPtr > 0) {
+        int nodeIndex = nodeIndexStack[--stackPtr];
+        BVHnode node = bvhs[nodeIndex];
+        STAT(statNodeVisits++);
+
+        if (hitAABB(nodeIndex, r, tmin, tmax)) {
+            if (node.type == BVH_TYPE_SPHERE) {
+                if (hitSphereAny(node.left_index, r, tmin, tmax)) {
+                    return true;
+                }
+            }
+            else {
+                nodeIndexStack[stackPtr++] = node.left_index;
+                nodeIndexStack[stackPtr++] = node.right_index;
+            }
+        }
+    }
+
+    return false;
+}
+
+bool occludedWorld(Ray r, float tmin, float tmax) {
+    for (int i = 0; i < SPHERE_COUNT; i++) {
+        if (hitSphereAny(i, r, tmin, tmax)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool occludedScene(Ray r, float tmin, float tmax) {
+    STAT(statRays++);
+#ifdef FEATURE_BVH
+    return occludedWorldFast(r, tmin, tmax);
+#else
+    return occludedWorld(r, tmin, tmax);
+#endif
+}
+
+bool hitScene(Ray r, float tmin, float tmax, inout HitRecord rec) {
+    STAT(statRays++);
+#ifdef FEATURE_BVH
+    return hitWorldFast(r, tmin, tmax, rec);
+#else
+    return hitWorld(r, tmin, tmax, rec);
+#endif
+}
+
+// Light sampling -----------------------------------------------------------------------------
+
+// solid angle pdf of sampling the cone subtended by a spherical light, 0 from inside it
+float lightPdf(vec3 p, vec3 centre, float radius) {
+    float sin2ThetaMax = radius * radius / magnitudeSquared(centre - p);
+    if (sin2ThetaMax >= 1.0) return 0.0;
+    float cosThetaMax = sqrt(1.0 - sin2ThetaMax);
+    return 1.0 / (2.0 * PI * (1.0 - cosThetaMax) * LIGHT_COUNT);
+}
+
+float powerHeuristic(float pdfA, float pdfB) {
+    float a2 = pdfA * pdfA;
+    float b2 = pdfB * pdfB;
+    return a2 / (a2 + b2);
+}
+
+// next event estimation from a lambertian surface: pick a light, sample its cone,
+// trace a shadow ray and weight against the cosine lobe with MIS
+vec3 sampleLights(vec3 p, vec3 normal, vec3 albedo, int dimension) {
+    Light light = lights[min(int(sample1D(dimension + DIM_CHOICE) * LIGHT_COUNT), LIGHT_COUNT - 1)];
+    if (light.radius <= 0.0) return vec3(0, 0, 0);
+
+    vec3 toCentre = light.position - p;
+    float dist2 = magnitudeSquared(toCentre);
+    float sin2ThetaMax = light.radius * light.radius / dist2;
+    if (sin2ThetaMax >= 1.0) return vec3(0, 0, 0);
+    float cosThetaMax = sqrt(1.0 - sin2ThetaMax);
+
+    // uniform direction inside the cone, around w
+    vec2 u = sample2D(dimension + DIM_LIGHT);
+    float cosTheta = 1.0 - u.x * (1.0 - cosThetaMax);
+    float sinTheta = sqrt(max(0.0, 1.0 - cosTheta * cosTheta));
+    float phi = 2.0 * PI * u.y;
+
+    vec3 w = toCentre / sqrt(dist2);
+    vec3 t = normalize(cross(abs(w.x) > 0.9 ? vec3(0, 1, 0) : vec3(1, 0, 0), w));
+    vec3 b = cross(w, t);
+    vec3 direction = normalize(t * cos(phi) * sinTheta + b * sin(phi) * sinTheta + w * cosTheta);
+
+    float cosSurface = dot(direction, normal);
+    if (cosSurface <= 0.0) return vec3(0, 0, 0);
+
+    // distance to the near side of the light along the sampled direction
+    float halfb = dot(-toCentre, direction);
+    float c = dist2 - light.radius * light.radius;
+    float tLight = -halfb - sqrt(max(0.0, halfb * halfb - c));
+
+    if (occludedScene(Ray(p, direction), 0.001, tLight - 0.001)) return vec3(0, 0, 0);
+
+    float pdfLight = 1.0 / (2.0 * PI * (1.0 - cosThetaMax) * LIGHT_COUNT);
+    float pdfBsdf = cosSurface / PI;
+
+    return albedo / PI * light.emission * cosSurface / pdfLight * powerHeuristic(pdfLight, pdfBsdf);
+}
+
+vec3 skyColour(vec3 unitDir) {
+    float a = 0.5 * unitDir.y + 1.0;
+    return (1.0 - a) * vec3(1, 1, 1) + a * vec3(0.5, 0.7, 1.0);
+}
+
+// Textures -----------------------------------------------------------------------------------
+// the same uvs, patterns and mip selection as CpuRenderer and TextureStore
+
+// what a bounce sees of the material, normal is the shading normal and fuzz a metal's roughness
+struct Surface {
+    vec3 albedo;
+    vec3 normal;
+    float fuzz;
+};
+
+#ifdef FEATURE_TEXTURES
+vec2 sphereUV(vec3 d) {
+    return vec2((atan(-d.z, d.x) + PI) / (2.0 * PI), acos(clamp(-d.y, -1.0, 1.0)) / PI);
+}
+
+float latticeValue(ivec3 c) {
+    return toUnitFloat(hash(uint(c.x) * 73856093u ^ uint(c.y) * 19349663u ^ uint(c.z) * 83492791u));
+}
+
+float valueNoise(vec3 p) {
+    vec3 i = floor(p);
+    vec3 f = p - i;
+    f = f * f * (vec3(3, 3, 3) - 2.0 * f);
+    ivec3 c = ivec3(i);
+
+    float front0 = mix(latticeValue(c), latticeValue(c + ivec3(1, 0, 0)), f.x);
+    float front1 = mix(latticeValue(c + ivec3(0, 1, 0)), latticeValue(c + ivec3(1, 1, 0)), f.x);
+    float back0 = mix(latticeValue(c + ivec3(0, 0, 1)), latticeValue(c + ivec3(1, 0, 1)), f.x);
+    float back1 = mix(latticeValue(c + ivec3(0, 1, 1)), latticeValue(c + ivec3(1, 1, 1)), f.x);
+    return mix(mix(front0, front1, f.y), mix(back0, back1, f.y), f.z);
+}
+
+// local is the hit point relative to the sphere's centre, coneWidth the ray cone's width there
+vec3 sampleTexture(int index, vec2 uv, vec3 local, float coneWidth, float radius) {
+    Texture t = textures[index];
+    if (t.type == TEXTURE_TYPE_CHECKER) {
+        int cell = int(floor(uv.x * t.scale * 2.0)) + int(floor(uv.y * t.scale));
+        return (cell & 1) != 0 ? t.colourB : t.colourA;
+    }
+    if (t.type == TEXTURE_TYPE_NOISE) {
+        vec3 p = local * t.scale;
+        float sum = 0.0, total = 0.0, amplitude = 0.5;
+        for (int i = 0; i < TEXTURE_NOISE_OCTAVES; i++) {
+            sum += amplitude * valueNoise(p);
+            total += amplitude;
+            p *= 2.0;
+            amplitude *= 0.5;
+        }
+        return mix(t.colourB, t.colourA, sum / total);
+    }
+    float lod = log2(max(coneWidth / (2.0 * PI * radius) * float(textureSize(textureArray, 0).x), 1e-6));
+    return textureLod(textureArray, vec3(uv, float(t.image)), lod).rgb;
+}
+#endif
+
+Surface getSurface(in HitRecord rec, in Material material, float coneWidth) {
+    Surface s = Surface(material.colour, rec.normal, 1.0 - material.reflective);
+#ifdef FEATURE_TEXTURES
+    if (material.emitter || (material.albedoTexture == TEXTURE_NONE && material.roughnessTexture == TEXTURE_NONE && material.normalTexture == TEXTURE_NONE)) return s;
+
+    Sphere sphere = spheres[rec.sphereIndex];
+    float radius = abs(sphere.radius);
+    vec3 local = rec.p - sphere.position;
+    vec3 d = local / radius;
+    vec2 uv = sphereUV(d);
+
+    if (material.albedoTexture != TEXTURE_NONE) s.albedo *= sampleTexture(material.albedoTexture, uv, local, coneWidth, radius);
+    if (material.roughnessTexture != TEXTURE_NONE) s.fuzz = sampleTexture(material.roughnessTexture, uv, local, coneWidth, radius).r;
+    // tangent along u and bitangent along v, undefined at the poles
+    if (material.normalTexture != TEXTURE_NONE && d.x * d.x + d.z * d.z > 1e-8) {
+        vec3 m = sampleTexture(material.normalTexture, uv, local, coneWidth, radius) * 2.0 - vec3(1, 1, 1);
+        vec3 t = normalize(vec3(d.z, 0.0, -d.x));
+        vec3 b = cross(d, t);
+        s.normal = normalize(t * m.x + b * m.y + d * m.z);
+        if (dot(s.normal, rec.normal) < 0.0) s.normal = -s.normal;
+    }
+#endif
+    return s;
+}
+
+// first hit features of the last traced path, written by getRayColour
+vec3 firstAlbedo;
+vec3 firstNormal;
+float firstDepth;
+
+void setFirstHit(in Ray ray, in HitRecord rec, in Surface surface) {
+    firstAlbedo = surface.albedo;
+    firstNormal = surface.normal;
+    firstDepth = distance(rec.p, ray.origin);
+}
+
+void setFirstMiss(vec3 unitDir) {
+    firstAlbedo = skyColour(unitDir);
+    firstNormal = -unitDir;
+    firstDepth = SKY_DEPTH;
+}
+
+// spread is the ray cone's width per unit of path length, for texture mip levels
+vec3 getRayColour(in Ray ray, inout uint segments, float spread) {
+    vec3 colour = vec3(1, 1, 1); // path throughput
+    vec3 radiance = vec3(0, 0, 0);
     Ray currentRay = Ray(ray.origin, ray.direction);
+    float pathLength = 0.0;
+
+    // set after a lambertian bounce, so an emitter hit can be weighted against light sampling
+    bool lastDiffuse = false;
+    float lastPdfBsdf = 0.0;
 
     for (int i = 0; i < MAX_BOUNCES; i++) {
+        segments++;
+        int dimension = i * DIMS_PER_BOUNCE;
+
         HitRecord rec;
-        if (hitWorldFast(currentRay, 0.001, INFINITY, rec)) {
+        if (hitScene(currentRay, 0.001, INFINITY, rec)) {
             vec3 newDirection;
-
-            if (rec.material.refractive > 0.0) { // refractive
-                float refractionRatio = rec.front_face ? (1.0 / rec.material.refractive) : rec.material.refractive;
+            Material material = materials[sphereMaterial(rec.sphereIndex)];
+            pathLength += distance(rec.p, currentRay.origin);
+            Surface surface = getSurface(rec, material, spread * pathLength);
+
+            if (i == 0) setFirstHit(currentRay, rec, surface);
+
+#ifdef FEATURE_EMITTER
+            if (material.emitter) { // emitters don't scatter
+                if (rec.front_face) {
+                    float weight = 1.0;
+                    if (lastDiffuse) {
+                        Sphere light = spheres[rec.sphereIndex];
+                        weight = powerHeuristic(lastPdfBsdf, lightPdf(currentRay.origin, light.position, abs(light.radius)));
+                    }
+                    radiance += colour * material.colour * weight;
+                }
+                break;
+            }
+            lastDiffuse = false;
+#endif
+
+            // only the branches for materials present in the scene are compiled,
+            // each one falls through to the next with a dangling else
+#ifdef FEATURE_REFRACTIVE
+            if (material.refractive > 0.0) { // refractive
+                float refractionRatio = rec.front_face ? (1.0 / material.refractive) : material.refractive;
                 vec3 unitDir = normalize(currentRay.direction);
 
-                float cosTheta = min(dot(-unitDir, rec.normal), 1.0);
+                float cosTheta = min(dot(-unitDir, surface.normal), 1.0);
                 float sinTheta = sqrt(1.0 - cosTheta * cosTheta);
 
                 bool cannotRefract = refractionRatio * sinTheta > 1.0;
 
-                if (cannotRefract || reflectance(cosTheta, refractionRatio) > random()) {
-                    newDirection = reflect(unitDir, rec.normal);
+                if (cannotRefract || reflectance(cosTheta, refractionRatio) > sample1D(dimension + DIM_CHOICE)) {
+                    newDirection = reflect(unitDir, surface.normal);
                 }
                 else {
-                    newDirection = refract(unitDir, rec.normal, refractionRatio);
+                    newDirection = refract(unitDir, surface.normal, refractionRatio);
                 }
             }
-            else if (rec.material.reflective > 0.0) { // specular
-                newDirection = reflect(normalize(currentRay.direction), rec.normal) + (1.0 - rec.material.reflective) * randomUnitVec3();
+            else
+#endif
+#ifdef FEATURE_SPECULAR
+            if (material.reflective > 0.0) { // specular
+                newDirection = reflect(normalize(currentRay.direction), surface.normal) + surface.fuzz * uniformSphere(sample2D(dimension + DIM_BSDF));
                 if (dot(newDirection, rec.normal) < 0) {
-                    colour = vec3(0, 0, 0);
                     break;
                 };
             }
-
-            else { // lambertian
-                newDirection = rec.normal + randomUnitVec3();
-
-                if (nearZero(newDirection)) {
-                    newDirection = rec.normal;
-                }
+            else
+#endif
+            { // lambertian
+#ifdef FEATURE_LAMBERTIAN
+                newDirection = cosineHemisphere(surface.normal, sample2D(dimension + DIM_BSDF));
+
+#ifdef FEATURE_EMITTER
+                radiance += colour * sampleLights(rec.p, surface.normal, surface.albedo, dimension);
+                lastDiffuse = true;
+                lastPdfBsdf = max(dot(newDirection, surface.normal), 0.0) / PI;
+#endif
+#endif
             }
 
             currentRay = Ray(rec.p, newDirection);
-            colour *= rec.material.colour;
+            colour *= surface.albedo;
+
+            // russian roulette: dim paths are ended early, survivors are boosted to stay unbiased
+            if (i + 1 >= RR_MIN_DEPTH) {
+                float survival = min(max(colour.r, max(colour.g, colour.b)), 0.95);
+                if (sample1D(dimension + DIM_RR) >= survival) break;
+                colour /= survival;
+            }
 
             continue;
         }
 
         vec3 unitDir = normalize(currentRay.direction);
-        float a = 0.5 * unitDir.y + 1.0;
-        colour *= (1.0 - a) * vec3(1, 1, 1) + a * vec3(0.5, 0.7, 1.0);
+        radiance += colour * skyColour(unitDir);
+
+        if (i == 0) setFirstMiss(unitDir);
         break;
     }
-    return colour;
+    return radiance;
 };
 
 vec3 getPixelSquare() {
     // random point in pixel
-    float px = -0.5 + random();
-    float py = -0.5 + random();
-    return camera.du * px + camera.dv * py;
+    vec2 u = sample2D(DIM_PIXEL) - vec2(0.5, 0.5);
+    return camera.du * u.x + camera.dv * u.y;
 }
 
 Ray getRay(in vec3 pos) {
@@ -372,17 +777,57 @@ void main() {
     // scale frag coords to nicer ones
     vec2 screenCoord = vec2(gl_FragCoord.x, gl_FragCoord.y);
     vec3 pixelCenter = camera.viewportTopLeft + screenCoord.x * camera.du + screenCoord.y * camera.dv;
+    // a pixel's height at the viewport, over the viewport's distance
+    float spread = length(camera.dv) / length(camera.viewportTopLeft - camera.position);
+
+    // skipped checkerboard pixels still need features for temporal.frag to validate history against,
+    // and write zero alpha so it knows to fill them in
+    if (checkerboard != 0 && ((pixel.x + pixel.y + frameIndex) & 1) != 0) {
+        Ray r = getRay(pixelCenter);
+        HitRecord rec;
+        if (hitScene(r, 0.001, INFINITY, rec)) {
+            setFirstHit(r, rec, getSurface(rec, materials[sphereMaterial(rec.sphereIndex)], spread * distance(rec.p, r.origin)));
+        }
+        else setFirstMiss(normalize(r.direction));
+
+        FragColor = vec4(0.0, 0.0, 0.0, 0.0);
+        FragAlbedo = vec4(firstAlbedo, 1.0);
+        FragNormal = vec4(firstNormal, 1.0);
+        FragDepth = firstDepth;
+        return;
+    }
 
     // antialiasing
     vec3 accumColour = vec3(0.0, 0.0, 0.0);
+    vec3 accumAlbedo = vec3(0.0, 0.0, 0.0);
+    vec3 accumNormal = vec3(0.0, 0.0, 0.0);
+    float accumDepth = 0.0;
+    uint segments = 0u;
     for (int i = 0; i < SAMPLES; i++) {
+        sampleIndex = uint(frameIndex * SAMPLES + i);
+
         // fire sample ray at random point in pixel
         Ray r = getRay(pixelCenter + getPixelSquare());
-        accumColour += getRayColour(r);
+        accumColour += getRayColour(r, segments, spread);
+        accumAlbedo += firstAlbedo;
+        accumNormal += firstNormal;
+        accumDepth += firstDepth;
     }
 
-    vec3 outColour = accumColour / SAMPLES;
-
-    FragColor = sqrt(outColour);
+#ifdef PATH_STATS
+    atomicAdd(pathCount, uint(SAMPLES));
+    atomicAdd(segmentCount, segments);
+#endif
+#ifdef TRACE_STATS
+    atomicAdd(rayCount, statRays);
+    atomicAdd(nodeVisits, statNodeVisits);
+    atomicAdd(primitiveTests, statPrimitiveTests);
+#endif
+
+    // gamma correction happens in texture.frag so the denoiser gets linear values
+    FragColor = vec4(accumColour / SAMPLES, 1.0);
+    FragAlbedo = vec4(accumAlbedo / SAMPLES, 1.0);
+    FragNormal = vec4(normalize(accumNormal), 1.0);
+    FragDepth = accumDepth / SAMPLES;
 
 }
\ No newline at end of file
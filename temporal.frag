@@ -0,0 +1,140 @@
+#version 460 core
+
+// temporal accumulation for the viewer. each pixel's first hit is rebuilt from the depth buffer,
+// projected into the previous frame's camera, and blended with the history there if the depth
+// and normal stored with the history agree with it. pixels skipped by checkerboarding keep the
+// history as is, or are filled from their neighbours when there is none.
+// the targets can be bigger than the render, so bounds come from each camera's screenRes
+
+in vec2 UV;
+
+layout(location = 0) out vec4 HistoryColour; // rgb colour, a frames accumulated
+layout(location = 1) out vec4 HistoryFeatures; // xyz normal, w depth
+
+struct Camera {
+    vec3 position;
+    vec3 viewportTopLeft;
+    vec3 du; // viewport vectors
+    vec3 dv;
+    vec3 backgroundColour;
+    vec2 screenRes;
+};
+
+layout (std140, binding = 0) uniform cameraBuffer {
+    Camera camera;
+};
+
+layout (std140, binding = 4) uniform previousCameraBuffer {
+    Camera previousCamera;
+};
+
+layout(binding = 0) uniform sampler2D colourTexture;
+layout(binding = 3) uniform sampler2D normalTexture;
+layout(binding = 4) uniform sampler2D depthTexture;
+layout(binding = 5) uniform sampler2D historyColourTexture;
+layout(binding = 6) uniform sampler2D historyFeaturesTexture;
+
+uniform int maxHistory;
+uniform int resetHistory;
+
+// relative depth difference and normal cosine a history sample has to be within
+#define DEPTH_TOLERANCE 0.05
+#define NORMAL_TOLERANCE 0.9
+
+// where a world position lands in the previous frame, in the same units as gl_FragCoord.
+// false if it is behind the previous camera
+bool reproject(vec3 p, out vec2 fragCoord) {
+    vec3 d = p - previousCamera.position;
+    vec3 n = cross(previousCamera.du, previousCamera.dv);
+    float denom = dot(d, n);
+    if (abs(denom) < 1e-8) return false;
+
+    float t = dot(previousCamera.viewportTopLeft - previousCamera.position, n) / denom;
+    if (t <= 0.0) return false;
+
+    vec3 q = previousCamera.position + t * d - previousCamera.viewportTopLeft;
+    fragCoord = vec2(dot(q, previousCamera.du) / dot(previousCamera.du, previousCamera.du), dot(q, previousCamera.dv) / dot(previousCamera.dv, previousCamera.dv));
+    return true;
+}
+
+bool inside(ivec2 q, vec2 size) {
+    return all(greaterThanEqual(q, ivec2(0))) && all(lessThan(q, ivec2(size)));
+}
+
+// average of the traced 4-neighbours, which is all of them with checkerboarding
+vec3 fillHole(ivec2 p) {
+    const ivec2 offsets[4] = ivec2[4](ivec2(1, 0), ivec2(-1, 0), ivec2(0, 1), ivec2(0, -1));
+    vec3 sum = vec3(0.0);
+    float count = 0.0;
+    for (int i = 0; i < 4; i++) {
+        ivec2 q = p + offsets[i];
+        if (!inside(q, camera.screenRes)) continue;
+        vec4 c = texelFetch(colourTexture, q, 0);
+        sum += c.rgb * c.a;
+        count += c.a;
+    }
+    return count > 0.0 ? sum / count : vec3(0.0);
+}
+
+void main() {
+    ivec2 p = ivec2(gl_FragCoord.xy);
+
+    vec4 current = texelFetch(colourTexture, p, 0);
+    bool traced = current.a > 0.0;
+    vec3 colour = traced ? current.rgb : fillHole(p);
+    vec3 normal = texelFetch(normalTexture, p, 0).rgb;
+    float depth = texelFetch(depthTexture, p, 0).r;
+    HistoryFeatures = vec4(normal, depth);
+
+    // first hit position, through the pixel centre
+    vec3 pixelCentre = camera.viewportTopLeft + gl_FragCoord.x * camera.du + gl_FragCoord.y * camera.dv;
+    vec3 position = camera.position + normalize(pixelCentre - camera.position) * depth;
+
+    vec2 previousCoord;
+    if (resetHistory != 0 || !reproject(position, previousCoord)) {
+        HistoryColour = vec4(colour, 1.0);
+        return;
+    }
+    float expectedDepth = distance(position, previousCamera.position);
+
+    // bilinear over the four nearest history texels, dropping the ones that fail validation
+    vec2 base = previousCoord - 0.5;
+    ivec2 corner = ivec2(floor(base));
+    vec2 f = base - vec2(corner);
+
+    vec3 historyColour = vec3(0.0);
+    float historyCount = 0.0;
+    float totalWeight = 0.0;
+    for (int j = 0; j <= 1; j++) {
+        for (int i = 0; i <= 1; i++) {
+            ivec2 q = corner + ivec2(i, j);
+            if (!inside(q, previousCamera.screenRes)) continue;
+
+            vec4 features = texelFetch(historyFeaturesTexture, q, 0);
+            if (abs(features.w - expectedDepth) > DEPTH_TOLERANCE * expectedDepth) continue;
+            if (dot(features.xyz, normal) < NORMAL_TOLERANCE) continue;
+
+            float w = (i == 0 ? 1.0 - f.x : f.x) * (j == 0 ? 1.0 - f.y : f.y);
+            vec4 history = texelFetch(historyColourTexture, q, 0);
+            historyColour += history.rgb * w;
+            historyCount += history.a * w;
+            totalWeight += w;
+        }
+    }
+
+    if (totalWeight < 1e-4) {
+        HistoryColour = vec4(colour, 1.0);
+        return;
+    }
+
+    historyColour /= totalWeight;
+    historyCount /= totalWeight;
+    if (!traced) {
+        HistoryColour = vec4(historyColour, historyCount);
+        return;
+    }
+
+    // running average over at most maxHistory frames, so it keeps adapting while the camera moves
+    float count = min(historyCount + 1.0, float(maxHistory));
+    HistoryColour = vec4(mix(historyColour, colour, 1.0 / count), count);
+}
@@ -5,7 +5,38 @@ in vec2 UV;
 out vec3 colour;
 
 uniform sampler2D renderedTexture;
+// pixels actually rendered, the bottom left of the texture when the viewer renders below window size
+uniform vec2 renderSize;
+
+// catmull-rom weights for the 4 texels around t in [0, 1)
+vec4 catmullRom(float t) {
+	float t2 = t * t;
+	float t3 = t2 * t;
+	return vec4(
+		-0.5 * t3 + t2 - 0.5 * t,
+		1.5 * t3 - 2.5 * t2 + 1.0,
+		-1.5 * t3 + 2.0 * t2 + 0.5 * t,
+		0.5 * t3 - 0.5 * t2
+	);
+}
 
 void main() {
-	colour = texture(renderedTexture, UV).rgb;
-}
\ No newline at end of file
+	// bicubic upscale, which stays sharper than bilinear and is exact at scale 1
+	vec2 coord = UV * renderSize - 0.5;
+	ivec2 base = ivec2(floor(coord));
+	vec2 f = coord - vec2(base);
+	vec4 wx = catmullRom(f.x);
+	vec4 wy = catmullRom(f.y);
+	ivec2 maxCoord = ivec2(renderSize) - 1;
+
+	vec3 sum = vec3(0.0);
+	for (int j = 0; j < 4; j++) {
+		for (int i = 0; i < 4; i++) {
+			ivec2 q = clamp(base + ivec2(i - 1, j - 1), ivec2(0), maxCoord);
+			sum += texelFetch(renderedTexture, q, 0).rgb * wx[i] * wy[j];
+		}
+	}
+
+	// the ray tracer writes linear colour, gamma correct it here
+	colour = sqrt(max(sum, vec3(0.0)));
+}